@@ -0,0 +1,581 @@
+/*
+ * Licensed under the GPLv2
+ *
+ * Wire-efficiency benchmarks against the MPSSE emulator: per operation, the
+ * USB transactions, MPSSE bytes, bus time and host time it costs. Every case
+ * prints one JSON object per line, to be compared across versions.
+ *
+ * I2C: 24C256 at 0x50, DS3231 at 0x68, SSD1306 at 0x3c, a BME280 at 0x77
+ * NACKing every register byte, and a BME280 at 0x76 and a 24C256 at 0x54
+ * stretching SCL after every byte (their cases follow it, at 3.4 MHz).
+ * SPI: a 16 MiB NOR flash holding a pattern at 1 MiB, GPIO waveforms run next
+ * to it, and one taking its maximum page program time.
+ */
+#include <err.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ftdi_mpsse.h>
+
+#define ARRAY_SIZE(x)	(sizeof(x) / sizeof(*x))
+
+/* where the NOR flash holds a known pattern */
+#define BENCH_NOR_PATTERN	0x100000
+/* ms, for the stalled link case */
+#define BENCH_READ_TIMEOUT	100
+
+struct bench_case {
+	const char *name;
+	bool spi;
+	unsigned int iterations;
+	/* NULL: the case measures the init itself */
+	int (*run)(struct ftdi_mpsse *ftdi_mpsse);
+	bool warm;
+	bool stretch;
+	/* the link stalls past the read timeout once, early in the case */
+	bool stall;
+	/* the flash takes its maximum tPP, the first polls of a batch miss it */
+	bool slow_pp;
+};
+
+static uint8_t bench_buf[65536];
+static struct ftdi_emu_device *bench_nor;
+
+static int bench_i2c_write_reg(struct ftdi_mpsse *ftdi_mpsse)
+{
+	uint8_t buf[] = { 0x10, 0x5a };
+	const struct ftdi_i2c_msg msg = { .addr = 0x68, .len = sizeof(buf), .buf = buf };
+
+	return ftdi_i2c_transfer(ftdi_mpsse, &msg, 1);
+}
+
+static int bench_i2c_read_reg(struct ftdi_mpsse *ftdi_mpsse)
+{
+	uint8_t reg = 0x10;
+	const struct ftdi_i2c_msg msgs[] = {
+		{ .addr = 0x68, .len = 1, .buf = &reg },
+		{ .addr = 0x68, .flags = FTDI_I2C_M_RD, .len = 1, .buf = bench_buf },
+	};
+
+	return ftdi_i2c_transfer(ftdi_mpsse, msgs, 2);
+}
+
+static int bench_i2c_eeprom_read(struct ftdi_mpsse *ftdi_mpsse)
+{
+	uint8_t offset[] = { 0x00, 0x00 };
+	const struct ftdi_i2c_msg msgs[] = {
+		{ .addr = 0x50, .len = sizeof(offset), .buf = offset },
+		{ .addr = 0x50, .flags = FTDI_I2C_M_RD, .len = 128, .buf = bench_buf },
+	};
+
+	return ftdi_i2c_transfer(ftdi_mpsse, msgs, 2);
+}
+
+/* a page write, then ACK polling until the write cycle is over */
+static int bench_i2c_eeprom_write(struct ftdi_mpsse *ftdi_mpsse)
+{
+	uint8_t buf[2 + 64] = { 0x00, 0x40 };
+	const struct ftdi_i2c_msg msg = { .addr = 0x50, .len = sizeof(buf), .buf = buf };
+	int ret;
+
+	ret = ftdi_i2c_transfer(ftdi_mpsse, &msg, 1);
+	if (ret < 0)
+		return ret;
+
+	for (unsigned int polls = 0; polls < 1000; polls++) {
+		ret = ftdi_i2c_begin(ftdi_mpsse, 0x50, true);
+		ftdi_i2c_end(ftdi_mpsse);
+		if (ret >= 0)
+			return 0;
+	}
+
+	return ret;
+}
+
+/* the error path: the register byte is NACKed */
+static int bench_i2c_nack(struct ftdi_mpsse *ftdi_mpsse)
+{
+	uint8_t reg = 0xd0;
+	const struct ftdi_i2c_msg msgs[] = {
+		{ .addr = 0x77, .len = 1, .buf = &reg },
+		{ .addr = 0x77, .flags = FTDI_I2C_M_RD, .len = 1, .buf = bench_buf },
+	};
+
+	if (ftdi_i2c_transfer(ftdi_mpsse, msgs, 2) >= 0) {
+		warnx("%s: the NACK was missed", __func__);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int bench_i2c_stretch_read(struct ftdi_mpsse *ftdi_mpsse)
+{
+	uint8_t reg = 0xd0;
+	const struct ftdi_i2c_msg msgs[] = {
+		{ .addr = 0x76, .len = 1, .buf = &reg },
+		{ .addr = 0x76, .flags = FTDI_I2C_M_RD, .len = 1, .buf = bench_buf },
+	};
+	int ret;
+
+	ret = ftdi_i2c_transfer(ftdi_mpsse, msgs, 2);
+	if (ret < 0)
+		return ret;
+
+	if (bench_buf[0] != 0x60) {
+		warnx("%s: read ID 0x%02x", __func__, bench_buf[0]);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* a page written while SCL is stretched must reach the memory */
+static int bench_i2c_stretch_eeprom_write(struct ftdi_mpsse *ftdi_mpsse)
+{
+	static uint8_t pattern;
+	uint8_t buf[2 + 64] = { 0x00, 0x40 };
+	const struct ftdi_i2c_msg msgs[] = {
+		{ .addr = 0x54, .len = 2, .buf = buf },
+		{ .addr = 0x54, .flags = FTDI_I2C_M_RD, .len = 64, .buf = bench_buf },
+	};
+	const struct ftdi_i2c_msg msg = { .addr = 0x54, .len = sizeof(buf), .buf = buf };
+	int ret;
+
+	pattern++;
+	for (unsigned int a = 0; a < 64; a++)
+		buf[2 + a] = pattern + a;
+
+	ret = ftdi_i2c_transfer(ftdi_mpsse, &msg, 1);
+	if (ret < 0)
+		return ret;
+
+	for (unsigned int polls = 0; polls < 1000; polls++) {
+		ret = ftdi_i2c_transfer(ftdi_mpsse, msgs, 2);
+		if (ret >= 0)
+			break;
+	}
+	if (ret < 0)
+		return ret;
+
+	if (memcmp(bench_buf, buf + 2, 64)) {
+		warnx("%s: the page write was lost", __func__);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* a reset pulse, then an enable and a 4-bit mux select stepped through */
+static int bench_gpio_waveform(struct ftdi_mpsse *ftdi_mpsse)
+{
+	const uint16_t mask = FTDI_GPIOL(0) | FTDI_GPIOL(1) | 0x0f00;
+	struct ftdi_gpio_step steps[2 + 16];
+
+	steps[0] = (struct ftdi_gpio_step){ .val = 0, .dir = mask, .hold = 16 };
+	steps[1] = (struct ftdi_gpio_step){ .val = FTDI_GPIOL(0), .dir = mask, .hold = 16 };
+	for (unsigned int a = 0; a < 16; a++)
+		steps[2 + a] = (struct ftdi_gpio_step){
+			.val = FTDI_GPIOL(0) | FTDI_GPIOL(1) | a << 8, .dir = mask, .hold = 4,
+		};
+
+	return ftdi_gpio_waveform(ftdi_mpsse, mask, steps, ARRAY_SIZE(steps));
+}
+
+/* a 128x64 SSD1306 frame, the way examples/oled.c sends it */
+static int bench_i2c_display(struct ftdi_mpsse *ftdi_mpsse)
+{
+	int ret;
+
+	ftdi_i2c_set_posted(ftdi_mpsse, true);
+	ret = ftdi_i2c_begin(ftdi_mpsse, 0x3c, true);
+	if (ret < 0)
+		return ret;
+	ftdi_i2c_send_check_ack(ftdi_mpsse, 0x40);
+	for (unsigned int a = 0; a < 1024; a++)
+		ftdi_i2c_enqueue_writebyte(ftdi_mpsse, bench_buf[a]);
+
+	return ftdi_i2c_end(ftdi_mpsse);
+}
+
+static int bench_spi_byte(struct ftdi_mpsse *ftdi_mpsse)
+{
+	uint8_t c = 0x9f;
+	int ret;
+
+	ret = ftdi_spi_begin(ftdi_mpsse);
+	if (ret < 0)
+		return ret;
+	ret = ftdi_spi_sendrecv(ftdi_mpsse, &c);
+	if (ret < 0)
+		return ret;
+
+	return ftdi_spi_end(ftdi_mpsse);
+}
+
+static int bench_spi_bulk(struct ftdi_mpsse *ftdi_mpsse)
+{
+	int ret;
+
+	ret = ftdi_spi_begin(ftdi_mpsse);
+	if (ret < 0)
+		return ret;
+	ret = ftdi_spi_transfer(ftdi_mpsse, bench_buf, bench_buf, sizeof(bench_buf));
+	if (ret < 0)
+		return ret;
+
+	return ftdi_spi_end(ftdi_mpsse);
+}
+
+static int bench_spi_flash_read(struct ftdi_mpsse *ftdi_mpsse)
+{
+	return ftdi_spiflash_read(ftdi_mpsse, 0, bench_buf, sizeof(bench_buf));
+}
+
+/*
+ * The first read runs into the read timeout mid-stream. The replies it left
+ * in the chip must not end up in the next read.
+ */
+static int bench_spi_flash_read_timeout(struct ftdi_mpsse *ftdi_mpsse)
+{
+	const uint8_t *mem = ftdi_emu_spinor_get_memory(bench_nor) + BENCH_NOR_PATTERN;
+	static bool stalled;
+	int ret;
+
+	ret = ftdi_spiflash_read(ftdi_mpsse, BENCH_NOR_PATTERN, bench_buf, sizeof(bench_buf));
+	if (!stalled) {
+		if (ret >= 0) {
+			warnx("%s: the stalled read did not fail", __func__);
+			return -1;
+		}
+		stalled = true;
+		ret = ftdi_spiflash_read(ftdi_mpsse, BENCH_NOR_PATTERN, bench_buf,
+					 sizeof(bench_buf));
+	}
+	if (ret < 0)
+		return ret;
+
+	if (memcmp(bench_buf, mem, sizeof(bench_buf))) {
+		warnx("%s: stale data after the timeout", __func__);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* a sector erase, then its 16 pages with a pattern new every time, verified */
+static int bench_spi_flash_write(struct ftdi_mpsse *ftdi_mpsse)
+{
+	static unsigned int round;
+	int ret;
+
+	round++;
+	for (unsigned int a = 0; a < 0x1000; a++)
+		bench_buf[a] = a * 7 ^ a >> 8 ^ round * 0x5b;
+
+	ret = ftdi_spiflash_erase(ftdi_mpsse, 0, 0x1000);
+	if (ret < 0)
+		return ret;
+
+	ret = ftdi_spiflash_write(ftdi_mpsse, 0, bench_buf, 0x1000);
+	if (ret < 0)
+		return ret;
+
+	return ftdi_spiflash_verify(ftdi_mpsse, 0, bench_buf, 0x1000);
+}
+
+static const struct bench_case bench_cases[] = {
+	{ .name = "i2c_init_cold", .iterations = 5 },
+	{ .name = "i2c_init_warm", .iterations = 20, .warm = true },
+	{ .name = "spi_init_cold", .spi = true, .iterations = 5 },
+	{ .name = "i2c_write_reg", .iterations = 200, .run = bench_i2c_write_reg },
+	{ .name = "i2c_read_reg", .iterations = 200, .run = bench_i2c_read_reg },
+	{ .name = "i2c_eeprom_read_128", .iterations = 50, .run = bench_i2c_eeprom_read },
+	{ .name = "i2c_eeprom_write_64", .iterations = 10, .run = bench_i2c_eeprom_write },
+	{ .name = "i2c_display_1k", .iterations = 10, .run = bench_i2c_display },
+	{ .name = "i2c_nack", .iterations = 200, .run = bench_i2c_nack },
+	{ .name = "i2c_stretch_read", .iterations = 200, .run = bench_i2c_stretch_read,
+	  .stretch = true },
+	{ .name = "i2c_stretch_eeprom_write_64", .iterations = 10,
+	  .run = bench_i2c_stretch_eeprom_write, .stretch = true },
+	{ .name = "spi_byte", .spi = true, .iterations = 200, .run = bench_spi_byte },
+	{ .name = "spi_bulk_64k", .spi = true, .iterations = 5, .run = bench_spi_bulk },
+	{ .name = "spi_flash_read_64k", .spi = true, .iterations = 5, .run = bench_spi_flash_read },
+	{ .name = "spi_flash_write_4k", .spi = true, .iterations = 5, .run = bench_spi_flash_write },
+	{ .name = "spi_flash_write_slow_4k", .spi = true, .iterations = 5,
+	  .run = bench_spi_flash_write, .slow_pp = true },
+	{ .name = "spi_flash_read_timeout", .spi = true, .iterations = 5,
+	  .run = bench_spi_flash_read_timeout, .stall = true },
+	{ .name = "gpio_waveform", .spi = true, .iterations = 200, .run = bench_gpio_waveform },
+};
+
+struct bench_result {
+	struct ftdi_mpsse_stats stats;
+	uint64_t bus_ns;
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+};
+
+static uint64_t bench_now_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_add(struct bench_result *res, const struct ftdi_mpsse *ftdi_mpsse)
+{
+	struct ftdi_mpsse_stats stats;
+
+	ftdi_mpsse_get_stats(ftdi_mpsse, &stats);
+	res->stats.usb_writes += stats.usb_writes;
+	res->stats.usb_reads += stats.usb_reads;
+	res->stats.bytes_out += stats.bytes_out;
+	res->stats.bytes_in += stats.bytes_in;
+	res->stats.round_trips += stats.round_trips;
+	res->bus_ns += ftdi_emu_get_bus_ns(ftdi_mpsse);
+}
+
+static int bench_open(struct ftdi_mpsse *ftdi_mpsse, const struct bench_case *bc,
+		      const struct ftdi_mpsse_config *conf)
+{
+	return bc->spi ? ftdi_spi_init(ftdi_mpsse, conf) : ftdi_i2c_init(ftdi_mpsse, conf);
+}
+
+static void bench_close(struct ftdi_mpsse *ftdi_mpsse, const struct bench_case *bc)
+{
+	if (bc->spi)
+		ftdi_spi_close(ftdi_mpsse);
+	else
+		ftdi_i2c_close(ftdi_mpsse);
+}
+
+static int bench_run(const struct bench_case *bc, struct ftdi_mpsse_config *conf,
+		     unsigned int iterations, struct bench_result *res)
+{
+	struct ftdi_mpsse ftdi_mpsse;
+	uint64_t wall, cpu;
+	int ret;
+
+	memset(res, 0, sizeof(*res));
+	conf->warm_attach = bc->warm;
+
+	if (!bc->run) {
+		for (unsigned int a = 0; a < iterations; a++) {
+			wall = bench_now_ns(CLOCK_MONOTONIC);
+			cpu = bench_now_ns(CLOCK_PROCESS_CPUTIME_ID);
+			ret = bench_open(&ftdi_mpsse, bc, conf);
+			if (ret < 0)
+				goto err;
+			res->wall_ns += bench_now_ns(CLOCK_MONOTONIC) - wall;
+			res->cpu_ns += bench_now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+			bench_add(res, &ftdi_mpsse);
+			bench_close(&ftdi_mpsse, bc);
+		}
+		return 0;
+	}
+
+	ret = bench_open(&ftdi_mpsse, bc, conf);
+	if (ret < 0)
+		goto err;
+
+	/* one untimed pass, so that the buffers are allocated */
+	ret = bc->run(&ftdi_mpsse);
+	if (ret < 0)
+		goto close;
+	ftdi_mpsse_reset_stats(&ftdi_mpsse);
+	res->bus_ns -= ftdi_emu_get_bus_ns(&ftdi_mpsse);
+
+	wall = bench_now_ns(CLOCK_MONOTONIC);
+	cpu = bench_now_ns(CLOCK_PROCESS_CPUTIME_ID);
+	for (unsigned int a = 0; a < iterations; a++) {
+		ret = bc->run(&ftdi_mpsse);
+		if (ret < 0)
+			goto close;
+	}
+	res->wall_ns = bench_now_ns(CLOCK_MONOTONIC) - wall;
+	res->cpu_ns = bench_now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+	bench_add(res, &ftdi_mpsse);
+	bench_close(&ftdi_mpsse, bc);
+
+	return 0;
+close:
+	bench_close(&ftdi_mpsse, bc);
+err:
+	warnx("%s: %s", bc->name, ftdi_mpsse_get_error(&ftdi_mpsse));
+	return ret;
+}
+
+static void bench_print(const struct bench_case *bc, unsigned int iterations,
+			unsigned int latency_us, const struct bench_result *res)
+{
+	double n = iterations;
+
+	printf("{\"bench\": \"%s\", \"version\": \"%s\", \"iterations\": %u, \"latency_us\": %u, "
+	       "\"usb_writes\": %.2f, \"usb_reads\": %.2f, \"round_trips\": %.2f, "
+	       "\"bytes_out\": %.1f, \"bytes_in\": %.1f, \"bus_us\": %.1f, "
+	       "\"wall_us\": %.1f, \"cpu_us\": %.1f}\n",
+	       bc->name, FTDI_MPSSE_VERSION, iterations, latency_us,
+	       res->stats.usb_writes / n, res->stats.usb_reads / n, res->stats.round_trips / n,
+	       res->stats.bytes_out / n, res->stats.bytes_in / n, res->bus_ns / n / 1000,
+	       res->wall_ns / n / 1000, res->cpu_ns / n / 1000);
+}
+
+static void usage(const char *prgname)
+{
+	fprintf(stderr, "Usage: %s [-l <latency_us>] [-n <iterations>] [<case>...]\n", prgname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "-l <latency_us> -- emulated USB round trip (default 125)\n");
+	fprintf(stderr, "-n <iterations> -- override the per-case iteration count\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Cases:\n");
+	for (unsigned int a = 0; a < ARRAY_SIZE(bench_cases); a++)
+		fprintf(stderr, "\t%s\n", bench_cases[a].name);
+}
+
+int main(int argc, char **argv)
+{
+	const struct ftdi_emu_i2c_faults nack_reg = { .nack_at = 1 };
+	const struct ftdi_emu_i2c_faults stretch = { .nack_at = -1, .stretch_ns = 2000 };
+	struct ftdi_emu_device *i2c_devs[] = {
+		ftdi_emu_24cxx_new(0x50, 32768, 64),
+		ftdi_emu_ds3231_new(0x68),
+		ftdi_emu_ssd1306_new(0x3c),
+		ftdi_emu_bme280_new(0x77),
+		ftdi_emu_bme280_new(0x76),
+		ftdi_emu_24cxx_new(0x54, 32768, 64),
+	};
+	struct ftdi_emu_device *spi_devs[] = {
+		ftdi_emu_spinor_new(0xef4018, 16 << 20),
+	};
+	struct ftdi_emu_device *spi_slow_devs[] = {
+		ftdi_emu_spinor_new(0xef4018, 16 << 20),
+	};
+	struct ftdi_emu_config i2c_emu = {
+		.latency_us = 125,
+		.tied = { BIT(1) | BIT(2) },	/* SDA on DO and DI */
+		.devices = i2c_devs,
+		.num_devices = ARRAY_SIZE(i2c_devs),
+	};
+	struct ftdi_emu_config i2c_stretch_emu = {
+		.latency_us = 125,
+		.tied = {
+			BIT(1) | BIT(2),	/* SDA on DO and DI */
+			BIT(0) | BIT(5) | BIT(7),	/* SCL on SK, GPIOL1 and GPIOL3 (RTCK) */
+		},
+		.devices = i2c_devs,
+		.num_devices = ARRAY_SIZE(i2c_devs),
+	};
+	struct ftdi_emu_config spi_emu = {
+		.latency_us = 125,
+		.devices = spi_devs,
+		.num_devices = ARRAY_SIZE(spi_devs),
+	};
+	struct ftdi_emu_config spi_slow_emu = {
+		.latency_us = 125,
+		.devices = spi_slow_devs,
+		.num_devices = ARRAY_SIZE(spi_slow_devs),
+	};
+	/* the stall outlasts the read timeout, not the resync after it */
+	struct ftdi_emu_config spi_stall_emu = {
+		.latency_us = 125,
+		.stall_ms = 3 * BENCH_READ_TIMEOUT / 2,
+		.stall_at = 4096,
+		.devices = spi_devs,
+		.num_devices = ARRAY_SIZE(spi_devs),
+	};
+	struct ftdi_mpsse_config conf = {
+		.transport = &ftdi_mpsse_transport_emu,
+	};
+	unsigned int iterations = 0;
+	bool selected[ARRAY_SIZE(bench_cases)] = {};
+	bool any = false;
+	int ret, failed = 0;
+
+	for (unsigned int a = 0; a < ARRAY_SIZE(i2c_devs); a++)
+		if (!i2c_devs[a])
+			errx(EXIT_FAILURE, "cannot allocate the devices");
+	if (!spi_devs[0] || !spi_slow_devs[0])
+		errx(EXIT_FAILURE, "cannot allocate the devices");
+	/* tPP max of a W25Q128 */
+	ftdi_emu_spinor_set_tpp(spi_slow_devs[0], 3000000);
+	bench_nor = spi_devs[0];
+	for (unsigned int a = 0; a < sizeof(bench_buf); a++)
+		ftdi_emu_spinor_get_memory(bench_nor)[BENCH_NOR_PATTERN + a] = a ^ a >> 8;
+	ftdi_emu_i2c_set_faults(i2c_devs[3], &nack_reg);
+	ftdi_emu_i2c_set_faults(i2c_devs[4], &stretch);
+	ftdi_emu_i2c_set_faults(i2c_devs[5], &stretch);
+
+	while ((ret = getopt(argc, argv, "l:n:")) >= 0) {
+		switch (ret) {
+		case 'l':
+			i2c_emu.latency_us = strtoul(optarg, NULL, 0);
+			i2c_stretch_emu.latency_us = spi_emu.latency_us = i2c_emu.latency_us;
+			spi_stall_emu.latency_us = spi_slow_emu.latency_us = i2c_emu.latency_us;
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (int a = optind; a < argc; a++) {
+		unsigned int c;
+
+		for (c = 0; c < ARRAY_SIZE(bench_cases); c++)
+			if (!strcmp(argv[a], bench_cases[c].name))
+				break;
+		if (c == ARRAY_SIZE(bench_cases)) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		selected[c] = any = true;
+	}
+
+	for (unsigned int c = 0; c < ARRAY_SIZE(bench_cases); c++) {
+		const struct bench_case *bc = &bench_cases[c];
+		unsigned int n = iterations ? : bc->iterations;
+		struct bench_result res;
+
+		if (any && !selected[c])
+			continue;
+
+		conf.i2c_clock_stretch = bc->stretch;
+		conf.read_timeout = bc->stall ? BENCH_READ_TIMEOUT : 0;
+		if (bc->stall || bc->slow_pp) {
+			conf.transport_conf = bc->stall ? &spi_stall_emu : &spi_slow_emu;
+			conf.speed = FTDI_SPI_SPD_MAX;
+		} else if (bc->spi) {
+			conf.transport_conf = &spi_emu;
+			conf.speed = FTDI_SPI_SPD_MAX;
+		} else if (bc->stretch) {
+			conf.transport_conf = &i2c_stretch_emu;
+			conf.speed = FTDI_I2C_SPD_HIGH;
+		} else {
+			conf.transport_conf = &i2c_emu;
+			conf.speed = FTDI_I2C_SPD_FAST;
+		}
+
+		if (bench_run(bc, &conf, n, &res) < 0) {
+			failed = 1;
+			continue;
+		}
+		bench_print(bc, n, spi_emu.latency_us, &res);
+	}
+
+	for (unsigned int a = 0; a < ARRAY_SIZE(i2c_devs); a++)
+		ftdi_emu_device_free(i2c_devs[a]);
+	ftdi_emu_device_free(spi_devs[0]);
+	ftdi_emu_device_free(spi_slow_devs[0]);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -43,40 +43,49 @@ struct BME280_compensation {
 	};
 };
 
-static int BME280_get_compensation(struct ftdi_mpsse *ftdi_mpsse,
-				    struct BME280_compensation *comp)
-{
-	uint8_t msb, lsb;
-	int ret;
+static const struct ftdi_regmap_range BME280_ranges[] = {
+	{ 0x88, 0xa1, FTDI_REGMAP_READABLE }, // calib00..25
+	{ 0xd0, 0xd0, FTDI_REGMAP_READABLE }, // id
+	{ 0xe0, 0xe0, FTDI_REGMAP_WRITABLE | FTDI_REGMAP_VOLATILE }, // reset
+	{ 0xe1, 0xe7, FTDI_REGMAP_READABLE }, // calib26..32
+	{ 0xf2, 0xf2, FTDI_REGMAP_READABLE | FTDI_REGMAP_WRITABLE }, // ctrl_hum
+	{ 0xf3, 0xf3, FTDI_REGMAP_READABLE | FTDI_REGMAP_VOLATILE }, // status
+	{ 0xf4, 0xf5, FTDI_REGMAP_READABLE | FTDI_REGMAP_WRITABLE }, // ctrl_meas, config
+	{ 0xf7, 0xfe, FTDI_REGMAP_READABLE | FTDI_REGMAP_VOLATILE }, // data
+};
 
-	for (unsigned i = 0; i < sizeof(comp->reg_88_9f) / sizeof(*comp->reg_88_9f); i++) {
-		ftdi_i2c_recv_send_ack(ftdi_mpsse, &lsb, 1, false);
-		ftdi_i2c_recv_send_ack(ftdi_mpsse, &msb, 1, false);
-		comp->reg_88_9f[i] = (msb << 8U) | lsb;
-	}
+static const struct ftdi_regmap_config BME280_regmap = {
+	.bus = FTDI_REGMAP_I2C,
+	.address = 0x76,
+	.val_bits = 8,
+	.max_register = 0xfe,
+	.ranges = BME280_ranges,
+	.num_ranges = sizeof(BME280_ranges) / sizeof(*BME280_ranges),
+	.write_pairs = true,
+};
 
-	ftdi_i2c_recv_send_ack(ftdi_mpsse, &msb, 1, false); // a0
-	ftdi_i2c_recv_send_ack(ftdi_mpsse, &comp->reg_a1, 1, true);
+static int BME280_get_compensation(struct ftdi_regmap *map, struct BME280_compensation *comp)
+{
+	unsigned int calib[0xa2 - 0x88], hum[0xe8 - 0xe1];
+	int ret;
 
-	ret = ftdi_i2c_begin(ftdi_mpsse, 0x76, true);
+	ret = ftdi_regmap_bulk_read(map, 0x88, calib, sizeof(calib) / sizeof(*calib));
 	if (ret < 0)
 		return ret;
-	ftdi_i2c_send_check_ack(ftdi_mpsse, 0xe1);
 
-	ret = ftdi_i2c_begin(ftdi_mpsse, 0x76, false);
+	for (unsigned i = 0; i < sizeof(comp->reg_88_9f) / sizeof(*comp->reg_88_9f); i++)
+		comp->reg_88_9f[i] = (calib[2 * i + 1] << 8U) | calib[2 * i];
+	comp->reg_a1 = calib[0xa1 - 0x88];
+
+	ret = ftdi_regmap_bulk_read(map, 0xe1, hum, sizeof(hum) / sizeof(*hum));
 	if (ret < 0)
 		return ret;
-	ftdi_i2c_recv_send_ack(ftdi_mpsse, &lsb, 1, false); // e1
-	ftdi_i2c_recv_send_ack(ftdi_mpsse, &msb, 1, false); // e2
-	comp->dig_H2 = (msb << 8U) | lsb;
-	ftdi_i2c_recv_send_ack(ftdi_mpsse, &comp->dig_H3, 1, false); // e3
-	ftdi_i2c_recv_send_ack(ftdi_mpsse, &lsb, 1, false); // e4
-	ftdi_i2c_recv_send_ack(ftdi_mpsse, &msb, 1, false); // e5
-	comp->dig_H4 = (lsb << 4U) | (msb & 0xf);
-	ftdi_i2c_recv_send_ack(ftdi_mpsse, &lsb, 1, false); // e6
-	comp->dig_H5 = (msb >> 4U) | (lsb << 4U);
-	ftdi_i2c_recv_send_ack(ftdi_mpsse, &lsb, 1, true); // e7
-	ftdi_i2c_end(ftdi_mpsse);
+
+	comp->dig_H2 = (hum[1] << 8U) | hum[0]; // e1, e2
+	comp->dig_H3 = hum[2]; // e3
+	comp->dig_H4 = (hum[3] << 4U) | (hum[4] & 0xf); // e4, e5
+	comp->dig_H5 = (hum[4] >> 4U) | (hum[5] << 4U); // e5, e6
+	comp->dig_H6 = hum[6]; // e7
 
 #ifdef DEBUG_COMP
 	printf("T1=%u T2=%d T3=%d\n", comp->dig_T1, comp->dig_T2, comp->dig_T3);
@@ -150,94 +159,81 @@ static double BME280_compensate_H(int adc_H, const struct BME280_compensation *c
 	return var_H;
 }
 
-int main()
+int main(int argc, char **argv)
 {
 	struct ftdi_mpsse ftdi_mpsse;
 	struct ftdi_mpsse_config conf = {
 		  .iface = INTERFACE_ANY,
 		  /*
-		   * HIGH (3.4 MHz) is supposed to work, but does not
-		   * (perhaps due to ACK stretching not implemented)
+		   * HIGH (3.4 MHz) does not work without following the clock
+		   * stretching, see -A
 		   */
-		  /* .speed = FTDI_I2C_SPD_HIGH, */
 		  .speed = FTDI_I2C_SPD_HIGH / 2,
 	};
-	uint8_t val;
+	struct ftdi_regmap map;
+	unsigned int val;
 	int ret;
 
+	while ((ret = getopt(argc, argv, "A")) >= 0) {
+		switch (ret) {
+		case 'A':
+			/* FT232H with SCL (AD0) wired to GPIOL1 (AD5) and GPIOL3 (AD7) */
+			conf.speed = FTDI_I2C_SPD_HIGH;
+			conf.i2c_clock_stretch = true;
+			break;
+		case '?':
+			return EXIT_FAILURE;
+		}
+	}
+
 	ret = ftdi_i2c_init(&ftdi_mpsse, &conf);
 	if (ret < 0)
 		errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
 			ftdi_mpsse_get_error(&ftdi_mpsse));
 
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_begin(&ftdi_mpsse, 0x76, true));
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_send_check_ack(&ftdi_mpsse, 0xd0)); // ID
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_begin(&ftdi_mpsse, 0x76, false));
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_recv_send_ack(&ftdi_mpsse, &val, 1, true));
+	check_err_or_exit(&ftdi_mpsse, ftdi_regmap_init(&map, &ftdi_mpsse, &BME280_regmap));
+
+	check_err_or_exit(&ftdi_mpsse, ftdi_regmap_read(&map, 0xd0, &val)); // ID
 	printf("id=%.2x\n", val);
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_end(&ftdi_mpsse));
 	if (val != 0x60)
 		return EXIT_FAILURE;
 
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_begin(&ftdi_mpsse, 0x76, true));
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_send_check_ack(&ftdi_mpsse, 0x88)); // CALIB
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_begin(&ftdi_mpsse, 0x76, false));
 	struct BME280_compensation comp;
-	check_err_or_exit(&ftdi_mpsse, BME280_get_compensation(&ftdi_mpsse, &comp));
-
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_begin(&ftdi_mpsse, 0x76, true));
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_send_check_ack(&ftdi_mpsse, 0xf2)); // HUM
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_send_check_ack(&ftdi_mpsse, 0b00000001));
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_send_check_ack(&ftdi_mpsse, 0xf4)); // MEAS
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_send_check_ack(&ftdi_mpsse, 0b00100111));
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_send_check_ack(&ftdi_mpsse, 0xf5)); // CONF
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_send_check_ack(&ftdi_mpsse, 0b00100000));
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_end(&ftdi_mpsse));
-
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_begin(&ftdi_mpsse, 0x76, true));
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_send_check_ack(&ftdi_mpsse, 0xf3)); // STAT
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_begin(&ftdi_mpsse, 0x76, false));
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_recv_send_ack(&ftdi_mpsse, &val, 1, false));
+	check_err_or_exit(&ftdi_mpsse, BME280_get_compensation(&map, &comp));
+
+	/* all three go in one transaction */
+	ftdi_regmap_cache_only(&map, true);
+	check_err_or_exit(&ftdi_mpsse, ftdi_regmap_write(&map, 0xf2, 0b00000001)); // HUM
+	check_err_or_exit(&ftdi_mpsse, ftdi_regmap_write(&map, 0xf4, 0b00100111)); // MEAS
+	check_err_or_exit(&ftdi_mpsse, ftdi_regmap_write(&map, 0xf5, 0b00100000)); // CONF
+	ftdi_regmap_cache_only(&map, false);
+	check_err_or_exit(&ftdi_mpsse, ftdi_regmap_sync(&map));
+
+	check_err_or_exit(&ftdi_mpsse, ftdi_regmap_read(&map, 0xf3, &val)); // STAT
 	printf("stat=%.2x\n", val);
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_recv_send_ack(&ftdi_mpsse, &val, 1, false));
+	/* served from the cache */
+	check_err_or_exit(&ftdi_mpsse, ftdi_regmap_read(&map, 0xf4, &val));
 	printf("ctrl_meas=%.2x\n", val);
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_recv_send_ack(&ftdi_mpsse, &val, 1, true));
+	check_err_or_exit(&ftdi_mpsse, ftdi_regmap_read(&map, 0xf5, &val));
 	printf("config=%.2x\n", val);
-	check_err_or_exit(&ftdi_mpsse, ftdi_i2c_end(&ftdi_mpsse));
 
 	for (unsigned cnt = 0; cnt < 4; cnt++) {
 		unsigned int temp, press, hum;
-		check_err_or_exit(&ftdi_mpsse, ftdi_i2c_begin(&ftdi_mpsse, 0x76, true));
-		ftdi_i2c_send_check_ack(&ftdi_mpsse, 0xf7);
-		check_err_or_exit(&ftdi_mpsse, ftdi_i2c_begin(&ftdi_mpsse, 0x76, false));
-		check_err_or_exit(&ftdi_mpsse, ftdi_i2c_recv_send_ack(&ftdi_mpsse, &val, 1, false)); // f7
-		press = val << 12U;
-		check_err_or_exit(&ftdi_mpsse, ftdi_i2c_recv_send_ack(&ftdi_mpsse, &val, 1, false));
-		press |= val << 4U;
-		check_err_or_exit(&ftdi_mpsse, ftdi_i2c_recv_send_ack(&ftdi_mpsse, &val, 1, false));
-		press |= val >> 4U;
-
-		check_err_or_exit(&ftdi_mpsse, ftdi_i2c_recv_send_ack(&ftdi_mpsse, &val, 1, false)); // fa
-		temp = val << 12U;
-		check_err_or_exit(&ftdi_mpsse, ftdi_i2c_recv_send_ack(&ftdi_mpsse, &val, 1, false));
-		temp |= val << 4U;
-		check_err_or_exit(&ftdi_mpsse, ftdi_i2c_recv_send_ack(&ftdi_mpsse, &val, 1, false));
-		temp |= val >> 4U;
-
-		check_err_or_exit(&ftdi_mpsse, ftdi_i2c_recv_send_ack(&ftdi_mpsse, &val, 1, false)); // fd
-		hum = val << 8U;
-		check_err_or_exit(&ftdi_mpsse, ftdi_i2c_recv_send_ack(&ftdi_mpsse, &val, 1, true));
-		hum |= val;
+		unsigned int data[8];
+
+		check_err_or_exit(&ftdi_mpsse, ftdi_regmap_bulk_read(&map, 0xf7, data, 8));
+		press = (data[0] << 12U) | (data[1] << 4U) | (data[2] >> 4U); // f7
+		temp = (data[3] << 12U) | (data[4] << 4U) | (data[5] >> 4U); // fa
+		hum = (data[6] << 8U) | data[7]; // fd
 
 		printf("temp  = 0x%06x -> %10.2lf\n", temp, BME280_compensate_T(temp, &comp));
 		printf("press = 0x%06x -> %10.2lf\n", press, BME280_compensate_P(press, &comp));
 		printf("hum   = 0x%06x -> %10.2lf\n", hum, BME280_compensate_H(hum, &comp));
 
-		check_err_or_exit(&ftdi_mpsse, ftdi_i2c_end(&ftdi_mpsse));
-
 		sleep(2);
 	}
 
+	ftdi_regmap_exit(&map);
 	ftdi_i2c_close(&ftdi_mpsse);
 
 	return 0;
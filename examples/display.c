@@ -26,8 +26,6 @@ static void send_pcf4(struct ftdi_mpsse *ftdi_mpsse, uint8_t rs_rw, uint8_t nibb
 	ftdi_i2c_send_check_ack(ftdi_mpsse, to_send | E);
 	//printf("%s: %.2x\n", __func__, to_send);
 	ftdi_i2c_send_check_ack(ftdi_mpsse, to_send);
-
-	usleep(50);
 }
 
 void send_pcf(struct ftdi_mpsse *ftdi_mpsse, uint8_t rs_rw, uint8_t byte)
@@ -70,6 +68,15 @@ static __attribute__((unused)) void read_pcf(struct ftdi_mpsse *ftdi_mpsse)
 	printf("busy=%.8x\n", (msb & 0xf0) | (lsb >> 4));
 }
 
+static void commit(struct ftdi_mpsse *ftdi_mpsse)
+{
+	int nack;
+
+	if (ftdi_i2c_commit(ftdi_mpsse, &nack) < 0)
+		errx(EXIT_FAILURE, "%s: byte %d: %s\n", __func__, nack,
+		     ftdi_mpsse_get_error(ftdi_mpsse));
+}
+
 int main()
 {
 	struct ftdi_mpsse ftdi_mpsse;
@@ -84,11 +91,19 @@ int main()
 		errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
 		     ftdi_mpsse_get_error(&ftdi_mpsse));
 
+	/*
+	 * Writes are only queued and checked at commit. A PCF8574 write takes
+	 * ~90 us at 100 kHz, longer than the LCD needs per command, so only the
+	 * long delays below need the queue to be committed first.
+	 */
+	ftdi_i2c_set_posted(&ftdi_mpsse, true);
+
 	ret = ftdi_i2c_begin(&ftdi_mpsse, 0x27, true);
 	if (ret < 0)
 		errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
 		     ftdi_mpsse_get_error(&ftdi_mpsse));
 	send_pcf4(&ftdi_mpsse, 0, 0b0011);
+	commit(&ftdi_mpsse);
 	usleep(5000);
 	send_pcf4(&ftdi_mpsse, 0, 0b0011);
 	send_pcf4(&ftdi_mpsse, 0, 0b0011);
@@ -97,6 +112,7 @@ int main()
 	send_pcf(&ftdi_mpsse, 0, 0b00101000); /* 4bit, 2 lines */
 	send_pcf(&ftdi_mpsse, 0, 0b00001000); /* OFF */
 	send_pcf(&ftdi_mpsse, 0, 0b00000001);  // Clear display
+	commit(&ftdi_mpsse);
 	usleep(2000);                        // Wait 2ms for display to clear
 	send_pcf(&ftdi_mpsse, 0, 0b00000110);  // Entry mode set: cursor moves right
 	send_pcf(&ftdi_mpsse, 0, 0b00000010);  /* CUR HOME */
@@ -121,7 +137,10 @@ int main()
 	for (unsigned i = 0; i < sizeof(text) - 1; i++) {
 		send_pcf(&ftdi_mpsse, RS, text[i]);
 	}
-	ftdi_i2c_end(&ftdi_mpsse);
+	ret = ftdi_i2c_end(&ftdi_mpsse);
+	if (ret < 0)
+		errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
+		     ftdi_mpsse_get_error(&ftdi_mpsse));
 
 	ftdi_i2c_close(&ftdi_mpsse);
 
@@ -40,6 +40,9 @@ int main(int argc, char **argv)
 		errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
 		     ftdi_mpsse_get_error(&ftdi_mpsse));
 
+	/* ACKs are checked only by ftdi_i2c_end() */
+	ftdi_i2c_set_posted(&ftdi_mpsse, true);
+
 	ret = ftdi_i2c_begin(&ftdi_mpsse, 0x3c, true);
 	if (ret < 0)
 		errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
@@ -72,7 +75,10 @@ int main(int argc, char **argv)
 	/* fade */
 	ftdi_i2c_send_check_ack(&ftdi_mpsse, 0x23);
 	ftdi_i2c_send_check_ack(&ftdi_mpsse, (0b00 << 4) | 0b0000);
-	ftdi_i2c_end(&ftdi_mpsse);
+	ret = ftdi_i2c_end(&ftdi_mpsse);
+	if (ret < 0)
+		errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
+		     ftdi_mpsse_get_error(&ftdi_mpsse));
 
 	ret = ftdi_i2c_begin(&ftdi_mpsse, 0x3c, true);
 	if (ret < 0)
@@ -11,6 +11,8 @@
 
 #include <ftdi_mpsse.h>
 
+#include "utils.h"
+
 static unsigned int bcd2hex(unsigned int bcd)
 {
 	return ((bcd & 0xf0) >> 4) * 10 + (bcd & 0x0f);
@@ -80,20 +82,14 @@ int main(int argc, char **argv)
 	}
 
 	if (read_eeprom) {
-		ret = ftdi_i2c_begin(&ftdi_mpsse, 0x57, true);
-                if (ret < 0)
-			errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
-			     ftdi_mpsse_get_error(&ftdi_mpsse));
-                ftdi_i2c_send_check_ack(&ftdi_mpsse, 0x00);
-                ftdi_i2c_send_check_ack(&ftdi_mpsse, 0x00);
-
-		ret = ftdi_i2c_begin(&ftdi_mpsse, 0x57, false);
-		if (ret < 0)
-			errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
-			     ftdi_mpsse_get_error(&ftdi_mpsse));
-
 		uint8_t eeprom[128];
-		ftdi_i2c_recv_send_ack(&ftdi_mpsse, eeprom, sizeof(eeprom), true);
+		uint8_t offset[2] = {};
+		const struct ftdi_i2c_msg msgs[] = {
+			{ .addr = 0x57, .len = sizeof(offset), .buf = offset },
+			{ .addr = 0x57, .flags = FTDI_I2C_M_RD, .len = sizeof(eeprom), .buf = eeprom },
+		};
+
+		check_err_or_exit(&ftdi_mpsse, ftdi_i2c_transfer(&ftdi_mpsse, msgs, 2));
 
 		printf("EEPROM:");
 		for (unsigned i = 0; i < sizeof(eeprom); i++) {
@@ -103,8 +99,6 @@ int main(int argc, char **argv)
 		}
 		puts("");
 		puts("");
-
-		ftdi_i2c_end(&ftdi_mpsse);
 	}
 
 
@@ -130,21 +124,10 @@ int main(int argc, char **argv)
 	}
 
 	for (unsigned cnt = 0; cnt < 10; cnt++) {
-		ret = ftdi_i2c_begin(&ftdi_mpsse, addr, true);
-		if (ret < 0)
-			errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
-			     ftdi_mpsse_get_error(&ftdi_mpsse));
-		ret = ftdi_i2c_send_check_ack(&ftdi_mpsse, 0x00);
-		if (ret < 0)
-			errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
-			     ftdi_mpsse_get_error(&ftdi_mpsse));
-
-		ret = ftdi_i2c_begin(&ftdi_mpsse, addr, false);
-		if (ret < 0)
-			errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
-			     ftdi_mpsse_get_error(&ftdi_mpsse));
 		uint8_t regs[0x13];
-		ftdi_i2c_recv_send_ack(&ftdi_mpsse, regs, sizeof(regs), true);
+
+		check_err_or_exit(&ftdi_mpsse, i2c_read_regs(&ftdi_mpsse, addr, 0x00, regs,
+							     sizeof(regs)));
 
 		for (unsigned reg = 7; reg <= 0x10; reg++)
 			printf("  [0x%.2x]=0x%.2x", reg, regs[reg]);
@@ -165,7 +148,6 @@ int main(int argc, char **argv)
 		       days[tm->tm_wday],
 		       tm->tm_hour, tm->tm_min, tm->tm_sec);
 
-		ftdi_i2c_end(&ftdi_mpsse);
 		sleep(1);
 		puts("");
 	}
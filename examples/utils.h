@@ -14,4 +14,16 @@ static inline void __check_err_or_exit(struct ftdi_mpsse *ftdi_mpsse, int error,
 #define check_err_or_exit(ftdi_mpsse, err) \
 	__check_err_or_exit(ftdi_mpsse, err, __func__, __LINE__)
 
+/* write the register pointer, repeated START, read count registers */
+static inline int i2c_read_regs(struct ftdi_mpsse *ftdi_mpsse, uint8_t address, uint8_t reg,
+				uint8_t *buf, uint16_t count)
+{
+	const struct ftdi_i2c_msg msgs[] = {
+		{ .addr = address, .len = 1, .buf = &reg },
+		{ .addr = address, .flags = FTDI_I2C_M_RD, .len = count, .buf = buf },
+	};
+
+	return ftdi_i2c_transfer(ftdi_mpsse, msgs, 2);
+}
+
 #endif
@@ -0,0 +1,98 @@
+/*
+ * Licensed under the GPLv2
+ */
+#ifndef FTDI_EMU_H
+#define FTDI_EMU_H
+
+#ifndef FTDI_MPSSE_H
+#error include ftdi_mpsse.h instead
+#endif
+
+#include <stdint.h>
+
+/*
+ * In-process MPSSE emulator, a transport for runs without an adapter. The
+ * opcodes are interpreted as the chip would, the pins are modelled and the
+ * replies are produced from their levels. Select it with
+ * ftdi_mpsse_config.transport = &ftdi_mpsse_transport_emu and pass a
+ * struct ftdi_emu_config as transport_conf (or NULL for the defaults).
+ *
+ * Lines are ADBUS0..7 as bits 0..7 and ACBUS0..7 as bits 8..15. A line not
+ * driven by the chip is pulled up unless a device pulls it low.
+ */
+struct ftdi_emu_device {
+	const char *name;
+	/*
+	 * Called whenever the chip sets its pins, with the levels of all the
+	 * lines and the emulated time (bus time plus USB latency). Returns the
+	 * lines the device pulls low, push-pull outputs included.
+	 */
+	uint16_t (*update)(struct ftdi_emu_device *dev, uint16_t lines, uint64_t now_ns);
+	void (*free)(struct ftdi_emu_device *dev);
+};
+
+#define FTDI_EMU_TIED_GROUPS	4
+
+struct ftdi_emu_config {
+	enum ftdi_chip_type type;	/* TYPE_AM (0) means FT232H */
+	/* added to every round trip, e.g. 125 for a USB 2.0 microframe */
+	unsigned int latency_us;
+	/* replies also wait for the time their commands take on the bus */
+	bool real_time;
+	/*
+	 * Groups of lines wired together on the board, e.g. BIT(1) | BIT(2) for
+	 * I2C SDA, BIT(0) | BIT(7) for SCL on RTCK (adaptive clocking).
+	 */
+	uint16_t tied[FTDI_EMU_TIED_GROUPS];
+	/*
+	 * Once the replies since the open pass stall_at bytes, nothing arrives
+	 * for stall_ms: a stalled link, to run into the read timeout. 0 = never.
+	 */
+	unsigned int stall_ms;
+	size_t stall_at;
+	/* owned by the caller, they keep their state across opens */
+	struct ftdi_emu_device **devices;
+	unsigned int num_devices;
+};
+
+extern const struct ftdi_mpsse_transport ftdi_mpsse_transport_emu;
+
+/* time the emulated bus spent clocking so far, 0 for other transports */
+uint64_t ftdi_emu_get_bus_ns(const struct ftdi_mpsse *ftdi_mpsse);
+
+/*
+ * Device models, for the pins of ftdi_i2c.h (SCL on ADBUS0, SDA on ADBUS1)
+ * and ftdi_spi.h (SCLK, MOSI, MISO, CS on ADBUS0..3, mode 0). They return
+ * NULL when out of memory and are freed by ftdi_emu_device_free().
+ */
+struct ftdi_emu_device *ftdi_emu_24cxx_new(uint8_t address, unsigned int size,
+					   unsigned int page_size);
+struct ftdi_emu_device *ftdi_emu_bme280_new(uint8_t address);
+struct ftdi_emu_device *ftdi_emu_ds3231_new(uint8_t address);
+struct ftdi_emu_device *ftdi_emu_ssd1306_new(uint8_t address);
+/* JEDEC ID e.g. 0xef4018 (W25Q128), up to 16 MiB (3-byte addresses) */
+struct ftdi_emu_device *ftdi_emu_spinor_new(uint32_t jedec_id, unsigned int size);
+void ftdi_emu_device_free(struct ftdi_emu_device *dev);
+
+/* the 128x64 GDDRAM of an SSD1306 model, 8 pages of 128 bytes */
+const uint8_t *ftdi_emu_ssd1306_get_ram(const struct ftdi_emu_device *dev);
+/* the arrays of the memory models, e.g. to preload or check them */
+uint8_t *ftdi_emu_24cxx_get_memory(struct ftdi_emu_device *dev);
+uint8_t *ftdi_emu_spinor_get_memory(struct ftdi_emu_device *dev);
+
+/*
+ * Faults of the I2C models. Bytes are counted from the address (0) within a
+ * transfer, i.e. since the last START.
+ */
+struct ftdi_emu_i2c_faults {
+	int nack_at;			/* NACK this byte, -1 never */
+	unsigned int nack_count;	/* that many times, 0 = always */
+	/* hold SCL low after every ACK that long, needs adaptive clocking */
+	unsigned int stretch_ns;
+};
+
+int ftdi_emu_i2c_set_faults(struct ftdi_emu_device *dev, const struct ftdi_emu_i2c_faults *faults);
+/* page program time of the NOR model, 400 us by default */
+int ftdi_emu_spinor_set_tpp(struct ftdi_emu_device *dev, unsigned int tpp_ns);
+
+#endif
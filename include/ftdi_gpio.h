@@ -0,0 +1,41 @@
+/*
+ * Licensed under the GPLv2
+ */
+#ifndef FTDI_GPIO_H
+#define FTDI_GPIO_H
+
+#ifndef FTDI_MPSSE_H
+#error include ftdi_mpsse.h instead
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * One bit per pin: GPIOL0..3 (xDBUS4..7) at bits 4..7, GPIOH0..7 (xCBUS0..7)
+ * at bits 8..15. Bits 0..3 are the bus pins of I2C/SPI and cannot be set, the
+ * pins a chip lacks are in ftdi_mpsse_caps.gpio_pins. In dir, 1 = output.
+ */
+#define FTDI_GPIOL(n)		(1U << (4 + (n)))
+#define FTDI_GPIOH(n)		(1U << (8 + (n)))
+
+/* one pin write, then hold more writes (about 60 ns each) of the same state */
+struct ftdi_gpio_step {
+	uint16_t val;
+	uint16_t dir;
+	unsigned int hold;
+};
+
+/*
+ * The pins in mask take val/dir. The commands are written out on return, in
+ * order with anything queued by I2C/SPI, but no reply is waited for.
+ */
+int ftdi_gpio_set(struct ftdi_mpsse *ftdi_mpsse, uint16_t mask, uint16_t val);
+int ftdi_gpio_set_dir(struct ftdi_mpsse *ftdi_mpsse, uint16_t mask, uint16_t dir);
+/* all 16 lines as the chip sees them, bus pins included: one round trip */
+int ftdi_gpio_get(struct ftdi_mpsse *ftdi_mpsse, uint16_t *val);
+/* the steps, restricted to mask, as one command stream */
+int ftdi_gpio_waveform(struct ftdi_mpsse *ftdi_mpsse, uint16_t mask,
+		       const struct ftdi_gpio_step *steps, size_t count);
+
+#endif
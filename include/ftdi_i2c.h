@@ -13,7 +13,7 @@
 #include <stdint.h>
 
 enum ftdi_i2c_speed {
-	FTDI_I2C_SPD_MIN	=      458 * 2 / 3,
+	FTDI_I2C_SPD_MIN	=       93 * 2 / 3,
 	FTDI_I2C_SPD_STD	=   100000,
 	FTDI_I2C_SPD_FAST	=   400000,
 	FTDI_I2C_SPD_FASTP	=  1000000,
@@ -21,6 +21,31 @@ enum ftdi_i2c_speed {
 	FTDI_I2C_SPD_MAX	= 30000000 * 2 / 3,
 };
 
+/* modelled after Linux' struct i2c_msg */
+#define FTDI_I2C_M_RD		0x0001
+
+struct ftdi_i2c_msg {
+	uint8_t addr;		/* 7-bit */
+	uint16_t flags;
+	uint16_t len;
+	uint8_t *buf;
+};
+
+struct ftdi_i2c_wire_stats {
+	uint64_t mpsse_bytes;	/* MPSSE bytes queued, commands included */
+	uint64_t i2c_bytes;	/* bytes on the bus, addresses included */
+};
+
+/*
+ * START/STOP hold times: the I2C minimums (ns) for the configured speed and
+ * the number of pin-setting commands emitted to cover them.
+ */
+struct ftdi_i2c_timing {
+	unsigned int su_sta_ns, hd_sta_ns, low_ns, su_sto_ns, buf_ns;
+	unsigned int set_pins_ns;
+	unsigned int su_sta_cycles, hd_sta_cycles, low_cycles, su_sto_cycles, buf_cycles;
+};
+
 int ftdi_i2c_init(struct ftdi_mpsse *ftdi_mpsse,
 		  const struct ftdi_mpsse_config *conf);
 void ftdi_i2c_close(struct ftdi_mpsse *ftdi_mpsse);
@@ -33,4 +58,25 @@ int ftdi_i2c_recv_send_ack(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf,
 			   size_t count, bool last_nack);
 int ftdi_i2c_end(struct ftdi_mpsse *ftdi_mpsse);
 
+/*
+ * Send msgs joined by repeated STARTs in one USB round trip. Returns num, or
+ * a negative error (incl. NACK).
+ */
+int ftdi_i2c_transfer(struct ftdi_mpsse *ftdi_mpsse, const struct ftdi_i2c_msg *msgs,
+		      unsigned int num);
+
+/*
+ * Posted writes: ftdi_i2c_begin() and ftdi_i2c_send_check_ack() only queue
+ * the bytes, their ACKs are collected by ftdi_i2c_commit() or ftdi_i2c_end().
+ * On a NACK, these fail and nack_idx is the index of the first NACKed byte
+ * since the last commit (the address byte being 0), -1 otherwise.
+ */
+void ftdi_i2c_set_posted(struct ftdi_mpsse *ftdi_mpsse, bool posted);
+int ftdi_i2c_commit(struct ftdi_mpsse *ftdi_mpsse, int *nack_idx);
+
+void ftdi_i2c_get_timing(const struct ftdi_mpsse *ftdi_mpsse, struct ftdi_i2c_timing *timing);
+void ftdi_i2c_get_wire_stats(const struct ftdi_mpsse *ftdi_mpsse,
+			     struct ftdi_i2c_wire_stats *stats);
+void ftdi_i2c_reset_wire_stats(struct ftdi_mpsse *ftdi_mpsse);
+
 #endif
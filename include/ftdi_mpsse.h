@@ -4,13 +4,22 @@
 #ifndef FTDI_MPSSE_H
 #define FTDI_MPSSE_H
 
+#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include <ftdi.h>
 
 #define BIT(x)		(1U << (x))
 
+/* defaults for ftdi_mpsse_config, in ms */
+#define FTDI_MPSSE_LATENCY_TIMER	1
+#define FTDI_MPSSE_READ_TIMEOUT		1000
+/* how long a warm attach waits for the echo before falling back to a reset */
+#define FTDI_MPSSE_WARM_TIMEOUT		20
+
 enum ftdi_mpsse_debug {
 	MPSSE_VERBOSE		= BIT(0),
 	MPSSE_DEBUG_READS	= BIT(1),
@@ -20,33 +29,205 @@ enum ftdi_mpsse_debug {
 	MPSSE_DEBUG_FLUSHING	= BIT(5),
 };
 
+struct ftdi_mpsse;
+struct ftdi_mpsse_async;
+struct ftdi_mpsse_config;
+struct ftdi_mpsse_trace;
+
+/*
+ * How a handle talks to the chip: libftdi by default, or the in-process
+ * emulator of ftdi_emu.h. Errors are stored in the handle and returned
+ * negative, like everywhere else.
+ */
+struct ftdi_mpsse_transport {
+	const char *name;
+	/* find and open the device, then set its caps (ftdi_mpsse_set_caps()) */
+	int (*open)(struct ftdi_mpsse *ftdi_mpsse, const struct ftdi_mpsse_config *conf);
+	/* switch to MPSSE mode and drop anything sent before */
+	int (*reset)(struct ftdi_mpsse *ftdi_mpsse, const struct ftdi_mpsse_config *conf);
+	int (*write)(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *buf, size_t len);
+	/* what has arrived, 0 if nothing did within a short wait */
+	int (*read)(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf, size_t size);
+	void (*close)(struct ftdi_mpsse *ftdi_mpsse);
+};
+
+extern const struct ftdi_mpsse_transport ftdi_mpsse_transport_libftdi;
+
+/* what an MPSSE channel of a given chip can do, see ftdi_mpsse_get_caps() */
+struct ftdi_mpsse_caps {
+	enum ftdi_chip_type type;
+	const char *name;
+	unsigned int channels;		/* channels with MPSSE, A.. */
+	unsigned int tx_bufsize;	/* per channel */
+	unsigned int rx_bufsize;	/* per channel */
+	unsigned int base_clock;	/* Hz, divide-by-5 disabled */
+	bool h_series;			/* div-by-5, 3-phase, adaptive clocking */
+	bool drive_zero;		/* open-drain outputs */
+	uint16_t gpio_pins;		/* GPIOL/GPIOH available, see ftdi_gpio.h */
+};
+
+/*
+ * How ftdi_mpsse_plan_clock() rounds a frequency the chip cannot produce
+ * exactly. The default never exceeds the requested bus speed.
+ */
+enum ftdi_mpsse_clock_mode {
+	FTDI_MPSSE_CLOCK_NOT_ABOVE,	/* fastest not exceeding the request */
+	FTDI_MPSSE_CLOCK_NEAREST,	/* closest, above or below */
+};
+
+/* clock setup of a channel: freq = base / (div5 ? 5 : 1) / ((divisor + 1) * (3 or 2)) */
+struct ftdi_mpsse_clock {
+	unsigned int freq;		/* Hz, the achieved bus clock */
+	uint16_t divisor;
+	bool div5;
+	bool three_phase;
+};
+
+/* bucket n of the round-trip histogram counts [2^(n-1), 2^n) us, bucket 0 < 1 us */
+#define FTDI_MPSSE_RTT_BUCKETS	16
+
+/*
+ * Counters kept by every handle. They are plain increments on paths that do
+ * USB I/O anyway, so they are always on. See ftdi_mpsse_get_stats().
+ */
+struct ftdi_mpsse_stats {
+	uint64_t usb_writes;
+	uint64_t usb_reads;
+	uint64_t bytes_out;
+	uint64_t bytes_in;
+	uint64_t empty_reads;		/* reads retried as nothing came yet */
+	uint64_t timeouts;
+	uint64_t nacks;
+	uint64_t auto_flushes;		/* flush window filled while queueing */
+	uint64_t forced_flushes;	/* replies about to overflow the chip's buffers */
+	/* a round trip: the first flush expecting replies until the last reply */
+	uint64_t round_trips;
+	uint64_t rtt_total_ns;
+	uint64_t rtt_max_ns;
+	uint64_t rtt_hist[FTDI_MPSSE_RTT_BUCKETS];
+};
+
+/* where a reply of a queued command goes, see ftdi_mpsse_collect() */
+enum ftdi_mpsse_reply_type {
+	MPSSE_REPLY_ACK,
+	MPSSE_REPLY_DATA,
+	MPSSE_REPLY_GPIO,
+};
+
+struct ftdi_mpsse_reply {
+	enum ftdi_mpsse_reply_type type;
+	uint8_t *buf;
+	size_t len;
+};
+
+/*
+ * Thread safety: handles share no state, so every handle (including the
+ * channels of one FT2232H/FT4232H, each opened by its own ftdi_*_init()) can
+ * be driven from its own thread without any locking. A handle itself is not
+ * locked by the library. Threads sharing one must hold ftdi_mpsse_lock()
+ * around whole transactions (e.g. ftdi_i2c_begin() .. ftdi_i2c_end()).
+ */
 struct ftdi_mpsse {
-	struct ftdi_context ftdic;
+	const struct ftdi_mpsse_transport *transport;
+	void *transport_priv;
+	struct ftdi_context ftdic;		/* libftdi transport */
+	pthread_mutex_t lock;
+	struct ftdi_mpsse_async *async;
+	struct ftdi_mpsse_trace *trace;
+	const struct ftdi_mpsse_caps *caps;
 	char error_buf[128];
-	uint8_t obuf[2048];
+	uint8_t *obuf;
 	unsigned int obuf_cnt;
-	unsigned int speed;
+	unsigned int obuf_size;
+	unsigned int flush_window;
+	uint64_t obuf_total;
+	int obuf_error;
+	unsigned int rx_queued;
+	unsigned int rx_inflight;
+	uint8_t *ibuf;
+	unsigned int ibuf_cnt;
+	unsigned int ibuf_pos;
+	unsigned int ibuf_size;
+	struct ftdi_mpsse_reply *replies;
+	unsigned int replies_cnt;
+	unsigned int replies_size;
+	unsigned int reply_bytes;
+	uint8_t *rbuf;
+	unsigned int rbuf_size;
+	unsigned int acks_seen;
+	int first_nack;
+	struct ftdi_mpsse_stats stats;
+	uint64_t rtt_start_ns;
+	unsigned int speed;		/* achieved bus clock */
+	struct ftdi_mpsse_clock clock;
+	unsigned int read_timeout;
 	unsigned int debug;
-	uint8_t gpio;
+	uint16_t gpio;				/* GPIOL at bits 4..7, GPIOH at 8..15 */
+	uint16_t gpio_dir;
+	uint8_t gpio_in;			/* GPIOL lines kept as inputs, e.g. RTCK */
+	uint8_t bus_bits;			/* last ftdi_mpsse_set_pins() */
+	uint8_t bus_output;
+	bool warm;
+	uint64_t init_start_ns;
+	uint64_t init_ns;
 	union {
 		struct {
 			unsigned int loops_after_read_ack;
-			unsigned int acks;
-			unsigned int bytes;
+			uint64_t wire_mpsse_base;
+			uint64_t wire_i2c_bytes;
+			struct {
+				unsigned int su_sta, hd_sta, low, su_sto, buf;
+			} cycles;
 			uint8_t address;
+			bool open_drain;
+			bool clock_stretch;
+			bool sda_out;
+			bool posted;
 		} i2c;
+		struct {
+			bool in_xfer;
+			bool posted;
+		} spi;
 	};
 };
 
 struct ftdi_mpsse_config {
+	/* NULL for libftdi, transport_conf is passed to its open() */
+	const struct ftdi_mpsse_transport *transport;
+	const void *transport_conf;
 	enum ftdi_interface iface;
 	uint16_t id_vendor;
 	uint16_t id_product;
+	/* device selection, NULL matches any */
+	const char *serial;
+	const char *description;
+	const char *bus_path;		/* "bus-port.port...", e.g. "1-2.4" */
 	unsigned int speed;
+	enum ftdi_mpsse_clock_mode clock_mode;
 	unsigned int loops_after_read_ack;
 	unsigned int debug;
+	unsigned int read_timeout;
+	uint8_t latency_timer;
 	uint8_t gpio;
 	uint8_t gpio_dir;
+	bool async;
+	bool i2c_open_drain;
+	/*
+	 * I2C clock stretching: SCL is wired to GPIOL3 (RTCK), so that every
+	 * clock edge waits until SCL follows (adaptive clocking), and to GPIOL1,
+	 * waited on before START and STOP. Needs an FT232H (open-drain outputs),
+	 * implies i2c_open_drain. The init fails if the wiring is missing.
+	 */
+	bool i2c_clock_stretch;
+	/*
+	 * If the chip is still in MPSSE mode (e.g. a tool run again), skip the
+	 * USB reset, the drain loop and the settle delay. The chip is reset as
+	 * usual if it does not answer within FTDI_MPSSE_WARM_TIMEOUT.
+	 */
+	bool warm_attach;
+	/* trace into a ring of trace_size bytes, dumped to trace_file at close */
+	size_t trace_size;
+	const char *trace_file;
 };
 
 static inline const char *ftdi_mpsse_get_error(const struct ftdi_mpsse *ftdi_mpsse)
@@ -54,12 +235,62 @@ static inline const char *ftdi_mpsse_get_error(const struct ftdi_mpsse *ftdi_mps
 	return ftdi_mpsse->error_buf;
 }
 
+void ftdi_mpsse_lock(struct ftdi_mpsse *ftdi_mpsse);
+void ftdi_mpsse_unlock(struct ftdi_mpsse *ftdi_mpsse);
+
+static inline const struct ftdi_mpsse_caps *ftdi_mpsse_get_caps(const struct ftdi_mpsse *ftdi_mpsse)
+{
+	return ftdi_mpsse->caps;
+}
+
+/* for transports: the chip behind the handle, channel 0 = A */
+int ftdi_mpsse_set_caps(struct ftdi_mpsse *ftdi_mpsse, enum ftdi_chip_type type,
+			unsigned int channel);
+
+void ftdi_mpsse_get_stats(const struct ftdi_mpsse *ftdi_mpsse, struct ftdi_mpsse_stats *stats);
+void ftdi_mpsse_reset_stats(struct ftdi_mpsse *ftdi_mpsse);
+void ftdi_mpsse_print_stats(const struct ftdi_mpsse *ftdi_mpsse, FILE *f);
+
+int ftdi_mpsse_plan_clock(const struct ftdi_mpsse_caps *caps, unsigned int speed,
+			  bool three_phase, enum ftdi_mpsse_clock_mode mode,
+			  struct ftdi_mpsse_clock *clock);
+
+/* the bus clock actually set, which differs from the requested speed */
+static inline unsigned int ftdi_mpsse_get_speed(const struct ftdi_mpsse *ftdi_mpsse)
+{
+	return ftdi_mpsse->speed;
+}
+
+static inline const struct ftdi_mpsse_clock *ftdi_mpsse_get_clock(const struct ftdi_mpsse *ftdi_mpsse)
+{
+	return &ftdi_mpsse->clock;
+}
+
+/* true if the last init reused the chip state, see warm_attach */
+static inline bool ftdi_mpsse_is_warm(const struct ftdi_mpsse *ftdi_mpsse)
+{
+	return ftdi_mpsse->warm;
+}
+
+/* time spent in ftdi_i2c_init()/ftdi_spi_init() */
+static inline uint64_t ftdi_mpsse_get_init_ns(const struct ftdi_mpsse *ftdi_mpsse)
+{
+	return ftdi_mpsse->init_ns;
+}
+
+/* GPIOL values for the next pin update, see ftdi_gpio_set() to apply them now */
 static inline void ftdi_mpsse_set_gpio(struct ftdi_mpsse *ftdi_mpsse, uint8_t gpio)
 {
-	ftdi_mpsse->gpio = gpio & 0xf0;
+	ftdi_mpsse->gpio = (ftdi_mpsse->gpio & 0xff00) | (gpio & 0xf0);
 }
 
+#include <ftdi_emu.h>
+#include <ftdi_gpio.h>
 #include <ftdi_i2c.h>
+#include <ftdi_pool.h>
+#include <ftdi_regmap.h>
 #include <ftdi_spi.h>
+#include <ftdi_spiflash.h>
+#include <ftdi_trace.h>
 
 #endif
@@ -0,0 +1,40 @@
+/*
+ * Licensed under the GPLv2
+ */
+#ifndef FTDI_POOL_H
+#define FTDI_POOL_H
+
+#ifndef FTDI_MPSSE_H
+#error include ftdi_mpsse.h instead
+#endif
+
+/*
+ * Multi-adapter manager: every adapter is opened and then driven by its own
+ * worker thread. Jobs submitted to an adapter run in order on its worker,
+ * jobs of different adapters run in parallel.
+ */
+enum ftdi_pool_bus {
+	FTDI_POOL_I2C,
+	FTDI_POOL_SPI,
+};
+
+struct ftdi_pool_adapter_config {
+	enum ftdi_pool_bus bus;
+	struct ftdi_mpsse_config conf;
+};
+
+struct ftdi_pool;
+
+/* a negative return is an error, the handle's error string is kept */
+typedef int (*ftdi_pool_job_fn)(struct ftdi_mpsse *ftdi_mpsse, void *data);
+
+struct ftdi_pool *ftdi_pool_create(const struct ftdi_pool_adapter_config *adapters,
+				   unsigned int count);
+int ftdi_pool_open(struct ftdi_pool *pool);
+int ftdi_pool_submit(struct ftdi_pool *pool, unsigned int adapter, ftdi_pool_job_fn fn,
+		     void *data);
+int ftdi_pool_wait(struct ftdi_pool *pool);
+void ftdi_pool_destroy(struct ftdi_pool *pool);
+const char *ftdi_pool_get_error(const struct ftdi_pool *pool);
+
+#endif
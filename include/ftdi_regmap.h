@@ -0,0 +1,82 @@
+/*
+ * Licensed under the GPLv2
+ */
+#ifndef FTDI_REGMAP_H
+#define FTDI_REGMAP_H
+
+#ifndef FTDI_MPSSE_H
+#error include ftdi_mpsse.h instead
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum ftdi_regmap_bus {
+	FTDI_REGMAP_I2C,
+	FTDI_REGMAP_SPI,
+};
+
+enum ftdi_regmap_flags {
+	FTDI_REGMAP_READABLE	= BIT(0),
+	FTDI_REGMAP_WRITABLE	= BIT(1),
+	/* never cached, e.g. status and measurement registers */
+	FTDI_REGMAP_VOLATILE	= BIT(2),
+};
+
+/* registers first..last (inclusive) have flags */
+struct ftdi_regmap_range {
+	unsigned int first;
+	unsigned int last;
+	unsigned int flags;
+};
+
+/*
+ * Registers are 8-bit addressed, values are 8 or 16 bits (big endian on the
+ * bus). Registers not covered by ranges are readable, writable and cached.
+ */
+struct ftdi_regmap_config {
+	enum ftdi_regmap_bus bus;
+	uint8_t address;		/* I2C */
+	uint8_t read_flag_mask;		/* SPI: OR-ed to the register for reads */
+	uint8_t write_flag_mask;	/* SPI: OR-ed to the register for writes */
+	unsigned int val_bits;
+	unsigned int max_register;
+	const struct ftdi_regmap_range *ranges;
+	unsigned int num_ranges;
+	/* no auto-increment on writes, send (register, value) pairs (e.g. BME280) */
+	bool write_pairs;
+};
+
+struct ftdi_regmap {
+	struct ftdi_mpsse *ftdi_mpsse;
+	struct ftdi_regmap_config conf;
+	unsigned int val_bytes;
+	uint8_t *state;
+	unsigned int *cache;
+	uint8_t *buf;
+	size_t buf_size;
+	bool cache_only;
+};
+
+int ftdi_regmap_init(struct ftdi_regmap *map, struct ftdi_mpsse *ftdi_mpsse,
+		     const struct ftdi_regmap_config *conf);
+void ftdi_regmap_exit(struct ftdi_regmap *map);
+
+int ftdi_regmap_read(struct ftdi_regmap *map, unsigned int reg, unsigned int *val);
+int ftdi_regmap_bulk_read(struct ftdi_regmap *map, unsigned int reg, unsigned int *vals,
+			  unsigned int count);
+int ftdi_regmap_write(struct ftdi_regmap *map, unsigned int reg, unsigned int val);
+int ftdi_regmap_update_bits(struct ftdi_regmap *map, unsigned int reg, unsigned int mask,
+			    unsigned int val);
+
+/*
+ * In cache-only mode, writes of non-volatile registers only update the cache,
+ * ftdi_regmap_sync() then writes the dirty ones as contiguous bursts.
+ */
+void ftdi_regmap_cache_only(struct ftdi_regmap *map, bool enable);
+int ftdi_regmap_sync(struct ftdi_regmap *map);
+/* forget the cached values, e.g. after a device reset */
+void ftdi_regmap_cache_drop(struct ftdi_regmap *map);
+
+#endif
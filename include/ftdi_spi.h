@@ -8,18 +8,37 @@
 #error include ftdi_mpsse.h instead
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 enum ftdi_spi_speed {
-	FTDI_SPI_SPD_MIN	=      458,
+	/* H series, divide-by-5 and divisor 0xffff */
+	FTDI_SPI_SPD_MIN	=       92,
 	FTDI_SPI_SPD_MAX	= 30000000,
 };
 
 int ftdi_spi_init(struct ftdi_mpsse *ftdi_mpsse,
 		  const struct ftdi_mpsse_config *conf);
+int ftdi_spi_begin(struct ftdi_mpsse *ftdi_mpsse);
+int ftdi_spi_end(struct ftdi_mpsse *ftdi_mpsse);
 int ftdi_spi_sendrecv(struct ftdi_mpsse *ftdi_mpsse, uint8_t *c);
 int ftdi_spi_recv(struct ftdi_mpsse *ftdi_mpsse, uint8_t *c);
 int ftdi_spi_send(struct ftdi_mpsse *ftdi_mpsse, uint8_t c);
+int ftdi_spi_transfer(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *tx, uint8_t *rx,
+		      size_t len);
+int ftdi_spi_write(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *buf, size_t len);
+int ftdi_spi_read(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf, size_t len);
+
+/*
+ * Posted mode: ftdi_spi_end() only deasserts CS, the data received since the
+ * last commit are valid after ftdi_spi_commit(). Several transactions (and
+ * delays) then take one USB round trip.
+ */
+void ftdi_spi_set_posted(struct ftdi_mpsse *ftdi_mpsse, bool posted);
+int ftdi_spi_commit(struct ftdi_mpsse *ftdi_mpsse);
+/* queue a pause of at least ns between transactions, SCLK runs with CS high */
+int ftdi_spi_delay(struct ftdi_mpsse *ftdi_mpsse, unsigned int ns);
+
 void ftdi_spi_close(struct ftdi_mpsse *ftdi_mpsse);
 
 #endif
@@ -0,0 +1,36 @@
+/*
+ * Licensed under the GPLv2
+ */
+#ifndef FTDI_SPIFLASH_H
+#define FTDI_SPIFLASH_H
+
+#ifndef FTDI_MPSSE_H
+#error include ftdi_mpsse.h instead
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* 3-byte addressing only */
+#define FTDI_SPIFLASH_MAX_SIZE	(1U << 24)
+
+/* manufacturer, memory type and capacity, e.g. 0xef4018 for a W25Q128 */
+int ftdi_spiflash_read_id(struct ftdi_mpsse *ftdi_mpsse, uint32_t *jedec_id);
+/* size from the capacity byte of the JEDEC ID (2^n), 0 if it is not usable */
+unsigned int ftdi_spiflash_size(uint32_t jedec_id);
+/* FAST READ under one CS assertion, streamed at the bus rate */
+int ftdi_spiflash_read(struct ftdi_mpsse *ftdi_mpsse, uint32_t addr, uint8_t *buf,
+		       size_t len);
+/* 4 KiB aligned, with the largest erases fitting */
+int ftdi_spiflash_erase(struct ftdi_mpsse *ftdi_mpsse, uint32_t addr, size_t len);
+/*
+ * Program erased flash. Several pages and their status polls go out per round
+ * trip, so the time is bounded by the page program time of the flash.
+ */
+int ftdi_spiflash_write(struct ftdi_mpsse *ftdi_mpsse, uint32_t addr, const uint8_t *buf,
+			size_t len);
+/* read back and compare, -EIO on a mismatch */
+int ftdi_spiflash_verify(struct ftdi_mpsse *ftdi_mpsse, uint32_t addr, const uint8_t *buf,
+			 size_t len);
+
+#endif
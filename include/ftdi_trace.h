@@ -0,0 +1,51 @@
+/*
+ * Licensed under the GPLv2
+ */
+#ifndef FTDI_TRACE_H
+#define FTDI_TRACE_H
+
+#ifndef FTDI_MPSSE_H
+#error include ftdi_mpsse.h instead
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary trace of the raw MPSSE streams: every USB write and read is copied
+ * with a timestamp into a per-handle ring, the oldest records are overwritten.
+ * Unlike MPSSE_DEBUG_WRITES/READS, nothing is formatted while tracing.
+ *
+ * A dump is a struct ftdi_trace_header followed by the records, each a
+ * struct ftdi_trace_record and len bytes of data. Fields are in host order.
+ */
+#define FTDI_TRACE_MAGIC	"MPSSETRC"
+#define FTDI_TRACE_VERSION	1
+
+enum ftdi_trace_dir {
+	FTDI_TRACE_TX,
+	FTDI_TRACE_RX,
+};
+
+struct ftdi_trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t speed;		/* achieved bus clock, Hz */
+	uint64_t dropped;	/* records overwritten in the ring */
+};
+
+struct ftdi_trace_record {
+	uint64_t ts_ns;		/* CLOCK_MONOTONIC */
+	uint32_t len;
+	uint8_t dir;
+	uint8_t truncated;	/* larger than the ring, the data were cut */
+	uint8_t pad[2];
+};
+
+/* (re)start tracing into a ring of size bytes, the previous records are lost */
+int ftdi_mpsse_trace_start(struct ftdi_mpsse *ftdi_mpsse, size_t size);
+void ftdi_mpsse_trace_stop(struct ftdi_mpsse *ftdi_mpsse);
+/* write the ring to path, tracing goes on */
+int ftdi_mpsse_trace_dump(struct ftdi_mpsse *ftdi_mpsse, const char *path);
+
+#endif
@@ -0,0 +1,260 @@
+/*
+ * Licensed under the GPLv2
+ *
+ * Asynchronous transport: command batches are submitted without waiting for
+ * their completion and the IN endpoint is kept busy by several transfers
+ * filling a ring. The host can thus encode the next batch while the previous
+ * one is still on the wire and the replies are being collected.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <ftdi.h>
+#include <libusb.h>
+
+#include "ftdi_mpsse.h"
+#include "internal.h"
+#include "mpsse_reg.h"
+
+#define ASYNC_TX_BUFS		2
+#define ASYNC_RX_XFERS		2
+#define ASYNC_RX_SIZE		4096
+/* power of 2 */
+#define ASYNC_RING_SIZE		(64 * 1024)
+#define ASYNC_EVENT_TIMEOUT_US	10000
+
+struct ftdi_mpsse_async {
+	struct ftdi_mpsse *ftdi_mpsse;
+
+	struct ftdi_transfer_control *tx_tc[ASYNC_TX_BUFS];
+	uint8_t *tx_buf[ASYNC_TX_BUFS];
+	size_t tx_size[ASYNC_TX_BUFS];
+	unsigned int tx_next;
+
+	struct libusb_transfer *rx_xfer[ASYNC_RX_XFERS];
+	uint8_t rx_buf[ASYNC_RX_XFERS][ASYNC_RX_SIZE];
+	unsigned int rx_active;
+	int rx_error;
+	bool stopping;
+
+	uint8_t ring[ASYNC_RING_SIZE];
+	unsigned int ring_head, ring_tail;
+};
+
+static unsigned int ftdi_mpsse_async_avail(const struct ftdi_mpsse_async *async)
+{
+	return async->ring_head - async->ring_tail;
+}
+
+static void ftdi_mpsse_async_rx_cb(struct libusb_transfer *xfer)
+{
+	struct ftdi_mpsse_async *async = xfer->user_data;
+	unsigned int packet = async->ftdi_mpsse->ftdic.max_packet_size;
+	int ret;
+
+	if (xfer->status != LIBUSB_TRANSFER_COMPLETED &&
+	    xfer->status != LIBUSB_TRANSFER_TIMED_OUT) {
+		if (xfer->status != LIBUSB_TRANSFER_CANCELLED)
+			async->rx_error = LIBUSB_ERROR_IO;
+		async->rx_active--;
+		return;
+	}
+
+	/* every packet starts with 2 modem status bytes */
+	for (int off = 0; off < xfer->actual_length; off += packet) {
+		int len = min((int)packet, xfer->actual_length - off) - 2;
+
+		if (len <= 0)
+			continue;
+
+		if (ftdi_mpsse_async_avail(async) + len > ASYNC_RING_SIZE) {
+			async->rx_error = LIBUSB_ERROR_NO_MEM;
+			break;
+		}
+
+		for (int a = 0; a < len; a++)
+			async->ring[async->ring_head++ & (ASYNC_RING_SIZE - 1)] =
+				xfer->buffer[off + 2 + a];
+	}
+
+	if (async->stopping || async->rx_error) {
+		async->rx_active--;
+		return;
+	}
+
+	ret = libusb_submit_transfer(xfer);
+	if (ret < 0) {
+		async->rx_error = ret;
+		async->rx_active--;
+	}
+}
+
+static int ftdi_mpsse_async_events(struct ftdi_mpsse *ftdi_mpsse)
+{
+	struct timeval tv = { .tv_usec = ASYNC_EVENT_TIMEOUT_US };
+	int ret;
+
+	ret = libusb_handle_events_timeout_completed(ftdi_mpsse->ftdic.usb_ctx, &tv, NULL);
+	if (ret < 0)
+		return ftdi_mpsse_store_error(ftdi_mpsse, ret, false,
+					      "libusb_handle_events: %s",
+					      libusb_error_name(ret));
+
+	return 0;
+}
+
+int ftdi_mpsse_async_start(struct ftdi_mpsse *ftdi_mpsse)
+{
+	struct ftdi_mpsse_async *async;
+	int ret;
+
+	async = calloc(1, sizeof(*async));
+	if (!async)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "cannot allocate async");
+
+	async->ftdi_mpsse = ftdi_mpsse;
+	ftdi_mpsse->async = async;
+
+	for (unsigned int a = 0; a < ASYNC_RX_XFERS; a++) {
+		struct libusb_transfer *xfer = libusb_alloc_transfer(0);
+
+		if (!xfer) {
+			ret = ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+						     "cannot allocate RX transfer");
+			goto err;
+		}
+
+		async->rx_xfer[a] = xfer;
+		libusb_fill_bulk_transfer(xfer, ftdi_mpsse->ftdic.usb_dev,
+					  ftdi_mpsse->ftdic.in_ep,
+					  async->rx_buf[a], sizeof(async->rx_buf[a]),
+					  ftdi_mpsse_async_rx_cb, async,
+					  ftdi_mpsse->ftdic.usb_read_timeout);
+
+		ret = libusb_submit_transfer(xfer);
+		if (ret < 0) {
+			ftdi_mpsse_store_error(ftdi_mpsse, ret, false,
+					       "cannot submit RX transfer: %s",
+					       libusb_error_name(ret));
+			goto err;
+		}
+		async->rx_active++;
+	}
+
+	if (ftdi_mpsse->debug & MPSSE_VERBOSE)
+		fprintf(stderr, "%s: %u TX buffers, %u RX transfers of %uB\n", __func__,
+			ASYNC_TX_BUFS, ASYNC_RX_XFERS, ASYNC_RX_SIZE);
+
+	return 0;
+err:
+	ftdi_mpsse_async_stop(ftdi_mpsse);
+	return ret;
+}
+
+static int ftdi_mpsse_async_wait_tx(struct ftdi_mpsse *ftdi_mpsse, unsigned int slot)
+{
+	struct ftdi_mpsse_async *async = ftdi_mpsse->async;
+	struct ftdi_transfer_control *tc = async->tx_tc[slot];
+	int ret;
+
+	if (!tc)
+		return 0;
+
+	async->tx_tc[slot] = NULL;
+	ret = ftdi_transfer_data_done(tc);
+	if (ret < 0)
+		return ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "%s: TX failed", __func__);
+
+	return 0;
+}
+
+void ftdi_mpsse_async_stop(struct ftdi_mpsse *ftdi_mpsse)
+{
+	struct ftdi_mpsse_async *async = ftdi_mpsse->async;
+
+	if (!async)
+		return;
+
+	for (unsigned int a = 0; a < ASYNC_TX_BUFS; a++)
+		ftdi_mpsse_async_wait_tx(ftdi_mpsse, a);
+
+	async->stopping = true;
+	for (unsigned int a = 0; a < ASYNC_RX_XFERS; a++)
+		if (async->rx_xfer[a])
+			libusb_cancel_transfer(async->rx_xfer[a]);
+
+	while (async->rx_active)
+		if (ftdi_mpsse_async_events(ftdi_mpsse) < 0)
+			break;
+
+	for (unsigned int a = 0; a < ASYNC_RX_XFERS; a++)
+		libusb_free_transfer(async->rx_xfer[a]);
+	for (unsigned int a = 0; a < ASYNC_TX_BUFS; a++)
+		free(async->tx_buf[a]);
+
+	free(async);
+	ftdi_mpsse->async = NULL;
+}
+
+/*
+ * Submit the output buffer and return immediately. Only when both TX buffers
+ * are in flight, wait for the older one to complete.
+ */
+int ftdi_mpsse_async_write(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *buf, size_t len)
+{
+	struct ftdi_mpsse_async *async = ftdi_mpsse->async;
+	unsigned int slot = async->tx_next;
+	int ret;
+
+	ret = ftdi_mpsse_async_wait_tx(ftdi_mpsse, slot);
+	if (ret < 0)
+		return ret;
+
+	if (len > async->tx_size[slot]) {
+		uint8_t *tx_buf = realloc(async->tx_buf[slot], len);
+
+		if (!tx_buf)
+			return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+						      "cannot allocate TX buffer");
+		async->tx_buf[slot] = tx_buf;
+		async->tx_size[slot] = len;
+	}
+
+	memcpy(async->tx_buf[slot], buf, len);
+	async->tx_tc[slot] = ftdi_write_data_submit(&ftdi_mpsse->ftdic, async->tx_buf[slot],
+						    len);
+	if (!async->tx_tc[slot])
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, true, "ftdi_write_data_submit");
+
+	async->tx_next = (slot + 1) % ASYNC_TX_BUFS;
+
+	return len;
+}
+
+/* Return what the RX transfers collected, waiting for one event round if nothing */
+int ftdi_mpsse_async_read(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf, size_t size)
+{
+	struct ftdi_mpsse_async *async = ftdi_mpsse->async;
+	unsigned int rd;
+	int ret;
+
+	if (!ftdi_mpsse_async_avail(async)) {
+		if (async->rx_error)
+			return ftdi_mpsse_store_error(ftdi_mpsse, async->rx_error, false,
+						      "%s: RX failed: %s", __func__,
+						      libusb_error_name(async->rx_error));
+		if (!async->rx_active)
+			return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+						      "%s: no RX transfer active", __func__);
+
+		ret = ftdi_mpsse_async_events(ftdi_mpsse);
+		if (ret < 0)
+			return ret;
+	}
+
+	rd = min(ftdi_mpsse_async_avail(async), size);
+	for (unsigned int a = 0; a < rd; a++)
+		buf[a] = async->ring[async->ring_tail++ & (ASYNC_RING_SIZE - 1)];
+
+	return rd;
+}
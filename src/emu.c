@@ -0,0 +1,526 @@
+/*
+ * Licensed under the GPLv2
+ *
+ * Software MPSSE: interprets the command stream like the chip does and
+ * models the pins, so the library and the tools run without an adapter.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ftdi_mpsse.h"
+#include "internal.h"
+
+#define PIN_SK		BIT(0)
+#define PIN_DO		BIT(1)
+#define PIN_DI		BIT(2)
+#define PIN_TMS		BIT(3)
+#define PIN_GPIOL1	BIT(5)
+#define PIN_RTCK	BIT(7)
+
+/* a SET_BITS command on the chip, independent of the bus clock */
+#define SET_BITS_PS	60000
+/* a chip waiting on a line longer than this is stuck, the emulator moves on */
+#define WAIT_TIMEOUT_PS	1000000000000ULL
+
+struct ftdi_emu {
+	struct ftdi_emu_config conf;
+	const struct ftdi_mpsse_caps *caps;
+	uint16_t val;			/* what the chip drives */
+	uint16_t dir;			/* 1 = output */
+	uint16_t drive_zero;
+	uint16_t pulls;			/* by the devices */
+	uint16_t lines;
+	bool loopback;
+	bool div5;
+	bool three_phase;
+	bool adaptive;
+	uint16_t divisor;
+	uint64_t period_ps;		/* of the bus clock */
+	uint64_t bus_ps;
+	uint64_t now_ps;		/* device time: bus time plus USB latency */
+	uint64_t pending_ps;		/* bus time of the replies not read yet */
+	uint64_t ready_ns;		/* replies are visible from then on */
+	uint64_t rx_total;
+	uint64_t stall_ns;		/* the link stalls until then */
+	bool stalled;
+	/* a command split over writes */
+	uint8_t *cmd;
+	size_t cmd_cnt;
+	size_t cmd_size;
+	uint8_t *rx;
+	size_t rx_cnt;
+	size_t rx_pos;
+	size_t rx_size;
+};
+
+static const struct ftdi_emu_config ftdi_emu_default;
+/* device time at the last close, the devices outlive the emulators */
+static uint64_t ftdi_emu_last_ps;
+
+static uint16_t ftdi_emu_resolve(const struct ftdi_emu *emu)
+{
+	uint16_t drive = emu->dir & ~(emu->drive_zero & emu->val);
+	uint16_t lines = ((emu->val & drive) | ~drive) & ~emu->pulls;
+
+	for (unsigned int a = 0; a < ARRAY_SIZE(emu->conf.tied); a++) {
+		uint16_t tied = emu->conf.tied[a];
+
+		if ((lines & tied) != tied)
+			lines &= ~tied;
+	}
+
+	return lines;
+}
+
+/* Let the devices see the levels, until their pulls settle */
+static void ftdi_emu_update(struct ftdi_emu *emu)
+{
+	for (unsigned int a = 0; a < 4; a++) {
+		uint16_t lines = ftdi_emu_resolve(emu), pulls = 0;
+
+		for (unsigned int d = 0; d < emu->conf.num_devices; d++) {
+			struct ftdi_emu_device *dev = emu->conf.devices[d];
+
+			pulls |= dev->update(dev, lines, emu->now_ps / 1000);
+		}
+		if (pulls == emu->pulls)
+			break;
+		emu->pulls = pulls;
+	}
+	emu->lines = ftdi_emu_resolve(emu);
+}
+
+static void ftdi_emu_advance(struct ftdi_emu *emu, uint64_t ps)
+{
+	emu->bus_ps += ps;
+	emu->now_ps += ps;
+}
+
+static void ftdi_emu_wait_line(struct ftdi_emu *emu, uint16_t pin, bool level, uint64_t step_ps)
+{
+	for (uint64_t waited = 0; waited < WAIT_TIMEOUT_PS; waited += step_ps) {
+		if (!!(emu->lines & pin) == level)
+			return;
+		ftdi_emu_advance(emu, step_ps);
+		ftdi_emu_update(emu);
+	}
+}
+
+/* Adaptive clocking: the chip waits until RTCK follows its clock */
+static void ftdi_emu_wait_rtck(struct ftdi_emu *emu)
+{
+	ftdi_emu_wait_line(emu, PIN_RTCK, emu->val & PIN_SK, emu->period_ps / 2);
+}
+
+static void ftdi_emu_set_period(struct ftdi_emu *emu)
+{
+	uint64_t base = emu->caps->base_clock / (emu->div5 ? 5 : 1);
+
+	emu->period_ps = 2 * (emu->divisor + 1ULL) * 1000000000000ULL / base;
+}
+
+static int ftdi_emu_put(struct ftdi_emu *emu, uint8_t c)
+{
+	if (emu->rx_cnt == emu->rx_size) {
+		size_t size = emu->rx_size ? emu->rx_size * 2 : 512;
+		uint8_t *rx = realloc(emu->rx, size);
+
+		if (!rx)
+			return -ENOMEM;
+		emu->rx = rx;
+		emu->rx_size = size;
+	}
+	emu->rx[emu->rx_cnt++] = c;
+	emu->rx_total++;
+
+	return 0;
+}
+
+/*
+ * One period of SK from its idle level. The outputs were set before the
+ * first edge, DI is sampled on the edge op asks for.
+ */
+static bool ftdi_emu_clock(struct ftdi_emu *emu, uint8_t op)
+{
+	bool sample_rising = !(op & CMD_IN_FALLING);
+	bool in = false;
+
+	for (unsigned int edge = 0; edge < 2; edge++) {
+		/* 3-phase clocking holds the data a third half period */
+		if (emu->three_phase && edge)
+			ftdi_emu_advance(emu, emu->period_ps / 2);
+		ftdi_emu_advance(emu, emu->period_ps / 2);
+		emu->val ^= PIN_SK;
+		ftdi_emu_update(emu);
+		if (emu->adaptive)
+			ftdi_emu_wait_rtck(emu);
+		if (!!(emu->val & PIN_SK) == sample_rising)
+			in = emu->loopback ? emu->val & PIN_DO : emu->lines & PIN_DI;
+	}
+
+	return in;
+}
+
+/* out and the result are in the order of the wire: bit 7 first */
+static uint8_t ftdi_emu_shift(struct ftdi_emu *emu, uint8_t op, uint8_t out, unsigned int bits)
+{
+	uint8_t in = 0;
+
+	for (unsigned int b = 0; b < bits; b++) {
+		if (op & CMD_TMS) {
+			emu->val = (emu->val & ~PIN_TMS) | (out & 0x80 ? PIN_TMS : 0);
+		} else if (op & CMD_OUT) {
+			emu->val = (emu->val & ~PIN_DO) | (out & 0x80 ? PIN_DO : 0);
+		}
+		ftdi_emu_update(emu);
+		in = in << 1 | ftdi_emu_clock(emu, op);
+		out <<= 1;
+	}
+
+	return in;
+}
+
+static uint8_t ftdi_emu_reverse(uint8_t c)
+{
+	c = (c & 0xf0) >> 4 | (c & 0x0f) << 4;
+	c = (c & 0xcc) >> 2 | (c & 0x33) << 2;
+	return (c & 0xaa) >> 1 | (c & 0x55) << 1;
+}
+
+static bool ftdi_emu_data_valid(uint8_t op)
+{
+	/* TMS commands are LSB first bit mode, the data byte carries TMS */
+	if (op & CMD_TMS)
+		return (op & (CMD_LSB | CMD_BIT | CMD_OUT)) == (CMD_LSB | CMD_BIT);
+
+	return op & (CMD_OUT | CMD_IN);
+}
+
+static int ftdi_emu_data(struct ftdi_emu *emu, const uint8_t *buf)
+{
+	uint8_t op = buf[0];
+	bool lsb = op & CMD_LSB;
+	int ret = 0;
+
+	if (op & (CMD_BIT | CMD_TMS)) {
+		unsigned int bits = (buf[1] & 7) + 1;
+		uint8_t out = op & (CMD_OUT | CMD_TMS) ? buf[2] : 0;
+		uint8_t in;
+
+		/* TMS commands keep DO at bit 7 of the data byte */
+		if (op & CMD_TMS)
+			emu->val = (emu->val & ~PIN_DO) | (out & 0x80 ? PIN_DO : 0);
+
+		in = ftdi_emu_shift(emu, op, lsb ? ftdi_emu_reverse(out) : out, bits);
+		/* MSB first shifts in from bit 0, LSB first from bit 7 */
+		if (op & CMD_IN)
+			ret = ftdi_emu_put(emu, lsb ? ftdi_emu_reverse(in) : in);
+		return ret;
+	}
+
+	for (unsigned int a = 0, len = (buf[1] | buf[2] << 8) + 1; a < len && !ret; a++) {
+		uint8_t out = op & CMD_OUT ? buf[3 + a] : 0;
+		uint8_t in;
+
+		in = ftdi_emu_shift(emu, op, lsb ? ftdi_emu_reverse(out) : out, 8);
+		if (op & CMD_IN)
+			ret = ftdi_emu_put(emu, lsb ? ftdi_emu_reverse(in) : in);
+	}
+
+	return ret;
+}
+
+/* Length of the command at buf, which may be more than avail */
+static size_t ftdi_emu_cmd_len(const struct ftdi_emu *emu, const uint8_t *buf, size_t avail)
+{
+	uint8_t op = buf[0];
+
+	if (op < 0x80) {
+		if (!ftdi_emu_data_valid(op))
+			return 1;
+		if (op & (CMD_BIT | CMD_TMS))
+			return op & (CMD_OUT | CMD_TMS) ? 3 : 2;
+		if (!(op & CMD_OUT) || avail < 3)
+			return 3;
+		return 3 + (buf[1] | buf[2] << 8) + 1;
+	}
+
+	switch (op) {
+	case CMD_SET_BITS_LOW:
+	case CMD_SET_BITS_HIGH:
+	case CMD_SET_CLK_DIVISOR:
+	case CMD_CLK_BYTES:
+		return 3;
+	case CMD_CLK_BITS:
+		return 2;
+	case CMD_DRIVE_ONLY_ZERO:
+		return emu->caps->drive_zero ? 3 : 1;
+	default:
+		return 1;
+	}
+}
+
+static int ftdi_emu_exec(struct ftdi_emu *emu, const uint8_t *buf)
+{
+	uint8_t op = buf[0];
+
+	if (op < 0x80) {
+		if (ftdi_emu_data_valid(op))
+			return ftdi_emu_data(emu, buf);
+		goto bad;
+	}
+
+	switch (op) {
+	case CMD_SET_BITS_LOW:
+		emu->val = (emu->val & 0xff00) | buf[1];
+		emu->dir = (emu->dir & 0xff00) | buf[2];
+		ftdi_emu_advance(emu, SET_BITS_PS);
+		ftdi_emu_update(emu);
+		return 0;
+	case CMD_SET_BITS_HIGH:
+		emu->val = (emu->val & 0x00ff) | buf[1] << 8;
+		emu->dir = (emu->dir & 0x00ff) | buf[2] << 8;
+		ftdi_emu_advance(emu, SET_BITS_PS);
+		ftdi_emu_update(emu);
+		return 0;
+	case CMD_GET_BITS_LOW:
+		return ftdi_emu_put(emu, emu->lines);
+	case CMD_GET_BITS_HIGH:
+		return ftdi_emu_put(emu, emu->lines >> 8);
+	case CMD_LOOPBACK_EN:
+	case CMD_LOOPBACK_DIS:
+		emu->loopback = op == CMD_LOOPBACK_EN;
+		return 0;
+	case CMD_SET_CLK_DIVISOR:
+		emu->divisor = buf[1] | buf[2] << 8;
+		ftdi_emu_set_period(emu);
+		return 0;
+	case CMD_SEND_IMMEDIATE:
+		return 0;
+	case CMD_CLK_BITS:
+		for (unsigned int a = 0; a <= buf[1]; a++)
+			ftdi_emu_clock(emu, op);
+		return 0;
+	case CMD_CLK_BYTES:
+		for (unsigned int a = 0; a < ((buf[1] | buf[2] << 8) + 1U) * 8; a++)
+			ftdi_emu_clock(emu, op);
+		return 0;
+	case CMD_WAIT_ON_IO_HIGH:
+	case CMD_WAIT_ON_IO_LOW:
+		ftdi_emu_wait_line(emu, PIN_GPIOL1, op == CMD_WAIT_ON_IO_HIGH, SET_BITS_PS);
+		return 0;
+	}
+
+	/* the rest exists on the H series only */
+	if (!emu->caps->h_series)
+		goto bad;
+
+	switch (op) {
+	case CMD_CLK_DIV5_DIS:
+	case CMD_CLK_DIV5_EN:
+		emu->div5 = op == CMD_CLK_DIV5_EN;
+		ftdi_emu_set_period(emu);
+		return 0;
+	case CMD_CLK_3PHASE_EN:
+	case CMD_CLK_3PHASE_DIS:
+		emu->three_phase = op == CMD_CLK_3PHASE_EN;
+		return 0;
+	case CMD_CLK_ADAPTIVE_EN:
+	case CMD_CLK_ADAPTIVE_DIS:
+		emu->adaptive = op == CMD_CLK_ADAPTIVE_EN;
+		return 0;
+	case CMD_DRIVE_ONLY_ZERO:
+		if (!emu->caps->drive_zero)
+			break;
+		emu->drive_zero = buf[1] | buf[2] << 8;
+		ftdi_emu_update(emu);
+		return 0;
+	}
+bad:
+	if (ftdi_emu_put(emu, CMD_INVALID) < 0)
+		return -ENOMEM;
+	return ftdi_emu_put(emu, op);
+}
+
+/* Power-up state of MPSSE mode, with the directions of ftdi_set_bitmode() */
+static void ftdi_emu_reset_state(struct ftdi_emu *emu, uint8_t gpio_dir)
+{
+	emu->val = 0;
+	emu->dir = gpio_dir;
+	emu->drive_zero = 0;
+	emu->loopback = false;
+	emu->div5 = emu->caps->h_series;
+	emu->three_phase = false;
+	emu->adaptive = false;
+	emu->divisor = 0xffff;
+	ftdi_emu_set_period(emu);
+	emu->cmd_cnt = 0;
+	emu->rx_cnt = 0;
+	emu->rx_pos = 0;
+	emu->pending_ps = 0;
+	emu->ready_ns = 0;
+	ftdi_emu_update(emu);
+}
+
+static int ftdi_emu_open(struct ftdi_mpsse *ftdi_mpsse, const struct ftdi_mpsse_config *conf)
+{
+	const struct ftdi_emu_config *emu_conf = conf->transport_conf ? : &ftdi_emu_default;
+	unsigned int channel = conf->iface > INTERFACE_ANY ? conf->iface - INTERFACE_A : 0;
+	struct ftdi_emu *emu;
+	int ret;
+
+	ret = ftdi_mpsse_set_caps(ftdi_mpsse, emu_conf->type ? : TYPE_232H, channel);
+	if (ret < 0)
+		return ret;
+
+	emu = calloc(1, sizeof(*emu));
+	if (!emu)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -ENOMEM, false,
+					      "cannot allocate the emulator");
+
+	emu->conf = *emu_conf;
+	emu->caps = ftdi_mpsse->caps;
+	emu->now_ps = max(ftdi_mpsse_now_ns() * 1000,
+			  __atomic_load_n(&ftdi_emu_last_ps, __ATOMIC_RELAXED));
+	ftdi_emu_reset_state(emu, conf->gpio_dir);
+	ftdi_mpsse->transport_priv = emu;
+
+	return 0;
+}
+
+static int ftdi_emu_reset(struct ftdi_mpsse *ftdi_mpsse, const struct ftdi_mpsse_config *conf)
+{
+	ftdi_emu_reset_state(ftdi_mpsse->transport_priv, conf->gpio_dir);
+
+	return 0;
+}
+
+static int ftdi_emu_write(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *buf, size_t len)
+{
+	struct ftdi_emu *emu = ftdi_mpsse->transport_priv;
+	size_t rx_cnt = emu->rx_cnt, pos = 0;
+	uint64_t bus_ps = emu->bus_ps;
+	int ret = 0;
+
+	if (emu->cmd_cnt + len > emu->cmd_size) {
+		size_t size = max(emu->cmd_cnt + len, 2 * emu->cmd_size);
+		uint8_t *cmd = realloc(emu->cmd, size);
+
+		if (!cmd)
+			return ftdi_mpsse_store_error(ftdi_mpsse, -ENOMEM, false,
+						      "emulator: cannot allocate %zuB", size);
+		emu->cmd = cmd;
+		emu->cmd_size = size;
+	}
+	memcpy(emu->cmd + emu->cmd_cnt, buf, len);
+	emu->cmd_cnt += len;
+	emu->now_ps += emu->conf.latency_us * 1000000ULL;
+
+	while (pos < emu->cmd_cnt) {
+		size_t cmd_len = ftdi_emu_cmd_len(emu, emu->cmd + pos, emu->cmd_cnt - pos);
+
+		if (cmd_len > emu->cmd_cnt - pos)
+			break;
+		ret = ftdi_emu_exec(emu, emu->cmd + pos);
+		if (ret < 0)
+			return ftdi_mpsse_store_error(ftdi_mpsse, ret, false,
+						      "emulator: cannot queue a reply");
+		pos += cmd_len;
+	}
+	memmove(emu->cmd, emu->cmd + pos, emu->cmd_cnt - pos);
+	emu->cmd_cnt -= pos;
+
+	emu->pending_ps += emu->bus_ps - bus_ps;
+	if (emu->rx_cnt > rx_cnt) {
+		uint64_t ready_ns = ftdi_mpsse_now_ns() + emu->conf.latency_us * 1000ULL;
+
+		if (emu->conf.real_time)
+			ready_ns += emu->pending_ps / 1000;
+		emu->pending_ps = 0;
+		emu->ready_ns = max(emu->ready_ns, ready_ns);
+	}
+
+	if (emu->conf.stall_ms && !emu->stalled && emu->rx_total > emu->conf.stall_at) {
+		emu->stalled = true;
+		emu->stall_ns = ftdi_mpsse_now_ns() + emu->conf.stall_ms * 1000000ULL;
+	}
+
+	return len;
+}
+
+static int ftdi_emu_read(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf, size_t size)
+{
+	struct ftdi_emu *emu = ftdi_mpsse->transport_priv;
+	size_t len = min(emu->rx_cnt - emu->rx_pos, size);
+
+	if (!len)
+		return 0;
+
+	/* a short wait without data, as USB reads do */
+	if (emu->stall_ns > ftdi_mpsse_now_ns()) {
+		struct timespec ts = { .tv_nsec = 1000000 };
+
+		nanosleep(&ts, NULL);
+		return 0;
+	}
+
+	if (emu->ready_ns > ftdi_mpsse_now_ns()) {
+		struct timespec ts = {
+			.tv_sec = emu->ready_ns / 1000000000,
+			.tv_nsec = emu->ready_ns % 1000000000,
+		};
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+	}
+
+	memcpy(buf, emu->rx + emu->rx_pos, len);
+	emu->rx_pos += len;
+	if (emu->rx_pos == emu->rx_cnt)
+		emu->rx_pos = emu->rx_cnt = 0;
+
+	return len;
+}
+
+static void ftdi_emu_close(struct ftdi_mpsse *ftdi_mpsse)
+{
+	struct ftdi_emu *emu = ftdi_mpsse->transport_priv;
+	uint64_t last_ps = __atomic_load_n(&ftdi_emu_last_ps, __ATOMIC_RELAXED);
+
+	while (last_ps < emu->now_ps &&
+	       !__atomic_compare_exchange_n(&ftdi_emu_last_ps, &last_ps, emu->now_ps, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	free(emu->cmd);
+	free(emu->rx);
+	free(emu);
+	ftdi_mpsse->transport_priv = NULL;
+}
+
+const struct ftdi_mpsse_transport ftdi_mpsse_transport_emu = {
+	.name = "emulator",
+	.open = ftdi_emu_open,
+	.reset = ftdi_emu_reset,
+	.write = ftdi_emu_write,
+	.read = ftdi_emu_read,
+	.close = ftdi_emu_close,
+};
+
+uint64_t ftdi_emu_get_bus_ns(const struct ftdi_mpsse *ftdi_mpsse)
+{
+	const struct ftdi_emu *emu = ftdi_mpsse->transport_priv;
+
+	if (ftdi_mpsse->transport != &ftdi_mpsse_transport_emu)
+		return 0;
+
+	return emu->bus_ps / 1000;
+}
+
+void ftdi_emu_device_free(struct ftdi_emu_device *dev)
+{
+	if (dev && dev->free)
+		dev->free(dev);
+	else
+		free(dev);
+}
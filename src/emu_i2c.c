@@ -0,0 +1,738 @@
+/*
+ * Licensed under the GPLv2
+ *
+ * I2C target models for the emulator: a bit-level target on SCL/SDA feeding
+ * the byte-level models of the devices driven by examples/.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ftdi_mpsse.h"
+#include "internal.h"
+
+#define PIN_SCL		BIT(0)
+#define PIN_SDA		BIT(1)
+
+struct ftdi_emu_i2c;
+
+struct ftdi_emu_i2c_ops {
+	/* whether the address is ACKed */
+	bool (*start)(struct ftdi_emu_i2c *i2c, bool read, uint64_t now_ns);
+	/* whether the byte is ACKed, idx 1 is the first after the address */
+	bool (*write)(struct ftdi_emu_i2c *i2c, unsigned int idx, uint8_t c, uint64_t now_ns);
+	uint8_t (*read)(struct ftdi_emu_i2c *i2c, uint64_t now_ns);
+	void (*stop)(struct ftdi_emu_i2c *i2c, uint64_t now_ns);
+};
+
+struct ftdi_emu_i2c {
+	struct ftdi_emu_device dev;
+	const struct ftdi_emu_i2c_ops *ops;
+	struct ftdi_emu_i2c_faults faults;
+	unsigned int nacks;
+	uint8_t address;
+	uint8_t address_mask;		/* address bits used as memory address */
+	uint8_t selected;		/* the address of the transfer */
+	bool read;
+	enum {
+		I2C_IDLE,
+		I2C_ADDR,
+		I2C_WRITE,
+		I2C_READ,
+	} state;
+	bool active;			/* addressed since the last START */
+	uint16_t prev;
+	unsigned int bit;
+	unsigned int idx;
+	uint8_t byte;
+	bool host_nack;
+	bool sda_pull;
+	bool scl_pull;
+	uint64_t stretch_until;
+};
+
+static bool ftdi_emu_i2c_fault(struct ftdi_emu_i2c *i2c)
+{
+	if (i2c->faults.nack_at < 0 || (unsigned int)i2c->faults.nack_at != i2c->idx)
+		return false;
+	if (i2c->faults.nack_count && i2c->nacks >= i2c->faults.nack_count)
+		return false;
+
+	i2c->nacks++;
+
+	return true;
+}
+
+/* SCL fell after 8 bits: the ACK slot */
+static void ftdi_emu_i2c_ack_slot(struct ftdi_emu_i2c *i2c, uint64_t now_ns)
+{
+	bool ack;
+
+	switch (i2c->state) {
+	case I2C_ADDR:
+		if ((i2c->byte >> 1 & ~i2c->address_mask) != (i2c->address & ~i2c->address_mask)) {
+			i2c->state = I2C_IDLE;
+			return;
+		}
+		i2c->selected = i2c->byte >> 1;
+		i2c->read = i2c->byte & 1;
+		ack = !ftdi_emu_i2c_fault(i2c) && i2c->ops->start(i2c, i2c->read, now_ns);
+		i2c->active |= ack;
+		break;
+	case I2C_WRITE:
+		ack = !ftdi_emu_i2c_fault(i2c) &&
+		      i2c->ops->write(i2c, i2c->idx, i2c->byte, now_ns);
+		break;
+	default:
+		/* the host's ACK */
+		i2c->sda_pull = false;
+		return;
+	}
+
+	i2c->sda_pull = ack;
+	if (!ack)
+		i2c->state = I2C_IDLE;
+}
+
+/* SCL fell after the ACK: the next byte */
+static void ftdi_emu_i2c_next(struct ftdi_emu_i2c *i2c, uint64_t now_ns)
+{
+	i2c->sda_pull = false;
+	i2c->bit = 0;
+	i2c->byte = 0;
+	i2c->idx++;
+
+	if (i2c->faults.stretch_ns) {
+		i2c->scl_pull = true;
+		i2c->stretch_until = now_ns + i2c->faults.stretch_ns;
+	}
+
+	if (i2c->state == I2C_ADDR)
+		i2c->state = i2c->read ? I2C_READ : I2C_WRITE;
+	else if (i2c->state == I2C_READ && i2c->host_nack)
+		i2c->state = I2C_IDLE;
+
+	if (i2c->state == I2C_READ)
+		i2c->byte = i2c->ops->read(i2c, now_ns);
+}
+
+static uint16_t ftdi_emu_i2c_update(struct ftdi_emu_device *dev, uint16_t lines, uint64_t now_ns)
+{
+	struct ftdi_emu_i2c *i2c = (struct ftdi_emu_i2c *)dev;
+	bool scl = lines & PIN_SCL, sda = lines & PIN_SDA;
+	bool prev_scl = i2c->prev & PIN_SCL, prev_sda = i2c->prev & PIN_SDA;
+
+	i2c->prev = lines;
+
+	if (i2c->scl_pull && now_ns >= i2c->stretch_until)
+		i2c->scl_pull = false;
+
+	if (scl && prev_scl && sda != prev_sda) {
+		if (!sda) {
+			/* (repeated) START, the target is addressed again */
+			i2c->state = I2C_ADDR;
+			i2c->active = false;
+			i2c->idx = 0;
+			i2c->bit = 0;
+			i2c->byte = 0;
+		} else {
+			/* the models see where in the byte the STOP came */
+			if (i2c->active)
+				i2c->ops->stop(i2c, now_ns);
+			i2c->state = I2C_IDLE;
+			i2c->active = false;
+		}
+	} else if (scl && !prev_scl && i2c->state != I2C_IDLE) {
+		if (i2c->state != I2C_READ && i2c->bit < 8)
+			i2c->byte = i2c->byte << 1 | sda;
+		else if (i2c->state == I2C_READ && i2c->bit == 8)
+			i2c->host_nack = sda;
+		i2c->bit++;
+	} else if (!scl && prev_scl && i2c->state != I2C_IDLE) {
+		if (i2c->bit == 8)
+			ftdi_emu_i2c_ack_slot(i2c, now_ns);
+		else if (i2c->bit == 9)
+			ftdi_emu_i2c_next(i2c, now_ns);
+		if (i2c->state == I2C_READ && i2c->bit < 8)
+			i2c->sda_pull = !(i2c->byte & (0x80 >> i2c->bit));
+	}
+
+	return (i2c->sda_pull ? PIN_SDA : 0) | (i2c->scl_pull ? PIN_SCL : 0);
+}
+
+static void *ftdi_emu_i2c_new(size_t size, const char *name, const struct ftdi_emu_i2c_ops *ops,
+			      uint8_t address)
+{
+	struct ftdi_emu_i2c *i2c = calloc(1, size);
+
+	if (!i2c)
+		return NULL;
+
+	i2c->dev.name = name;
+	i2c->dev.update = ftdi_emu_i2c_update;
+	i2c->ops = ops;
+	i2c->address = address;
+	i2c->faults.nack_at = -1;
+	i2c->prev = PIN_SCL | PIN_SDA;
+
+	return i2c;
+}
+
+int ftdi_emu_i2c_set_faults(struct ftdi_emu_device *dev, const struct ftdi_emu_i2c_faults *faults)
+{
+	struct ftdi_emu_i2c *i2c = (struct ftdi_emu_i2c *)dev;
+
+	if (dev->update != ftdi_emu_i2c_update)
+		return -1;
+
+	i2c->faults = *faults;
+	i2c->nacks = 0;
+
+	return 0;
+}
+
+/*
+ * 24Cxx EEPROM. Up to 2 KiB the memory address is one byte, its upper bits
+ * taken from the device address. Written bytes wrap within the page and are
+ * programmed at a STOP following an ACK, the device then NACKs its address
+ * for tWR. A START or a STOP inside a byte drops them.
+ */
+#define EEPROM_TWR_NS	5000000
+
+struct ftdi_emu_24cxx {
+	struct ftdi_emu_i2c i2c;
+	unsigned int size;
+	unsigned int page_size;
+	unsigned int addr_bytes;
+	unsigned int ptr;
+	unsigned int written;
+	uint64_t busy_until;
+	uint8_t *page;
+	bool *dirty;
+	uint8_t mem[];
+};
+
+static void ftdi_emu_24cxx_discard(struct ftdi_emu_24cxx *ee)
+{
+	memset(ee->dirty, 0, ee->page_size * sizeof(*ee->dirty));
+	ee->written = 0;
+}
+
+static bool ftdi_emu_24cxx_start(struct ftdi_emu_i2c *i2c, bool read, uint64_t now_ns)
+{
+	struct ftdi_emu_24cxx *ee = (struct ftdi_emu_24cxx *)i2c;
+
+	(void)read;
+	if (now_ns < ee->busy_until)
+		return false;
+
+	ftdi_emu_24cxx_discard(ee);
+	if (ee->addr_bytes == 1)
+		ee->ptr = (ee->ptr & 0xff) | (i2c->selected & i2c->address_mask) << 8;
+
+	return true;
+}
+
+static bool ftdi_emu_24cxx_write(struct ftdi_emu_i2c *i2c, unsigned int idx, uint8_t c,
+				 uint64_t now_ns)
+{
+	struct ftdi_emu_24cxx *ee = (struct ftdi_emu_24cxx *)i2c;
+	unsigned int page_start = ee->ptr - ee->ptr % ee->page_size;
+
+	(void)now_ns;
+	if (idx <= ee->addr_bytes) {
+		if (ee->addr_bytes == 1)
+			ee->ptr = (ee->ptr & ~0xffU) | c;
+		else if (idx == 1)
+			ee->ptr = c << 8;
+		else
+			ee->ptr |= c;
+		ee->ptr %= ee->size;
+		return true;
+	}
+
+	ee->page[ee->ptr % ee->page_size] = c;
+	ee->dirty[ee->ptr % ee->page_size] = true;
+	ee->ptr = page_start + (ee->ptr + 1) % ee->page_size;
+	ee->written++;
+
+	return true;
+}
+
+static uint8_t ftdi_emu_24cxx_read(struct ftdi_emu_i2c *i2c, uint64_t now_ns)
+{
+	struct ftdi_emu_24cxx *ee = (struct ftdi_emu_24cxx *)i2c;
+	uint8_t c = ee->mem[ee->ptr];
+
+	(void)now_ns;
+	ee->ptr = (ee->ptr + 1) % ee->size;
+
+	return c;
+}
+
+static void ftdi_emu_24cxx_stop(struct ftdi_emu_i2c *i2c, uint64_t now_ns)
+{
+	struct ftdi_emu_24cxx *ee = (struct ftdi_emu_24cxx *)i2c;
+	unsigned int page_start = ee->ptr - ee->ptr % ee->page_size;
+
+	if (!ee->written)
+		return;
+
+	/* the SCL rise of the STOP itself counts as the first bit */
+	if (i2c->state == I2C_WRITE && i2c->bit > 1) {
+		ftdi_emu_24cxx_discard(ee);
+		return;
+	}
+
+	for (unsigned int a = 0; a < ee->page_size; a++) {
+		if (ee->dirty[a])
+			ee->mem[page_start + a] = ee->page[a];
+	}
+	ftdi_emu_24cxx_discard(ee);
+	ee->busy_until = now_ns + EEPROM_TWR_NS;
+}
+
+static const struct ftdi_emu_i2c_ops ftdi_emu_24cxx_ops = {
+	.start = ftdi_emu_24cxx_start,
+	.write = ftdi_emu_24cxx_write,
+	.read = ftdi_emu_24cxx_read,
+	.stop = ftdi_emu_24cxx_stop,
+};
+
+struct ftdi_emu_device *ftdi_emu_24cxx_new(uint8_t address, unsigned int size,
+					   unsigned int page_size)
+{
+	struct ftdi_emu_24cxx *ee;
+
+	if (!size || !page_size || size % page_size || size > 0x10000)
+		return NULL;
+
+	ee = ftdi_emu_i2c_new(sizeof(*ee) + size + page_size * (1 + sizeof(bool)), "24cxx",
+			      &ftdi_emu_24cxx_ops, address);
+	if (!ee)
+		return NULL;
+
+	ee->size = size;
+	ee->page_size = page_size;
+	ee->addr_bytes = size > 2048 ? 2 : 1;
+	if (ee->addr_bytes == 1)
+		ee->i2c.address_mask = (size - 1) >> 8;
+	ee->page = ee->mem + size;
+	ee->dirty = (bool *)(ee->page + page_size);
+	memset(ee->mem, 0xff, size);
+
+	return &ee->i2c.dev;
+}
+
+uint8_t *ftdi_emu_24cxx_get_memory(struct ftdi_emu_device *dev)
+{
+	struct ftdi_emu_i2c *i2c = (struct ftdi_emu_i2c *)dev;
+
+	if (dev->update != ftdi_emu_i2c_update || i2c->ops != &ftdi_emu_24cxx_ops)
+		return NULL;
+
+	return ((struct ftdi_emu_24cxx *)i2c)->mem;
+}
+
+/*
+ * Register files: the first written byte is the register pointer, which
+ * increments on every access.
+ */
+struct ftdi_emu_regs {
+	struct ftdi_emu_i2c i2c;
+	uint8_t ptr;
+	uint8_t regs[256];
+};
+
+static bool ftdi_emu_regs_start(struct ftdi_emu_i2c *i2c, bool read, uint64_t now_ns)
+{
+	(void)i2c;
+	(void)read;
+	(void)now_ns;
+
+	return true;
+}
+
+/*
+ * BME280: calibration and raw data are the datasheet's examples (25.08 °C,
+ * 1006.5 hPa). Writes come in register/value pairs.
+ */
+static const uint8_t ftdi_emu_bme280_calib[] = {
+	/* 0x88: T1..T3, P1..P9 */
+	0x70, 0x6b, 0x43, 0x67, 0x18, 0xfc, 0x7d, 0x8e, 0x43, 0xd6, 0xd0, 0x0b,
+	0x27, 0x0b, 0x8c, 0x00, 0xf9, 0xff, 0x8c, 0x3c, 0xf8, 0xc6, 0x70, 0x17,
+};
+
+static const uint8_t ftdi_emu_bme280_hum[] = {
+	/* 0xe1: H2, H3, H4/H5, H6 */
+	0x6a, 0x01, 0x00, 0x13, 0x2a, 0x03, 0x1e,
+};
+
+/* 0xf7: press, temp, hum */
+static const uint8_t ftdi_emu_bme280_data[] = { 0x65, 0x5a, 0xc0, 0x7e, 0xed, 0x00, 0x6e, 0x8f };
+
+static void ftdi_emu_bme280_reset(struct ftdi_emu_regs *bme)
+{
+	memset(bme->regs, 0, sizeof(bme->regs));
+	memcpy(&bme->regs[0x88], ftdi_emu_bme280_calib, sizeof(ftdi_emu_bme280_calib));
+	bme->regs[0xa1] = 0x4b;		/* H1 */
+	bme->regs[0xd0] = 0x60;		/* id */
+	memcpy(&bme->regs[0xe1], ftdi_emu_bme280_hum, sizeof(ftdi_emu_bme280_hum));
+	memcpy(&bme->regs[0xf7], ftdi_emu_bme280_data, sizeof(ftdi_emu_bme280_data));
+}
+
+static bool ftdi_emu_bme280_write(struct ftdi_emu_i2c *i2c, unsigned int idx, uint8_t c,
+				  uint64_t now_ns)
+{
+	struct ftdi_emu_regs *bme = (struct ftdi_emu_regs *)i2c;
+
+	(void)now_ns;
+	if (idx & 1) {
+		bme->ptr = c;
+		return true;
+	}
+
+	switch (bme->ptr) {
+	case 0xe0:
+		if (c == 0xb6)
+			ftdi_emu_bme280_reset(bme);
+		break;
+	case 0xf2:
+	case 0xf4:
+	case 0xf5:
+		bme->regs[bme->ptr] = c;
+		break;
+	}
+
+	return true;
+}
+
+static uint8_t ftdi_emu_regs_read(struct ftdi_emu_i2c *i2c, uint64_t now_ns)
+{
+	struct ftdi_emu_regs *regs = (struct ftdi_emu_regs *)i2c;
+
+	(void)now_ns;
+
+	return regs->regs[regs->ptr++];
+}
+
+static void ftdi_emu_regs_stop(struct ftdi_emu_i2c *i2c, uint64_t now_ns)
+{
+	(void)i2c;
+	(void)now_ns;
+}
+
+static const struct ftdi_emu_i2c_ops ftdi_emu_bme280_ops = {
+	.start = ftdi_emu_regs_start,
+	.write = ftdi_emu_bme280_write,
+	.read = ftdi_emu_regs_read,
+	.stop = ftdi_emu_regs_stop,
+};
+
+struct ftdi_emu_device *ftdi_emu_bme280_new(uint8_t address)
+{
+	struct ftdi_emu_regs *bme;
+
+	bme = ftdi_emu_i2c_new(sizeof(*bme), "bme280", &ftdi_emu_bme280_ops, address);
+	if (!bme)
+		return NULL;
+
+	ftdi_emu_bme280_reset(bme);
+
+	return &bme->i2c.dev;
+}
+
+/*
+ * DS3231: the clock starts at 2000-01-01 00:00:00 of the emulated time and
+ * runs with it, writing the time registers sets it.
+ */
+#define DS3231_REGS	0x13
+
+struct ftdi_emu_ds3231 {
+	struct ftdi_emu_regs regs;
+	time_t base;
+	uint64_t base_ns;
+	bool set;
+};
+
+static uint8_t ftdi_emu_bcd(unsigned int val)
+{
+	return (val / 10) << 4 | val % 10;
+}
+
+static unsigned int ftdi_emu_from_bcd(uint8_t bcd)
+{
+	return (bcd >> 4) * 10 + (bcd & 0xf);
+}
+
+static void ftdi_emu_ds3231_latch(struct ftdi_emu_ds3231 *rtc, uint64_t now_ns)
+{
+	time_t t = rtc->base + (now_ns - rtc->base_ns) / 1000000000;
+	uint8_t *regs = rtc->regs.regs;
+	struct tm tm;
+
+	gmtime_r(&t, &tm);
+	regs[0] = ftdi_emu_bcd(tm.tm_sec);
+	regs[1] = ftdi_emu_bcd(tm.tm_min);
+	regs[2] = ftdi_emu_bcd(tm.tm_hour);
+	regs[3] = tm.tm_wday + 1;
+	regs[4] = ftdi_emu_bcd(tm.tm_mday);
+	regs[5] = ftdi_emu_bcd(tm.tm_mon + 1) | (tm.tm_year >= 200 ? 0x80 : 0);
+	regs[6] = ftdi_emu_bcd(tm.tm_year % 100);
+}
+
+static bool ftdi_emu_ds3231_start(struct ftdi_emu_i2c *i2c, bool read, uint64_t now_ns)
+{
+	struct ftdi_emu_ds3231 *rtc = (struct ftdi_emu_ds3231 *)i2c;
+
+	/* the time is latched at START, like the chip's user buffer */
+	if (!rtc->set)
+		ftdi_emu_ds3231_latch(rtc, now_ns);
+	(void)read;
+
+	return true;
+}
+
+static bool ftdi_emu_ds3231_write(struct ftdi_emu_i2c *i2c, unsigned int idx, uint8_t c,
+				  uint64_t now_ns)
+{
+	struct ftdi_emu_ds3231 *rtc = (struct ftdi_emu_ds3231 *)i2c;
+
+	(void)now_ns;
+	if (idx == 1) {
+		rtc->regs.ptr = c % DS3231_REGS;
+		return true;
+	}
+
+	/* temperature and the status flags are read-only */
+	if (rtc->regs.ptr < 0x07)
+		rtc->set = true;
+	if (rtc->regs.ptr < 0x11 && rtc->regs.ptr != 0x0f)
+		rtc->regs.regs[rtc->regs.ptr] = c;
+	rtc->regs.ptr = (rtc->regs.ptr + 1) % DS3231_REGS;
+
+	return true;
+}
+
+static uint8_t ftdi_emu_ds3231_read(struct ftdi_emu_i2c *i2c, uint64_t now_ns)
+{
+	struct ftdi_emu_ds3231 *rtc = (struct ftdi_emu_ds3231 *)i2c;
+	uint8_t c = rtc->regs.regs[rtc->regs.ptr];
+
+	(void)now_ns;
+	rtc->regs.ptr = (rtc->regs.ptr + 1) % DS3231_REGS;
+
+	return c;
+}
+
+static void ftdi_emu_ds3231_stop(struct ftdi_emu_i2c *i2c, uint64_t now_ns)
+{
+	struct ftdi_emu_ds3231 *rtc = (struct ftdi_emu_ds3231 *)i2c;
+	const uint8_t *regs = rtc->regs.regs;
+	struct tm tm = {
+		.tm_sec = ftdi_emu_from_bcd(regs[0] & 0x7f),
+		.tm_min = ftdi_emu_from_bcd(regs[1] & 0x7f),
+		.tm_hour = ftdi_emu_from_bcd(regs[2] & 0x3f),
+		.tm_mday = ftdi_emu_from_bcd(regs[4] & 0x3f),
+		.tm_mon = ftdi_emu_from_bcd(regs[5] & 0x1f) - 1,
+		.tm_year = ftdi_emu_from_bcd(regs[6]) + (regs[5] & 0x80 ? 200 : 100),
+	};
+
+	if (!rtc->set)
+		return;
+
+	rtc->base = timegm(&tm);
+	rtc->base_ns = now_ns;
+	rtc->set = false;
+}
+
+static const struct ftdi_emu_i2c_ops ftdi_emu_ds3231_ops = {
+	.start = ftdi_emu_ds3231_start,
+	.write = ftdi_emu_ds3231_write,
+	.read = ftdi_emu_ds3231_read,
+	.stop = ftdi_emu_ds3231_stop,
+};
+
+struct ftdi_emu_device *ftdi_emu_ds3231_new(uint8_t address)
+{
+	struct ftdi_emu_ds3231 *rtc;
+
+	rtc = ftdi_emu_i2c_new(sizeof(*rtc), "ds3231", &ftdi_emu_ds3231_ops, address);
+	if (!rtc)
+		return NULL;
+
+	rtc->base = 946684800;		/* 2000-01-01 */
+	rtc->regs.regs[0x0e] = 0x1c;	/* control */
+	rtc->regs.regs[0x11] = 25;	/* temperature */
+
+	return &rtc->regs.i2c.dev;
+}
+
+/*
+ * SSD1306: every transfer is a control byte followed by commands or data
+ * (Co = 0), or by one command or data byte and another control byte (Co = 1).
+ * Data land in the GDDRAM as the addressing commands set.
+ */
+struct ftdi_emu_ssd1306 {
+	struct ftdi_emu_i2c i2c;
+	bool control;			/* next byte is a control byte */
+	bool continuation;		/* Co */
+	bool data;			/* D/C# */
+	uint8_t cmd[7];
+	unsigned int cmd_len;
+	unsigned int mode;		/* 0 horizontal, 1 vertical, 2 page */
+	unsigned int col, col_start, col_end;
+	unsigned int page, page_start, page_end;
+	uint8_t ram[8 * 128];
+};
+
+/* number of argument bytes of a command */
+static unsigned int ftdi_emu_ssd1306_args(uint8_t cmd)
+{
+	switch (cmd) {
+	case 0x20: case 0x23: case 0x81: case 0x8d: case 0xa8: case 0xd3:
+	case 0xd5: case 0xd9: case 0xda: case 0xdb:
+		return 1;
+	case 0x21: case 0x22: case 0xa3:
+		return 2;
+	case 0x29: case 0x2a:
+		return 5;
+	case 0x26: case 0x27:
+		return 6;
+	default:
+		return 0;
+	}
+}
+
+static void ftdi_emu_ssd1306_cmd(struct ftdi_emu_ssd1306 *oled)
+{
+	const uint8_t *cmd = oled->cmd;
+
+	switch (cmd[0]) {
+	case 0x00 ... 0x0f:
+		oled->col = (oled->col & 0xf0) | (cmd[0] & 0x0f);
+		break;
+	case 0x10 ... 0x17:
+		oled->col = (oled->col & 0x0f) | (cmd[0] & 0x07) << 4;
+		break;
+	case 0x20:
+		oled->mode = cmd[1] & 3;
+		break;
+	case 0x21:
+		oled->col_start = oled->col = cmd[1] & 0x7f;
+		oled->col_end = cmd[2] & 0x7f;
+		break;
+	case 0x22:
+		oled->page_start = oled->page = cmd[1] & 7;
+		oled->page_end = cmd[2] & 7;
+		break;
+	case 0xb0 ... 0xb7:
+		oled->page = cmd[0] & 7;
+		break;
+	}
+}
+
+static void ftdi_emu_ssd1306_data(struct ftdi_emu_ssd1306 *oled, uint8_t c)
+{
+	oled->ram[oled->page * 128 + oled->col] = c;
+
+	switch (oled->mode) {
+	case 0:
+		if (oled->col++ < oled->col_end)
+			break;
+		oled->col = oled->col_start;
+		if (oled->page++ >= oled->page_end)
+			oled->page = oled->page_start;
+		break;
+	case 1:
+		if (oled->page++ < oled->page_end)
+			break;
+		oled->page = oled->page_start;
+		if (oled->col++ >= oled->col_end)
+			oled->col = oled->col_start;
+		break;
+	default:
+		oled->col = (oled->col + 1) % 128;
+		break;
+	}
+}
+
+static bool ftdi_emu_ssd1306_start(struct ftdi_emu_i2c *i2c, bool read, uint64_t now_ns)
+{
+	struct ftdi_emu_ssd1306 *oled = (struct ftdi_emu_ssd1306 *)i2c;
+
+	(void)read;
+	(void)now_ns;
+	oled->control = true;
+
+	return true;
+}
+
+static bool ftdi_emu_ssd1306_write(struct ftdi_emu_i2c *i2c, unsigned int idx, uint8_t c,
+				   uint64_t now_ns)
+{
+	struct ftdi_emu_ssd1306 *oled = (struct ftdi_emu_ssd1306 *)i2c;
+
+	(void)idx;
+	(void)now_ns;
+	if (oled->control) {
+		oled->continuation = c & 0x80;
+		oled->data = c & 0x40;
+		oled->control = false;
+		return true;
+	}
+
+	if (oled->data) {
+		ftdi_emu_ssd1306_data(oled, c);
+	} else {
+		oled->cmd[oled->cmd_len++] = c;
+		if (oled->cmd_len > ftdi_emu_ssd1306_args(oled->cmd[0])) {
+			ftdi_emu_ssd1306_cmd(oled);
+			oled->cmd_len = 0;
+		}
+	}
+	oled->control = oled->continuation;
+
+	return true;
+}
+
+/* reads return the status byte: display on (0x00) */
+static uint8_t ftdi_emu_ssd1306_read(struct ftdi_emu_i2c *i2c, uint64_t now_ns)
+{
+	(void)i2c;
+	(void)now_ns;
+
+	return 0x00;
+}
+
+static const struct ftdi_emu_i2c_ops ftdi_emu_ssd1306_ops = {
+	.start = ftdi_emu_ssd1306_start,
+	.write = ftdi_emu_ssd1306_write,
+	.read = ftdi_emu_ssd1306_read,
+	.stop = ftdi_emu_regs_stop,
+};
+
+struct ftdi_emu_device *ftdi_emu_ssd1306_new(uint8_t address)
+{
+	struct ftdi_emu_ssd1306 *oled;
+
+	oled = ftdi_emu_i2c_new(sizeof(*oled), "ssd1306", &ftdi_emu_ssd1306_ops, address);
+	if (!oled)
+		return NULL;
+
+	oled->mode = 2;
+	oled->col_end = 127;
+	oled->page_end = 7;
+
+	return &oled->i2c.dev;
+}
+
+const uint8_t *ftdi_emu_ssd1306_get_ram(const struct ftdi_emu_device *dev)
+{
+	const struct ftdi_emu_i2c *i2c = (const struct ftdi_emu_i2c *)dev;
+
+	if (dev->update != ftdi_emu_i2c_update || i2c->ops != &ftdi_emu_ssd1306_ops)
+		return NULL;
+
+	return ((const struct ftdi_emu_ssd1306 *)i2c)->ram;
+}
@@ -0,0 +1,226 @@
+/*
+ * Licensed under the GPLv2
+ *
+ * SPI NOR flash model for the emulator, mode 0 on the pins of spi.c.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "ftdi_mpsse.h"
+#include "internal.h"
+
+#define PIN_SCLK	BIT(0)
+#define PIN_MOSI	BIT(1)
+#define PIN_MISO	BIT(2)
+#define PIN_CS		BIT(3)
+
+#define NOR_SR_WIP	BIT(0)
+#define NOR_SR_WEL	BIT(1)
+
+/* typical times of a W25Q series part */
+#define NOR_TPP_NS	400000ULL
+#define NOR_TSE_NS	45000000ULL
+#define NOR_TBE32_NS	120000000ULL
+#define NOR_TBE64_NS	150000000ULL
+
+struct ftdi_emu_spinor {
+	struct ftdi_emu_device dev;
+	uint32_t jedec_id;
+	unsigned int size;
+	uint16_t prev;
+	bool selected;
+	unsigned int bit;
+	unsigned int idx;		/* byte of the command, the opcode is 0 */
+	uint8_t in;
+	uint8_t out;
+	bool miso;
+	uint8_t cmd;
+	uint32_t addr;
+	uint8_t status;
+	bool programmed;
+	uint64_t tpp_ns;
+	uint64_t busy_until;
+	uint8_t mem[];
+};
+
+static bool ftdi_emu_spinor_busy(const struct ftdi_emu_spinor *nor, uint64_t now_ns)
+{
+	return now_ns < nor->busy_until;
+}
+
+static void ftdi_emu_spinor_erase(struct ftdi_emu_spinor *nor, uint32_t size, uint64_t busy_ns,
+				  uint64_t now_ns)
+{
+	uint32_t start = nor->addr % nor->size & ~(size - 1);
+
+	memset(nor->mem + start, 0xff, min(size, nor->size - start));
+	nor->busy_until = now_ns + busy_ns;
+}
+
+/* CS went high: commands taking effect at the end */
+static void ftdi_emu_spinor_end(struct ftdi_emu_spinor *nor, uint64_t now_ns)
+{
+	bool wel = nor->status & NOR_SR_WEL;
+
+	if (ftdi_emu_spinor_busy(nor, now_ns) || !nor->idx)
+		return;
+
+	switch (nor->cmd) {
+	case 0x06:
+		nor->status |= NOR_SR_WEL;
+		return;
+	case 0x04:
+		nor->status &= ~NOR_SR_WEL;
+		return;
+	case 0x02:
+		if (nor->programmed)
+			nor->busy_until = now_ns + nor->tpp_ns;
+		break;
+	case 0x20:
+		if (wel && nor->idx == 4)
+			ftdi_emu_spinor_erase(nor, 0x1000, NOR_TSE_NS, now_ns);
+		break;
+	case 0x52:
+		if (wel && nor->idx == 4)
+			ftdi_emu_spinor_erase(nor, 0x8000, NOR_TBE32_NS, now_ns);
+		break;
+	case 0xd8:
+		if (wel && nor->idx == 4)
+			ftdi_emu_spinor_erase(nor, 0x10000, NOR_TBE64_NS, now_ns);
+		break;
+	case 0x60:
+	case 0xc7:
+		if (wel && nor->idx == 1) {
+			memset(nor->mem, 0xff, nor->size);
+			nor->busy_until = now_ns + NOR_TBE64_NS * div_round_up(nor->size, 0x10000);
+		}
+		break;
+	default:
+		return;
+	}
+
+	nor->status &= ~NOR_SR_WEL;
+}
+
+/* A byte was received, return the one to send next */
+static uint8_t ftdi_emu_spinor_byte(struct ftdi_emu_spinor *nor, uint8_t c, uint64_t now_ns)
+{
+	unsigned int idx = nor->idx++;
+
+	if (!idx) {
+		nor->cmd = c;
+		nor->addr = 0;
+		nor->programmed = false;
+	} else if (idx <= 3) {
+		nor->addr = nor->addr << 8 | c;
+	}
+
+	/* only the status can be read while busy */
+	if (ftdi_emu_spinor_busy(nor, now_ns)) {
+		if (nor->cmd == 0x05)
+			return nor->status | NOR_SR_WIP;
+		return 0xff;
+	}
+
+	switch (nor->cmd) {
+	case 0x05:
+		return nor->status;
+	case 0x9f:
+		return idx < 3 ? nor->jedec_id >> (16 - 8 * idx) : 0xff;
+	case 0x03:
+	case 0x0b:
+		/* FAST READ has a dummy byte after the address */
+		if (idx < (nor->cmd == 0x0b ? 4U : 3U))
+			return 0xff;
+		return nor->mem[nor->addr++ % nor->size];
+	case 0x02:
+		if (idx >= 4 && (nor->status & NOR_SR_WEL)) {
+			uint32_t addr = nor->addr % nor->size;
+
+			/* programming only clears bits, and wraps within the page */
+			nor->mem[addr] &= c;
+			nor->addr = (addr & ~0xffU) | ((addr + 1) & 0xff);
+			nor->programmed = true;
+		}
+		return 0xff;
+	default:
+		return 0xff;
+	}
+}
+
+static uint16_t ftdi_emu_spinor_update(struct ftdi_emu_device *dev, uint16_t lines,
+				       uint64_t now_ns)
+{
+	struct ftdi_emu_spinor *nor = (struct ftdi_emu_spinor *)dev;
+	uint16_t prev = nor->prev;
+
+	nor->prev = lines;
+
+	if (!(lines & PIN_CS) && (prev & PIN_CS)) {
+		nor->selected = true;
+		nor->bit = 0;
+		nor->idx = 0;
+		nor->out = 0xff;
+		nor->miso = true;
+	} else if ((lines & PIN_CS) && !(prev & PIN_CS)) {
+		nor->selected = false;
+		ftdi_emu_spinor_end(nor, now_ns);
+	}
+
+	if (!nor->selected)
+		return 0;
+
+	if ((lines & PIN_SCLK) && !(prev & PIN_SCLK)) {
+		nor->in = nor->in << 1 | !!(lines & PIN_MOSI);
+		if (++nor->bit == 8) {
+			nor->out = ftdi_emu_spinor_byte(nor, nor->in, now_ns);
+			nor->bit = 0;
+		}
+	} else if (!(lines & PIN_SCLK) && (prev & PIN_SCLK)) {
+		/* MISO changes on the falling edge, sampled by the host on the rising one */
+		nor->miso = nor->out & (0x80 >> nor->bit);
+	}
+
+	return nor->miso ? 0 : PIN_MISO;
+}
+
+struct ftdi_emu_device *ftdi_emu_spinor_new(uint32_t jedec_id, unsigned int size)
+{
+	struct ftdi_emu_spinor *nor;
+
+	if (!size || size > 1U << 24 || size & (size - 1))
+		return NULL;
+
+	nor = calloc(1, sizeof(*nor) + size);
+	if (!nor)
+		return NULL;
+
+	nor->dev.name = "spi-nor";
+	nor->dev.update = ftdi_emu_spinor_update;
+	nor->jedec_id = jedec_id;
+	nor->size = size;
+	nor->prev = PIN_CS;
+	nor->miso = true;
+	nor->tpp_ns = NOR_TPP_NS;
+	memset(nor->mem, 0xff, size);
+
+	return &nor->dev;
+}
+
+uint8_t *ftdi_emu_spinor_get_memory(struct ftdi_emu_device *dev)
+{
+	if (dev->update != ftdi_emu_spinor_update)
+		return NULL;
+
+	return ((struct ftdi_emu_spinor *)dev)->mem;
+}
+
+int ftdi_emu_spinor_set_tpp(struct ftdi_emu_device *dev, unsigned int tpp_ns)
+{
+	if (dev->update != ftdi_emu_spinor_update)
+		return -1;
+
+	((struct ftdi_emu_spinor *)dev)->tpp_ns = tpp_ns;
+
+	return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Licensed under the GPLv2
+ *
+ * GPIOL/GPIOH next to the I2C/SPI engine. The low byte is written together
+ * with the last state of the bus pins, so both can be mixed in one stream.
+ */
+#include "ftdi_mpsse.h"
+#include "internal.h"
+#include "mpsse_reg.h"
+
+#define GPIO_LOW		0x00f0
+#define GPIO_HIGH		0xff00
+
+static int ftdi_gpio_check(struct ftdi_mpsse *ftdi_mpsse, const char *func, uint16_t mask,
+			   uint16_t dir)
+{
+	uint16_t bad = mask & ~ftdi_mpsse->caps->gpio_pins;
+
+	if (bad)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "%s: %s has no pins 0x%04x",
+					      func, ftdi_mpsse->caps->name, bad);
+
+	bad = mask & dir & ftdi_mpsse->gpio_in;
+	if (bad)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "%s: pins 0x%04x must stay inputs", func, bad);
+
+	return 0;
+}
+
+static void ftdi_gpio_enqueue(struct ftdi_mpsse *ftdi_mpsse, uint16_t mask)
+{
+	if (mask & GPIO_LOW)
+		ftdi_mpsse_set_pins(ftdi_mpsse, ftdi_mpsse->bus_bits, ftdi_mpsse->bus_output);
+
+	if (mask & GPIO_HIGH) {
+		ftdi_mpsse_enqueue(ftdi_mpsse, CMD_SET_BITS_HIGH);
+		ftdi_mpsse_enqueue(ftdi_mpsse, ftdi_mpsse->gpio >> 8);
+		ftdi_mpsse_enqueue(ftdi_mpsse, ftdi_mpsse->gpio_dir >> 8);
+	}
+}
+
+static void ftdi_gpio_update(struct ftdi_mpsse *ftdi_mpsse, uint16_t mask, uint16_t val,
+			     uint16_t dir)
+{
+	ftdi_mpsse->gpio = (ftdi_mpsse->gpio & ~mask) | (val & mask);
+	ftdi_mpsse->gpio_dir = (ftdi_mpsse->gpio_dir & ~mask) | (dir & mask);
+}
+
+static int ftdi_gpio_flush(struct ftdi_mpsse *ftdi_mpsse)
+{
+	int ret;
+
+	ret = ftdi_mpsse_flush(ftdi_mpsse);
+	if (ret < 0) {
+		ftdi_mpsse_drop_replies(ftdi_mpsse);
+		return ret;
+	}
+
+	return 0;
+}
+
+int ftdi_gpio_set(struct ftdi_mpsse *ftdi_mpsse, uint16_t mask, uint16_t val)
+{
+	int ret;
+
+	ret = ftdi_gpio_check(ftdi_mpsse, __func__, mask, 0);
+	if (ret < 0)
+		return ret;
+
+	ftdi_gpio_update(ftdi_mpsse, mask, val, ftdi_mpsse->gpio_dir);
+	ftdi_gpio_enqueue(ftdi_mpsse, mask);
+
+	return ftdi_gpio_flush(ftdi_mpsse);
+}
+
+int ftdi_gpio_set_dir(struct ftdi_mpsse *ftdi_mpsse, uint16_t mask, uint16_t dir)
+{
+	int ret;
+
+	ret = ftdi_gpio_check(ftdi_mpsse, __func__, mask, dir);
+	if (ret < 0)
+		return ret;
+
+	ftdi_gpio_update(ftdi_mpsse, mask, ftdi_mpsse->gpio, dir);
+	ftdi_gpio_enqueue(ftdi_mpsse, mask);
+
+	return ftdi_gpio_flush(ftdi_mpsse);
+}
+
+int ftdi_gpio_get(struct ftdi_mpsse *ftdi_mpsse, uint16_t *val)
+{
+	uint8_t low, high = 0;
+	int ret;
+
+	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_GET_BITS_LOW);
+	ftdi_mpsse_reply_gpio(ftdi_mpsse, &low);
+	if (ftdi_mpsse->caps->gpio_pins & GPIO_HIGH) {
+		ftdi_mpsse_enqueue(ftdi_mpsse, CMD_GET_BITS_HIGH);
+		ftdi_mpsse_reply_gpio(ftdi_mpsse, &high);
+	}
+	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_SEND_IMMEDIATE);
+
+	ret = ftdi_gpio_flush(ftdi_mpsse);
+	if (ret < 0)
+		return ret;
+
+	ret = ftdi_mpsse_collect(ftdi_mpsse);
+	if (ret < 0)
+		return ret;
+
+	*val = low | high << 8;
+
+	return 0;
+}
+
+/*
+ * Each step is one write of the bytes covered by mask, plus hold repeats of
+ * the last one. Nothing is read back, so the waveform costs no round trip.
+ */
+int ftdi_gpio_waveform(struct ftdi_mpsse *ftdi_mpsse, uint16_t mask,
+		       const struct ftdi_gpio_step *steps, size_t count)
+{
+	uint16_t last = mask & GPIO_HIGH ? GPIO_HIGH : GPIO_LOW;
+	int ret;
+
+	for (size_t i = 0; i < count; i++) {
+		ret = ftdi_gpio_check(ftdi_mpsse, __func__, mask, steps[i].dir);
+		if (ret < 0)
+			return ret;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		ftdi_gpio_update(ftdi_mpsse, mask, steps[i].val, steps[i].dir);
+		ftdi_gpio_enqueue(ftdi_mpsse, mask);
+		for (unsigned int a = 0; a < steps[i].hold; a++)
+			ftdi_gpio_enqueue(ftdi_mpsse, last);
+	}
+
+	return ftdi_gpio_flush(ftdi_mpsse);
+}
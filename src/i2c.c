@@ -13,6 +13,121 @@
 
 #define PIN_SCL		BIT(0)
 #define PIN_SDA		BIT(1)
+#define PIN_WAIT	BIT(5)		/* GPIOL1, read by CMD_WAIT_ON_IO_HIGH */
+#define PIN_RTCK	BIT(7)		/* GPIOL3 */
+
+/* direction changes are tracked so that the redundant ones can be skipped */
+static void ftdi_i2c_set_pins(struct ftdi_mpsse *ftdi_mpsse, uint8_t bits, uint8_t output)
+{
+	ftdi_mpsse->i2c.sda_out = output & PIN_SDA;
+	ftdi_mpsse_set_pins(ftdi_mpsse, bits, output);
+}
+
+/*
+ * A SET_BITS_LOW command lasts at least this long, whatever the bus clock. It
+ * is the calibration of the fixed counts used before (10 commands for >= 600
+ * ns) and errs towards more writes: a slower command only holds longer.
+ */
+#define SET_PINS_NS	60
+
+/* minimal bus timing per I2C mode, in ns */
+static const struct ftdi_i2c_mode_timing {
+	unsigned int max_speed;
+	unsigned int su_sta, hd_sta, low, su_sto, buf;
+} ftdi_i2c_mode_timings[] = {
+	{ FTDI_I2C_SPD_STD,	4700, 4000, 4700, 4000, 4700 },
+	{ FTDI_I2C_SPD_FAST,	 600,  600, 1300,  600, 1300 },
+	{ FTDI_I2C_SPD_FASTP,	 260,  260,  500,  260,  500 },
+	/* Hs-mode, Cb = 100 pF */
+	{ ~0U,			 160,  160,  160,  160,  160 },
+};
+
+static const struct ftdi_i2c_mode_timing *ftdi_i2c_mode_timing(unsigned int speed)
+{
+	unsigned int a;
+
+	for (a = 0; a < ARRAY_SIZE(ftdi_i2c_mode_timings) - 1; a++)
+		if (speed <= ftdi_i2c_mode_timings[a].max_speed)
+			break;
+
+	return &ftdi_i2c_mode_timings[a];
+}
+
+static unsigned int ftdi_i2c_ns_to_cycles(unsigned int ns)
+{
+	return max(div_round_up(ns, SET_PINS_NS), 1U);
+}
+
+static void ftdi_i2c_compute_timing(struct ftdi_mpsse *ftdi_mpsse)
+{
+	const struct ftdi_i2c_mode_timing *t = ftdi_i2c_mode_timing(ftdi_mpsse->speed);
+
+	ftdi_mpsse->i2c.cycles.su_sta = ftdi_i2c_ns_to_cycles(t->su_sta);
+	ftdi_mpsse->i2c.cycles.hd_sta = ftdi_i2c_ns_to_cycles(t->hd_sta);
+	ftdi_mpsse->i2c.cycles.low = ftdi_i2c_ns_to_cycles(t->low);
+	ftdi_mpsse->i2c.cycles.su_sto = ftdi_i2c_ns_to_cycles(t->su_sto);
+	ftdi_mpsse->i2c.cycles.buf = ftdi_i2c_ns_to_cycles(t->buf);
+
+	if (ftdi_mpsse->debug & MPSSE_DEBUG_CLOCK)
+		fprintf(stderr, "%s: speed=%u start=%u+%u stop=%u+%u+%u cycles\n", __func__,
+			ftdi_mpsse->speed, ftdi_mpsse->i2c.cycles.su_sta,
+			ftdi_mpsse->i2c.cycles.hd_sta, ftdi_mpsse->i2c.cycles.low,
+			ftdi_mpsse->i2c.cycles.su_sto, ftdi_mpsse->i2c.cycles.buf);
+}
+
+void ftdi_i2c_get_timing(const struct ftdi_mpsse *ftdi_mpsse, struct ftdi_i2c_timing *timing)
+{
+	const struct ftdi_i2c_mode_timing *t = ftdi_i2c_mode_timing(ftdi_mpsse->speed);
+
+	timing->su_sta_ns = t->su_sta;
+	timing->hd_sta_ns = t->hd_sta;
+	timing->low_ns = t->low;
+	timing->su_sto_ns = t->su_sto;
+	timing->buf_ns = t->buf;
+	timing->set_pins_ns = SET_PINS_NS;
+
+	timing->su_sta_cycles = ftdi_mpsse->i2c.cycles.su_sta;
+	timing->hd_sta_cycles = ftdi_mpsse->i2c.cycles.hd_sta;
+	timing->low_cycles = ftdi_mpsse->i2c.cycles.low;
+	timing->su_sto_cycles = ftdi_mpsse->i2c.cycles.su_sto;
+	timing->buf_cycles = ftdi_mpsse->i2c.cycles.buf;
+}
+
+/*
+ * With clock stretching, SCL is also read on GPIOL1 and GPIOL3. If they float,
+ * adaptive clocking and the waits would hang: SCL pulled low must show there.
+ */
+static int ftdi_i2c_check_scl_wiring(struct ftdi_mpsse *ftdi_mpsse)
+{
+	const uint8_t wires = PIN_WAIT | PIN_RTCK;
+	uint8_t high, low;
+	int ret;
+
+	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_GET_BITS_LOW);
+	ftdi_mpsse_reply_gpio(ftdi_mpsse, &high);
+	ftdi_i2c_set_pins(ftdi_mpsse, PIN_SDA, PIN_SCL | PIN_SDA);
+	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_GET_BITS_LOW);
+	ftdi_mpsse_reply_gpio(ftdi_mpsse, &low);
+	ftdi_i2c_set_pins(ftdi_mpsse, PIN_SCL | PIN_SDA, PIN_SCL | PIN_SDA);
+	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_SEND_IMMEDIATE);
+
+	ret = ftdi_mpsse_flush(ftdi_mpsse);
+	if (ret < 0) {
+		ftdi_mpsse_drop_replies(ftdi_mpsse);
+		return ret;
+	}
+
+	ret = ftdi_mpsse_collect(ftdi_mpsse);
+	if (ret < 0)
+		return ret;
+
+	if ((high & wires) != wires || (low & wires))
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "clock stretching: SCL not wired to GPIOL1 and GPIOL3 "
+					      "(high 0x%02x, low 0x%02x)", high, low);
+
+	return 0;
+}
 
 int ftdi_i2c_init(struct ftdi_mpsse *ftdi_mpsse,
 		  const struct ftdi_mpsse_config *conf)
@@ -29,23 +144,39 @@ int ftdi_i2c_init(struct ftdi_mpsse *ftdi_mpsse,
 		return ret;
 
 	ftdi_mpsse->i2c.loops_after_read_ack = conf->loops_after_read_ack;
+	ftdi_mpsse->i2c.open_drain = (conf->i2c_open_drain || conf->i2c_clock_stretch) &&
+				     ftdi_mpsse->caps->drive_zero;
+	if (conf->i2c_open_drain && !ftdi_mpsse->i2c.open_drain &&
+	    (ftdi_mpsse->debug & MPSSE_VERBOSE))
+		fprintf(stderr, "%s: %s has no open-drain outputs, ignoring\n", __func__,
+			ftdi_mpsse->caps->name);
+	/* a stretching slave would fight a push-pull SCL */
+	ftdi_mpsse->i2c.clock_stretch = conf->i2c_clock_stretch;
+	if (conf->i2c_clock_stretch && !(ftdi_mpsse->i2c.open_drain && ftdi_mpsse->caps->h_series)) {
+		ret = ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					     "%s cannot follow clock stretching (FT232H only)",
+					     ftdi_mpsse->caps->name);
+		goto close;
+	}
+	/* the lines following SCL must not be driven */
+	ftdi_mpsse->gpio_in = ftdi_mpsse->i2c.clock_stretch ? PIN_WAIT | PIN_RTCK : 0;
 
-	usleep(50000);
+	if (!ftdi_mpsse->warm)
+		usleep(50000);
 
-	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_CLK_DIV5_DIS);
-	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_CLK_ADAPTIVE_DIS);
-	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_CLK_3PHASE_EN);
+	if (ftdi_mpsse->caps->h_series)
+		ftdi_mpsse_enqueue(ftdi_mpsse, ftdi_mpsse->i2c.clock_stretch ?
+				   CMD_CLK_ADAPTIVE_EN : CMD_CLK_ADAPTIVE_DIS);
 	/*
 	 * this is recommended for i2c in the datasheet but breaks bme and oled
-	 * (high speed transfers likely)
+	 * (high speed transfers likely), so it is opt-in. It is always written
+	 * since a warm chip keeps the setting of its previous user.
 	 */
-#if 0
-	if (ftdi_mpsse->ftdic.type == TYPE_232H) {
+	if (ftdi_mpsse->caps->drive_zero) {
 		ftdi_mpsse_enqueue(ftdi_mpsse, CMD_DRIVE_ONLY_ZERO);
-		ftdi_mpsse_enqueue(ftdi_mpsse, 0x03);
+		ftdi_mpsse_enqueue(ftdi_mpsse, ftdi_mpsse->i2c.open_drain ? PIN_SCL | PIN_SDA : 0x00);
 		ftdi_mpsse_enqueue(ftdi_mpsse, 0x00);
 	}
-#endif
 
 	ret = ftdi_mpsse_flush(ftdi_mpsse);
 	if (ret < 0)
@@ -53,7 +184,11 @@ int ftdi_i2c_init(struct ftdi_mpsse *ftdi_mpsse,
 
 	ftdi_mpsse_set_pins(ftdi_mpsse, PIN_SCL | PIN_SDA, PIN_SCL | PIN_SDA);
 
-	ftdi_mpsse_set_speed(ftdi_mpsse, conf->speed, true);
+	ret = ftdi_mpsse_set_speed(ftdi_mpsse, conf->speed, conf->clock_mode, true);
+	if (ret < 0)
+		goto close;
+	/* the hold times follow the clock actually achieved */
+	ftdi_i2c_compute_timing(ftdi_mpsse);
 
 	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_LOOPBACK_DIS);
 
@@ -61,6 +196,15 @@ int ftdi_i2c_init(struct ftdi_mpsse *ftdi_mpsse,
 	if (ret < 0)
 		goto close;
 
+	if (ftdi_mpsse->i2c.clock_stretch) {
+		ret = ftdi_i2c_check_scl_wiring(ftdi_mpsse);
+		if (ret < 0)
+			goto close;
+	}
+
+	ftdi_i2c_reset_wire_stats(ftdi_mpsse);
+	ftdi_mpsse_init_done(ftdi_mpsse);
+
 	return 0;
 
 close:
@@ -68,39 +212,52 @@ close:
 	return ret;
 }
 
-#define FIRST_CYCLES	10
-#define SECOND_CYCLES	20
-#define STOP_CYCLES	10
+/*
+ * A slave may still stretch SCL after the last ACK, and pin writes do not wait
+ * for RTCK: release SCL, then wait until GPIOL1 sees it high.
+ */
+static void ftdi_i2c_enqueue_release_scl(struct ftdi_mpsse *ftdi_mpsse, uint8_t sda)
+{
+	if (!ftdi_mpsse->i2c.clock_stretch)
+		return;
+
+	ftdi_i2c_set_pins(ftdi_mpsse, PIN_SCL | sda, PIN_SCL | PIN_SDA);
+	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_WAIT_ON_IO_HIGH);
+}
 
 static void ftdi_i2c_enqueue_start(struct ftdi_mpsse *ftdi_mpsse)
 {
 	unsigned int a;
 
-	/* repeat to last for >= 600ns */
-	for (a = 0; a < FIRST_CYCLES; a++)
-		ftdi_mpsse_set_pins(ftdi_mpsse, PIN_SCL | PIN_SDA, PIN_SCL | PIN_SDA);
+	ftdi_i2c_enqueue_release_scl(ftdi_mpsse, PIN_SDA);
+
+	/* tBUF after a STOP is held by the STOP itself */
+	for (a = 0; a < ftdi_mpsse->i2c.cycles.su_sta; a++)
+		ftdi_i2c_set_pins(ftdi_mpsse, PIN_SCL | PIN_SDA, PIN_SCL | PIN_SDA);
 
-	for (a = 0; a < SECOND_CYCLES; a++)
-		ftdi_mpsse_set_pins(ftdi_mpsse, PIN_SCL, PIN_SCL | PIN_SDA);
+	for (a = 0; a < ftdi_mpsse->i2c.cycles.hd_sta; a++)
+		ftdi_i2c_set_pins(ftdi_mpsse, PIN_SCL, PIN_SCL | PIN_SDA);
 
-	ftdi_mpsse_set_pins(ftdi_mpsse, 0, PIN_SCL | PIN_SDA);
+	ftdi_i2c_set_pins(ftdi_mpsse, 0, PIN_SCL | PIN_SDA);
 }
 
 static void ftdi_i2c_enqueue_stop(struct ftdi_mpsse *ftdi_mpsse)
 {
 	unsigned int a;
 
-	for (a = 0; a < STOP_CYCLES; a++)
-		ftdi_mpsse_set_pins(ftdi_mpsse, 0, PIN_SCL | PIN_SDA);
+	for (a = 0; a < ftdi_mpsse->i2c.cycles.low; a++)
+		ftdi_i2c_set_pins(ftdi_mpsse, 0, PIN_SCL | PIN_SDA);
 
-	for (a = 0; a < STOP_CYCLES; a++)
-		ftdi_mpsse_set_pins(ftdi_mpsse, PIN_SCL, PIN_SCL | PIN_SDA);
+	ftdi_i2c_enqueue_release_scl(ftdi_mpsse, 0);
 
-	for (a = 0; a < STOP_CYCLES; a++)
-		ftdi_mpsse_set_pins(ftdi_mpsse, PIN_SCL | PIN_SDA, PIN_SCL | PIN_SDA);
+	for (a = 0; a < ftdi_mpsse->i2c.cycles.su_sto; a++)
+		ftdi_i2c_set_pins(ftdi_mpsse, PIN_SCL, PIN_SCL | PIN_SDA);
+
+	for (a = 0; a < ftdi_mpsse->i2c.cycles.buf; a++)
+		ftdi_i2c_set_pins(ftdi_mpsse, PIN_SCL | PIN_SDA, PIN_SCL | PIN_SDA);
 
 	/* set to input mode so they are in tristate (high impedance) */
-	ftdi_mpsse_set_pins(ftdi_mpsse, 0, 0);
+	ftdi_i2c_set_pins(ftdi_mpsse, 0, 0);
 }
 
 int ftdi_i2c_begin(struct ftdi_mpsse *ftdi_mpsse, uint8_t address, bool write)
@@ -116,82 +273,110 @@ int ftdi_i2c_begin(struct ftdi_mpsse *ftdi_mpsse, uint8_t address, bool write)
 	return ftdi_i2c_send_check_ack(ftdi_mpsse, address << 1 | !write);
 }
 
-static int ftdi_i2c_check_ack(struct ftdi_mpsse *ftdi_mpsse, bool check_all)
+/* Send the queued commands and read all the pending replies */
+static int ftdi_i2c_sync(struct ftdi_mpsse *ftdi_mpsse)
 {
-	unsigned int acks = ftdi_mpsse->i2c.acks;
-	uint8_t ibuf[acks + 16];
 	int ret;
 
-	ret = ftdi_mpsse_read_dev(ftdi_mpsse, ibuf, sizeof(ibuf), acks, check_all);
-	if (ret <= 0)
+	if (ftdi_mpsse->replies_cnt)
+		ftdi_mpsse_enqueue(ftdi_mpsse, CMD_SEND_IMMEDIATE);
+
+	ret = ftdi_mpsse_flush(ftdi_mpsse);
+	if (ret < 0) {
+		ftdi_mpsse_drop_replies(ftdi_mpsse);
+		ftdi_mpsse_reset_acks(ftdi_mpsse);
 		return ret;
+	}
 
-	ftdi_mpsse->i2c.acks -= ret;
+	ret = ftdi_mpsse_collect(ftdi_mpsse);
+	if (ret < 0)
+		ftdi_mpsse_reset_acks(ftdi_mpsse);
 
-	for (int a = 0; a < ret; a++) {
-		if (ibuf[a] & BIT(0)) {
-			return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
-						      "i2c-%x: received NACK at offset %u",
-						      ftdi_mpsse->i2c.address, a);
-		}
-	}
+	return ret;
+}
+
+/* Report the first NACK collected since the last call */
+static int ftdi_i2c_check_nack(struct ftdi_mpsse *ftdi_mpsse, int *nack_idx)
+{
+	int nack = ftdi_mpsse->first_nack;
+
+	ftdi_mpsse_reset_acks(ftdi_mpsse);
+	if (nack_idx)
+		*nack_idx = nack;
+
+	if (nack >= 0)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "i2c-%x: received NACK at offset %d",
+					      ftdi_mpsse->i2c.address, nack);
 
 	return 0;
 }
 
-static int ftdi_i2c_check_rx(struct ftdi_mpsse *ftdi_mpsse, uint8_t *ibuf, size_t size,
-			     bool check_all)
+/* Synchronous mode checks ACKs on every sync, posted mode only at commit */
+static int ftdi_i2c_sync_check(struct ftdi_mpsse *ftdi_mpsse)
 {
-	unsigned int bytes = ftdi_mpsse->i2c.bytes;
 	int ret;
 
-	ret = ftdi_mpsse_read_dev(ftdi_mpsse, ibuf, size, bytes, check_all);
-	if (ret <= 0)
+	ret = ftdi_i2c_sync(ftdi_mpsse);
+	if (ret < 0 || ftdi_mpsse->i2c.posted)
 		return ret;
 
-	ftdi_mpsse->i2c.bytes -= ret;
-
-	return ret;
+	return ftdi_i2c_check_nack(ftdi_mpsse, NULL);
 }
 
-static int ftdi_i2c_check_bufs(struct ftdi_mpsse *ftdi_mpsse, uint8_t *ibuf, size_t size)
+static int ftdi_i2c_check_bufs(struct ftdi_mpsse *ftdi_mpsse)
 {
-	if (ftdi_mpsse->i2c.acks + ftdi_mpsse->i2c.bytes < 3 * MPSSE_RX_BUFSIZE / 4 &&
-	    ftdi_mpsse->obuf_cnt < 3 * MPSSE_TX_BUFSIZE / 4)
+	const struct ftdi_mpsse_caps *caps = ftdi_mpsse->caps;
+
+	if (ftdi_mpsse->reply_bytes < 3 * caps->rx_bufsize / 4 &&
+	    ftdi_mpsse->obuf_cnt < 3 * caps->tx_bufsize / 4)
 		return 0;
 
-	if (ftdi_mpsse->debug & MPSSE_DEBUG_FLUSHING)
-		fprintf(stderr, "%s: flushing acks=%u bytes=%u obuf_cnt=%u\n", __func__,
-			ftdi_mpsse->i2c.acks, ftdi_mpsse->i2c.bytes, ftdi_mpsse->obuf_cnt);
+	ftdi_mpsse->stats.forced_flushes++;
 
-	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_SEND_IMMEDIATE);
-	int ret = ftdi_mpsse_flush(ftdi_mpsse);
-	if (ret < 0)
-		return ret;
-
-	ret = ftdi_i2c_check_ack(ftdi_mpsse, false);
-	if (ret < 0)
-		return ret;
+	if (ftdi_mpsse->debug & MPSSE_DEBUG_FLUSHING)
+		fprintf(stderr, "%s: flushing replies=%u bytes=%u obuf_cnt=%u\n", __func__,
+			ftdi_mpsse->replies_cnt, ftdi_mpsse->reply_bytes, ftdi_mpsse->obuf_cnt);
 
-	return ftdi_i2c_check_rx(ftdi_mpsse, ibuf, size, false);
+	return ftdi_i2c_sync_check(ftdi_mpsse);
 }
 
-int ftdi_i2c_enqueue_writebyte(struct ftdi_mpsse *ftdi_mpsse, uint8_t c)
+/*
+ * Push-pull outputs need SDA to be turned around for every ACK. With the
+ * open-drain outputs of FT232H, SDA stays an output: driving 1 releases the
+ * line, so data and ACK phases are plain clock commands (6 bytes per byte).
+ */
+static void __ftdi_i2c_enqueue_writebyte(struct ftdi_mpsse *ftdi_mpsse, uint8_t c)
 {
-	ftdi_mpsse_set_pins(ftdi_mpsse, PIN_SDA, PIN_SCL | PIN_SDA);
+	if (!ftdi_mpsse->i2c.open_drain && !ftdi_mpsse->i2c.sda_out)
+		ftdi_i2c_set_pins(ftdi_mpsse, PIN_SDA, PIN_SCL | PIN_SDA);
 
 	ftdi_mpsse_enqueue(ftdi_mpsse, CMD(CMD_OUT_FALLING, CMD_BIT, CMD_MSB, CMD_OUT));
 	ftdi_mpsse_enqueue(ftdi_mpsse, 0x07);
 	ftdi_mpsse_enqueue(ftdi_mpsse, c);
 
-	ftdi_mpsse_set_pins(ftdi_mpsse, 0, PIN_SCL);
+	if (ftdi_mpsse->i2c.open_drain) {
+		ftdi_mpsse_enqueue(ftdi_mpsse, CMD(CMD_OUT_FALLING | CMD_IN_RISING, CMD_BIT,
+						   CMD_MSB, CMD_OUT | CMD_IN));
+		/* len = 0 means 1 bit */
+		ftdi_mpsse_enqueue(ftdi_mpsse, 0x00);
+		ftdi_mpsse_enqueue(ftdi_mpsse, 0x80);
+	} else {
+		ftdi_i2c_set_pins(ftdi_mpsse, 0, PIN_SCL);
 
-	ftdi_mpsse_enqueue(ftdi_mpsse, CMD(CMD_IN_RISING, CMD_BIT, CMD_MSB, CMD_IN));
-	/* len = 0 means 1 bit */
-	ftdi_mpsse_enqueue(ftdi_mpsse, 0x00);
-	ftdi_mpsse->i2c.acks++;
+		ftdi_mpsse_enqueue(ftdi_mpsse, CMD(CMD_IN_RISING, CMD_BIT, CMD_MSB, CMD_IN));
+		/* len = 0 means 1 bit */
+		ftdi_mpsse_enqueue(ftdi_mpsse, 0x00);
+	}
+	ftdi_mpsse_reply_ack(ftdi_mpsse);
+	ftdi_mpsse->i2c.wire_i2c_bytes++;
+}
+
+int ftdi_i2c_enqueue_writebyte(struct ftdi_mpsse *ftdi_mpsse, uint8_t c)
+{
+	__ftdi_i2c_enqueue_writebyte(ftdi_mpsse, c);
 
-	return ftdi_i2c_check_bufs(ftdi_mpsse, NULL, 0);
+	return ftdi_i2c_check_bufs(ftdi_mpsse);
 }
 
 int ftdi_i2c_send_check_ack(struct ftdi_mpsse *ftdi_mpsse, uint8_t c)
@@ -199,87 +384,187 @@ int ftdi_i2c_send_check_ack(struct ftdi_mpsse *ftdi_mpsse, uint8_t c)
 	int ret;
 
 	ret = ftdi_i2c_enqueue_writebyte(ftdi_mpsse, c);
-	if (ret < 0)
-		return ret;
-
-	//ftdi_mpsse_enqueue(ftdi_mpsse, CMD_SEND_IMMEDIATE);
-
-	ret = ftdi_mpsse_flush(ftdi_mpsse);
-	if (ret < 0)
+	if (ret < 0 || ftdi_mpsse->i2c.posted)
 		return ret;
 
-	return ftdi_i2c_check_ack(ftdi_mpsse, true);
+	return ftdi_i2c_sync_check(ftdi_mpsse);
 }
 
-static void ftdi_i2c_enqueue_readbyte(struct ftdi_mpsse *ftdi_mpsse)
+static void ftdi_i2c_enqueue_readbyte(struct ftdi_mpsse *ftdi_mpsse, uint8_t *c)
 {
-	ftdi_mpsse_set_pins(ftdi_mpsse, 0, PIN_SCL);
-
-	ftdi_mpsse_enqueue(ftdi_mpsse, CMD(CMD_IN_RISING, CMD_BIT, CMD_MSB, CMD_IN));
-	ftdi_mpsse_enqueue(ftdi_mpsse, 0x07);
-	ftdi_mpsse->i2c.bytes++;
+	if (ftdi_mpsse->i2c.open_drain) {
+		ftdi_mpsse_enqueue(ftdi_mpsse, CMD(CMD_OUT_FALLING | CMD_IN_RISING, CMD_BIT,
+						   CMD_MSB, CMD_OUT | CMD_IN));
+		ftdi_mpsse_enqueue(ftdi_mpsse, 0x07);
+		ftdi_mpsse_enqueue(ftdi_mpsse, 0xff);
+	} else {
+		if (ftdi_mpsse->i2c.sda_out)
+			ftdi_i2c_set_pins(ftdi_mpsse, 0, PIN_SCL);
+
+		ftdi_mpsse_enqueue(ftdi_mpsse, CMD(CMD_IN_RISING, CMD_BIT, CMD_MSB, CMD_IN));
+		ftdi_mpsse_enqueue(ftdi_mpsse, 0x07);
+	}
+	ftdi_mpsse_reply_data(ftdi_mpsse, c, 1);
+	ftdi_mpsse->i2c.wire_i2c_bytes++;
 }
 
 static void ftdi_i2c_enqueue_ack(struct ftdi_mpsse *ftdi_mpsse, bool ack)
 {
-	ftdi_mpsse_set_pins(ftdi_mpsse, 0, PIN_SCL | PIN_SDA);
+	if (!ftdi_mpsse->i2c.open_drain)
+		ftdi_i2c_set_pins(ftdi_mpsse, 0, PIN_SCL | PIN_SDA);
 
 	ftdi_mpsse_enqueue(ftdi_mpsse, CMD(CMD_OUT_FALLING, CMD_BIT, CMD_MSB, CMD_OUT));
 	ftdi_mpsse_enqueue(ftdi_mpsse, 0x00);
 	ftdi_mpsse_enqueue(ftdi_mpsse, ack ? 0x00 : 0x80);
 }
 
+static void ftdi_i2c_enqueue_recv(struct ftdi_mpsse *ftdi_mpsse, uint8_t *c, bool nack)
+{
+	ftdi_i2c_enqueue_readbyte(ftdi_mpsse, c);
+	ftdi_i2c_enqueue_ack(ftdi_mpsse, !nack);
+
+	/* wait a bit, some implementations are slow to catch up after an ACK */
+	for (unsigned int a = 0; a < ftdi_mpsse->i2c.loops_after_read_ack; a++) {
+		ftdi_i2c_set_pins(ftdi_mpsse, PIN_SDA, PIN_SCL | PIN_SDA);
+		ftdi_i2c_set_pins(ftdi_mpsse, 0, PIN_SCL | PIN_SDA);
+	}
+}
+
 int ftdi_i2c_recv_send_ack(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf,
 			   size_t count, bool last_nack)
 {
-	unsigned int rd = 0;
 	int ret;
 
 	for (size_t i = 0; i < count; i++) {
-		ftdi_i2c_enqueue_readbyte(ftdi_mpsse);
+		ftdi_i2c_enqueue_recv(ftdi_mpsse, buf + i, last_nack && i == count - 1);
 
-		bool nack = last_nack && i == count - 1;
-		ftdi_i2c_enqueue_ack(ftdi_mpsse, !nack);
-
-		/* wait a bit, some implementations are slow to catch up after an ACK */
-		for (unsigned int a = 0; a < ftdi_mpsse->i2c.loops_after_read_ack; a++) {
-			ftdi_mpsse_set_pins(ftdi_mpsse, PIN_SDA, PIN_SCL | PIN_SDA);
-			ftdi_mpsse_set_pins(ftdi_mpsse, 0, PIN_SCL | PIN_SDA);
-		}
-
-		ret = ftdi_i2c_check_bufs(ftdi_mpsse, buf + rd, count - rd);
+		ret = ftdi_i2c_check_bufs(ftdi_mpsse);
 		if (ret < 0)
 			return ret;
-		rd += ret;
 	}
 
-	if (rd == count)
-		return rd;
-
-	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_SEND_IMMEDIATE);
-
-	ret = ftdi_mpsse_flush(ftdi_mpsse);
+	ret = ftdi_i2c_sync_check(ftdi_mpsse);
 	if (ret < 0)
 		return ret;
 
-	return ftdi_i2c_check_rx(ftdi_mpsse, buf + rd, count - rd, true);
+	return count;
 }
 
 int ftdi_i2c_end(struct ftdi_mpsse *ftdi_mpsse)
+{
+	ftdi_i2c_enqueue_stop(ftdi_mpsse);
+
+	return ftdi_i2c_commit(ftdi_mpsse, NULL);
+}
+
+void ftdi_i2c_set_posted(struct ftdi_mpsse *ftdi_mpsse, bool posted)
+{
+	ftdi_mpsse->i2c.posted = posted;
+}
+
+int ftdi_i2c_commit(struct ftdi_mpsse *ftdi_mpsse, int *nack_idx)
 {
 	int ret;
 
-	ftdi_i2c_enqueue_stop(ftdi_mpsse);
+	if (nack_idx)
+		*nack_idx = -1;
 
-	ret = ftdi_mpsse_flush(ftdi_mpsse);
+	ret = ftdi_i2c_sync(ftdi_mpsse);
 	if (ret < 0)
 		return ret;
 
-	ret = ftdi_i2c_check_ack(ftdi_mpsse, true);
+	return ftdi_i2c_check_nack(ftdi_mpsse, nack_idx);
+}
+
+/* Find the message and its byte to which a NACK index belongs */
+static int ftdi_i2c_nack_error(struct ftdi_mpsse *ftdi_mpsse, const struct ftdi_i2c_msg *msgs,
+			       unsigned int num, unsigned int nack)
+{
+	for (unsigned int i = 0; i < num; i++) {
+		if (!nack)
+			return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+						      "i2c-%x: msg %u: address NACKed",
+						      msgs[i].addr, i);
+		nack--;
+
+		if (msgs[i].flags & FTDI_I2C_M_RD)
+			continue;
+
+		if (nack < msgs[i].len)
+			return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+						      "i2c-%x: msg %u: received NACK at offset %u",
+						      msgs[i].addr, i, nack);
+		nack -= msgs[i].len;
+	}
+
+	return ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "received NACK");
+}
+
+/*
+ * The whole transfer, START, all the messages joined by repeated STARTs and
+ * STOP, is one command stream: one write and one read of the replies. After
+ * a NACK, the rest is still clocked out, but reported as failed.
+ */
+int ftdi_i2c_transfer(struct ftdi_mpsse *ftdi_mpsse, const struct ftdi_i2c_msg *msgs,
+		      unsigned int num)
+{
+	int nack, ret;
+
+	if (ftdi_mpsse->replies_cnt || ftdi_mpsse->acks_seen)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "%s: transaction in progress", __func__);
+
+	for (unsigned int i = 0; i < num; i++) {
+		if (msgs[i].addr & 0x80)
+			return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+						      "msg %u: wrong address (containing R/W bit?)",
+						      i);
+		if ((msgs[i].flags & FTDI_I2C_M_RD) && !msgs[i].len)
+			return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+						      "msg %u: zero-length read", i);
+	}
+
+	for (unsigned int i = 0; i < num; i++) {
+		const struct ftdi_i2c_msg *msg = &msgs[i];
+		bool rd = msg->flags & FTDI_I2C_M_RD;
+
+		ftdi_mpsse->i2c.address = msg->addr;
+		ftdi_i2c_enqueue_start(ftdi_mpsse);
+		__ftdi_i2c_enqueue_writebyte(ftdi_mpsse, msg->addr << 1 | rd);
+
+		for (unsigned int j = 0; j < msg->len; j++) {
+			if (rd)
+				ftdi_i2c_enqueue_recv(ftdi_mpsse, msg->buf + j, j == msg->len - 1u);
+			else
+				__ftdi_i2c_enqueue_writebyte(ftdi_mpsse, msg->buf[j]);
+		}
+	}
+
+	ftdi_i2c_enqueue_stop(ftdi_mpsse);
+
+	ret = ftdi_i2c_sync(ftdi_mpsse);
 	if (ret < 0)
 		return ret;
 
-	return 0;
+	nack = ftdi_mpsse->first_nack;
+	ftdi_mpsse_reset_acks(ftdi_mpsse);
+	if (nack >= 0)
+		return ftdi_i2c_nack_error(ftdi_mpsse, msgs, num, nack);
+
+	return num;
+}
+
+void ftdi_i2c_get_wire_stats(const struct ftdi_mpsse *ftdi_mpsse,
+			     struct ftdi_i2c_wire_stats *stats)
+{
+	stats->mpsse_bytes = ftdi_mpsse->obuf_total - ftdi_mpsse->i2c.wire_mpsse_base;
+	stats->i2c_bytes = ftdi_mpsse->i2c.wire_i2c_bytes;
+}
+
+void ftdi_i2c_reset_wire_stats(struct ftdi_mpsse *ftdi_mpsse)
+{
+	ftdi_mpsse->i2c.wire_mpsse_base = ftdi_mpsse->obuf_total;
+	ftdi_mpsse->i2c.wire_i2c_bytes = 0;
 }
 
 void ftdi_i2c_close(struct ftdi_mpsse *ftdi_mpsse)
@@ -7,8 +7,11 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "ftdi_mpsse.h"
+#include "mpsse_reg.h"
 
 #if __GNUC__ >= 4
   #define __local	__attribute__((visibility("hidden")))
@@ -20,14 +23,54 @@
 #define div_round_up(n, div)	(((n) + (div) - 1) / (div))
 #define min(x, y)		((x) < (y) ? (x) : (y))
 #define max(x, y)		((x) > (y) ? (x) : (y))
+#define abs_diff(x, y)		((x) > (y) ? (x) - (y) : (y) - (x))
+
+static inline uint64_t ftdi_mpsse_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int __local ftdi_mpsse_obuf_grow(struct ftdi_mpsse *ftdi_mpsse, size_t len);
+void __local ftdi_mpsse_autoflush(struct ftdi_mpsse *ftdi_mpsse);
 
 static inline void ftdi_mpsse_enqueue(struct ftdi_mpsse *ftdi_mpsse, uint8_t c)
 {
-	if (ftdi_mpsse->obuf_cnt >= ARRAY_SIZE(ftdi_mpsse->obuf)) {
-		fprintf(stderr, "%s (%d): buffer overflow\n", __func__, __LINE__);
+	if (ftdi_mpsse->obuf_cnt >= ftdi_mpsse->obuf_size && ftdi_mpsse_obuf_grow(ftdi_mpsse, 1))
 		return;
-	}
+
 	ftdi_mpsse->obuf[ftdi_mpsse->obuf_cnt++] = c;
+	ftdi_mpsse->obuf_total++;
+
+	if (ftdi_mpsse->obuf_cnt >= ftdi_mpsse->flush_window)
+		ftdi_mpsse_autoflush(ftdi_mpsse);
+}
+
+static inline void ftdi_mpsse_enqueue_buf(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *buf,
+					  size_t len)
+{
+	if (ftdi_mpsse->obuf_cnt + len > ftdi_mpsse->obuf_size &&
+	    ftdi_mpsse_obuf_grow(ftdi_mpsse, len))
+		return;
+
+	memcpy(ftdi_mpsse->obuf + ftdi_mpsse->obuf_cnt, buf, len);
+	ftdi_mpsse->obuf_cnt += len;
+	ftdi_mpsse->obuf_total += len;
+
+	if (ftdi_mpsse->obuf_cnt >= ftdi_mpsse->flush_window)
+		ftdi_mpsse_autoflush(ftdi_mpsse);
+}
+
+/*
+ * Account for replies of a command. Call after the whole command is queued,
+ * so that an automatic flush never waits for replies of a partial command.
+ */
+static inline void ftdi_mpsse_expect(struct ftdi_mpsse *ftdi_mpsse, unsigned int count)
+{
+	ftdi_mpsse->rx_queued += count;
 }
 
 int __local ftdi_mpsse_store_error(struct ftdi_mpsse *ftdi_mpsse, int ret,
@@ -35,13 +78,64 @@ int __local ftdi_mpsse_store_error(struct ftdi_mpsse *ftdi_mpsse, int ret,
 
 int __local ftdi_mpsse_init(struct ftdi_mpsse *ftdi_mpsse,
 			    const struct ftdi_mpsse_config *conf);
+extern const struct ftdi_mpsse_caps ftdi_mpsse_caps_default __local;
+
+int __local ftdi_mpsse_queue_init(struct ftdi_mpsse *ftdi_mpsse);
+void __local ftdi_mpsse_queue_free(struct ftdi_mpsse *ftdi_mpsse);
+size_t __local ftdi_mpsse_read_ahead(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf, size_t size);
+int __local ftdi_mpsse_take_error(struct ftdi_mpsse *ftdi_mpsse);
+
+void __local ftdi_mpsse_reply_ack(struct ftdi_mpsse *ftdi_mpsse);
+void __local ftdi_mpsse_reply_data(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf, size_t len);
+void __local ftdi_mpsse_reply_gpio(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf);
+int __local ftdi_mpsse_collect(struct ftdi_mpsse *ftdi_mpsse);
+
+/* after a failed flush, the replies will never come */
+static inline void ftdi_mpsse_drop_replies(struct ftdi_mpsse *ftdi_mpsse)
+{
+	ftdi_mpsse->replies_cnt = 0;
+	ftdi_mpsse->reply_bytes = 0;
+}
+
+static inline void ftdi_mpsse_reset_acks(struct ftdi_mpsse *ftdi_mpsse)
+{
+	ftdi_mpsse->acks_seen = 0;
+	ftdi_mpsse->first_nack = -1;
+}
+
+/* the last reply of a round trip arrived */
+void __local ftdi_mpsse_stats_rtt(struct ftdi_mpsse *ftdi_mpsse);
+
+int __local ftdi_mpsse_read_usb(struct ftdi_mpsse *ftdi_mpsse, uint8_t *ibuf, size_t size,
+				size_t count, bool check_all);
 int __local ftdi_mpsse_read_dev(struct ftdi_mpsse *ftdi_mpsse, uint8_t *ibuf, size_t size,
 				size_t count, bool check_all);
-void __local ftdi_mpsse_set_speed(struct ftdi_mpsse *ftdi_mpsse, unsigned int speed,
-				  bool three_phase);
+int __local ftdi_mpsse_set_speed(struct ftdi_mpsse *ftdi_mpsse, unsigned int speed,
+				 enum ftdi_mpsse_clock_mode mode, bool three_phase);
 int __local ftdi_mpsse_flush(struct ftdi_mpsse *ftdi_mpsse);
 void __local ftdi_mpsse_set_pins(struct ftdi_mpsse *ftdi_mpsse, uint8_t bits,
 				 uint8_t output);
+void __local ftdi_mpsse_init_done(struct ftdi_mpsse *ftdi_mpsse);
+void __local ftdi_mpsse_recover(struct ftdi_mpsse *ftdi_mpsse);
 void __local ftdi_mpsse_close(struct ftdi_mpsse *ftdi_mpsse);
 
+int __local ftdi_mpsse_trace_init(struct ftdi_mpsse *ftdi_mpsse,
+				  const struct ftdi_mpsse_config *conf);
+void __local ftdi_mpsse_trace_close(struct ftdi_mpsse *ftdi_mpsse);
+void __local ftdi_mpsse_trace_record(struct ftdi_mpsse *ftdi_mpsse, enum ftdi_trace_dir dir,
+				     const uint8_t *buf, size_t len);
+
+static inline void ftdi_mpsse_trace_io(struct ftdi_mpsse *ftdi_mpsse, enum ftdi_trace_dir dir,
+				       const uint8_t *buf, size_t len)
+{
+	if (ftdi_mpsse->trace)
+		ftdi_mpsse_trace_record(ftdi_mpsse, dir, buf, len);
+}
+
+int __local ftdi_mpsse_async_start(struct ftdi_mpsse *ftdi_mpsse);
+void __local ftdi_mpsse_async_stop(struct ftdi_mpsse *ftdi_mpsse);
+int __local ftdi_mpsse_async_write(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *buf,
+				   size_t len);
+int __local ftdi_mpsse_async_read(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf, size_t size);
+
 #endif
@@ -0,0 +1,224 @@
+/*
+ * Licensed under the GPLv2
+ *
+ * The default transport: a real chip through libftdi (and libusb directly for
+ * the async mode, see async.c).
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <libusb.h>
+
+#include "ftdi_mpsse.h"
+#include "internal.h"
+
+/* sysfs-like "bus-port.port...", e.g. "1-2.4" */
+static void ftdi_mpsse_bus_path(struct libusb_device *dev, char *path, size_t size)
+{
+	uint8_t ports[8];
+	int len, cnt;
+
+	len = snprintf(path, size, "%u", libusb_get_bus_number(dev));
+	cnt = libusb_get_port_numbers(dev, ports, ARRAY_SIZE(ports));
+	for (int a = 0; a < cnt && len < (int)size; a++)
+		len += snprintf(path + len, size - len, "%c%u", a ? '.' : '-', ports[a]);
+}
+
+static bool ftdi_mpsse_dev_matches(struct ftdi_mpsse *ftdi_mpsse,
+				   const struct ftdi_mpsse_config *conf,
+				   struct libusb_device *dev)
+{
+	char description[128], serial[128], path[64];
+
+	if (conf->bus_path) {
+		ftdi_mpsse_bus_path(dev, path, sizeof(path));
+		if (strcmp(path, conf->bus_path))
+			return false;
+	}
+
+	if (!conf->serial && !conf->description)
+		return true;
+
+	if (ftdi_usb_get_strings(&ftdi_mpsse->ftdic, dev, NULL, 0, description,
+				 sizeof(description), serial, sizeof(serial)) < 0) {
+		if (ftdi_mpsse->debug & MPSSE_VERBOSE)
+			fprintf(stderr, "%s: cannot read strings: %s\n", __func__,
+				ftdi_get_error_string(&ftdi_mpsse->ftdic));
+		return false;
+	}
+
+	if (conf->serial && strcmp(serial, conf->serial))
+		return false;
+
+	if (conf->description && strcmp(description, conf->description))
+		return false;
+
+	return true;
+}
+
+/* Open the first device matching serial, description and bus path (if set) */
+static int ftdi_mpsse_libftdi_find(struct ftdi_mpsse *ftdi_mpsse, const struct ftdi_mpsse_config *conf)
+{
+	struct ftdi_device_list *devlist, *cur;
+	unsigned int matches = 0;
+	struct libusb_device *dev = NULL;
+	int ret;
+
+	ret = ftdi_usb_find_all(&ftdi_mpsse->ftdic, &devlist, conf->id_vendor, conf->id_product);
+	if (ret < 0)
+		return ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "failed to find a device");
+	if (ret == 0) {
+		ftdi_list_free(&devlist);
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "cannot find vendor (%.4x) and/or product (%.4x)",
+					      conf->id_vendor, conf->id_product);
+	}
+
+	for (cur = devlist; cur; cur = cur->next) {
+		if (!ftdi_mpsse_dev_matches(ftdi_mpsse, conf, cur->dev))
+			continue;
+		if (!matches++)
+			dev = cur->dev;
+	}
+
+	if (!dev) {
+		ftdi_list_free(&devlist);
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "no device matches serial=%s description=%s path=%s",
+					      conf->serial ? : "*", conf->description ? : "*",
+					      conf->bus_path ? : "*");
+	}
+
+	if (matches > 1 && (ftdi_mpsse->debug & MPSSE_VERBOSE))
+		fprintf(stderr, "More than one device matches, taking the first one\n");
+
+	ret = ftdi_usb_open_dev(&ftdi_mpsse->ftdic, dev);
+	ftdi_list_free(&devlist);
+	if (ret < 0)
+		return ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "ftdi_usb_open");
+
+	return 0;
+}
+
+static int ftdi_mpsse_libftdi_open(struct ftdi_mpsse *ftdi_mpsse,
+				   const struct ftdi_mpsse_config *conf)
+{
+	int ret;
+
+	ret = ftdi_init(&ftdi_mpsse->ftdic);
+	if (ret < 0)
+		return ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "ftdi_init");
+
+	ftdi_set_interface(&ftdi_mpsse->ftdic, conf->iface);
+
+	ret = ftdi_mpsse_libftdi_find(ftdi_mpsse, conf);
+	if (ret < 0)
+		goto deinit;
+
+	ret = ftdi_mpsse_set_caps(ftdi_mpsse, ftdi_mpsse->ftdic.type, ftdi_mpsse->ftdic.interface);
+	if (ret < 0)
+		goto close;
+
+	/*
+	 * The chip holds back a partial packet until the latency timer expires.
+	 * Replies are pushed by SEND_IMMEDIATE, but a short timer also bounds how
+	 * long an empty read blocks.
+	 */
+	ret = ftdi_set_latency_timer(&ftdi_mpsse->ftdic,
+				     conf->latency_timer ? : FTDI_MPSSE_LATENCY_TIMER);
+	if (ret < 0) {
+		ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "ftdi_set_latency_timer");
+		goto close;
+	}
+
+	return 0;
+close:
+	ftdi_usb_close(&ftdi_mpsse->ftdic);
+deinit:
+	ftdi_deinit(&ftdi_mpsse->ftdic);
+	return ret;
+}
+
+/* Reset the chip, switch it to MPSSE and drop whatever it sent before */
+static int ftdi_mpsse_libftdi_reset(struct ftdi_mpsse *ftdi_mpsse,
+				    const struct ftdi_mpsse_config *conf)
+{
+	uint8_t ibuf[64];
+	int ret;
+
+	ret = ftdi_usb_reset(&ftdi_mpsse->ftdic);
+	if (ret < 0)
+		return ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "ftdi_usb_reset");
+
+	ret = ftdi_tcioflush(&ftdi_mpsse->ftdic);
+	if (ret < 0)
+		return ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "ftdi_tcioflush");
+
+	/* Set MPSSE mode */
+	ftdi_set_bitmode(&ftdi_mpsse->ftdic, 0, BITMODE_RESET);
+	ftdi_set_bitmode(&ftdi_mpsse->ftdic, conf->gpio_dir, BITMODE_MPSSE);
+
+	/* the flush is not enough, there might be USB data */
+	do {
+		ret = ftdi_read_data(&ftdi_mpsse->ftdic, ibuf, sizeof(ibuf));
+		if (ret < 0)
+			return ftdi_mpsse_store_error(ftdi_mpsse, ret, true,
+						      "ftdi_read_data(emptying)");
+
+		if ((ftdi_mpsse->debug & MPSSE_VERBOSE) && ret) {
+			fprintf(stderr, "%s: dropping stalled data (%dB)\n", __func__, ret);
+			if (ftdi_mpsse->debug & MPSSE_DEBUG_READS) {
+				for (unsigned a = 0; a < (unsigned)ret; a++)
+					fprintf(stderr, " %02x", ibuf[a]);
+				fprintf(stderr, "\n");
+			}
+		}
+	} while (ret > 0);
+
+	return 0;
+}
+
+static int ftdi_mpsse_libftdi_write(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *buf,
+				    size_t len)
+{
+	int ret;
+
+	if (ftdi_mpsse->async)
+		return ftdi_mpsse_async_write(ftdi_mpsse, buf, len);
+
+	ret = ftdi_write_data(&ftdi_mpsse->ftdic, buf, len);
+	if (ret < 0)
+		return ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "ftdi_write_data");
+
+	return ret;
+}
+
+static int ftdi_mpsse_libftdi_read(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf, size_t size)
+{
+	int ret;
+
+	if (ftdi_mpsse->async)
+		return ftdi_mpsse_async_read(ftdi_mpsse, buf, size);
+
+	ret = ftdi_read_data(&ftdi_mpsse->ftdic, buf, size);
+	if (ret < 0)
+		return ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "ftdi_read_data");
+
+	return ret;
+}
+
+static void ftdi_mpsse_libftdi_close(struct ftdi_mpsse *ftdi_mpsse)
+{
+	ftdi_mpsse_async_stop(ftdi_mpsse);
+	ftdi_usb_close(&ftdi_mpsse->ftdic);
+	ftdi_deinit(&ftdi_mpsse->ftdic);
+}
+
+const struct ftdi_mpsse_transport ftdi_mpsse_transport_libftdi = {
+	.name = "libftdi",
+	.open = ftdi_mpsse_libftdi_open,
+	.reset = ftdi_mpsse_libftdi_reset,
+	.write = ftdi_mpsse_libftdi_write,
+	.read = ftdi_mpsse_libftdi_read,
+	.close = ftdi_mpsse_libftdi_close,
+};
@@ -4,20 +4,62 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
 
 #include "ftdi_mpsse.h"
 #include "internal.h"
 #include "mpsse_reg.h"
 
+/* Buffer sizes are per channel, from the datasheets */
+static const struct ftdi_mpsse_caps ftdi_mpsse_caps_table[] = {
+	{ TYPE_2232C, "FT2232D", 1,  128,  384, 12000000, false, false, 0x0ff0 },
+	{ TYPE_2232H, "FT2232H", 2, 4096, 4096, 60000000, true, false, 0xfff0 },
+	{ TYPE_4232H, "FT4232H", 2, 2048, 2048, 60000000, true, false, 0x00f0 },
+	{ TYPE_232H,  "FT232H",  1, 1024, 1024, 60000000, true, true, 0xfff0 },
+};
+
+/* the most common MPSSE chip, used until the real one is known */
+const struct ftdi_mpsse_caps ftdi_mpsse_caps_default = {
+	TYPE_232H,  "FT232H",  1, 1024, 1024, 60000000, true, true, 0xfff0
+};
+
+int ftdi_mpsse_set_caps(struct ftdi_mpsse *ftdi_mpsse, enum ftdi_chip_type type,
+			unsigned int channel)
+{
+	for (unsigned int a = 0; a < ARRAY_SIZE(ftdi_mpsse_caps_table); a++) {
+		const struct ftdi_mpsse_caps *caps = &ftdi_mpsse_caps_table[a];
+
+		if (caps->type != type)
+			continue;
+
+		if (channel >= caps->channels)
+			return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+						      "%s: channel %c has no MPSSE", caps->name,
+						      'A' + channel);
+
+		ftdi_mpsse->caps = caps;
+		ftdi_mpsse->flush_window = caps->tx_bufsize;
+
+		if (ftdi_mpsse->debug & MPSSE_VERBOSE)
+			fprintf(stderr, "%s: %s channel %c, TX %uB, RX %uB (%s)\n", __func__,
+				caps->name, 'A' + channel, caps->tx_bufsize, caps->rx_bufsize,
+				ftdi_mpsse->transport->name);
+
+		return 0;
+	}
+
+	return ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "chip type %d has no MPSSE", type);
+}
+
 /*
  * Synchronize the MPSSE interface by sending bad command 0xAA. The chip shall
  * respond with an echo command followed by bad command 0xAA. This will make
  * sure the MPSSE interface is enabled and synchronized successfully.
  */
-static int ftdi_mpsse_synchronize(struct ftdi_mpsse *ftdi_mpsse)
+static int ftdi_mpsse_synchronize(struct ftdi_mpsse *ftdi_mpsse, unsigned int timeout_ms)
 {
-	unsigned char ibuf[8];
+	uint64_t deadline = ftdi_mpsse_now_ns() + timeout_ms * 1000000ULL;
+	uint8_t ibuf[64], prev = 0;
+	unsigned int rd = 0;
 	int ret;
 
 	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_ECHO1);
@@ -26,163 +68,201 @@ static int ftdi_mpsse_synchronize(struct ftdi_mpsse *ftdi_mpsse)
 	if (ret < 0)
 		return ret;
 
-	unsigned int a, rd = 0;
-	for (a = 0; a < 5; a++) {
-		ret = ftdi_read_data(&ftdi_mpsse->ftdic, ibuf, sizeof(ibuf));
+	/* anything before the reply is stale data */
+	do {
+		ret = ftdi_mpsse_read_usb(ftdi_mpsse, ibuf, sizeof(ibuf), 1, false);
 		if (ret < 0)
-			return ftdi_mpsse_store_error(ftdi_mpsse, ret, true,
-						      "ftdi_read_data(sync reply)");
-		if (ret > 0) {
-			rd = ret;
-			break;
-		}
-	}
-	if (!rd)
-		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
-					      "cannot sync the chip (no data)");
+			return ret;
 
-	if (ftdi_mpsse->debug & MPSSE_VERBOSE) {
-		fprintf(stderr, "%s: sync received %dB:", __func__, rd);
-		for (unsigned a = 0; a < (unsigned)rd; a++)
-			fprintf(stderr, " %02x", ibuf[a]);
-		fprintf(stderr, "\n");
-	}
+		if ((ftdi_mpsse->debug & MPSSE_VERBOSE) && ret) {
+			fprintf(stderr, "%s: sync received %dB:", __func__, ret);
+			for (unsigned a = 0; a < (unsigned)ret; a++)
+				fprintf(stderr, " %02x", ibuf[a]);
+			fprintf(stderr, "\n");
+		}
 
-	for (a = 0; a < rd - 1; a++) {
-		if (ibuf[a] == CMD_INVALID && ibuf[a + 1] == CMD_ECHO1) {
-			if (ftdi_mpsse->debug & MPSSE_VERBOSE)
-				fprintf(stderr, "Chip synchronized\n");
-			break;
+		for (unsigned int a = 0; a < (unsigned)ret; a++) {
+			if (prev == CMD_INVALID && ibuf[a] == CMD_ECHO1) {
+				if (ftdi_mpsse->debug & MPSSE_VERBOSE)
+					fprintf(stderr, "Chip synchronized\n");
+				return 0;
+			}
+			prev = ibuf[a];
 		}
-	}
+		rd += ret;
+	} while (ftdi_mpsse_now_ns() < deadline);
 
-	if (a >= rd)
-		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
-					      "cannot sync the chip (invalid data)");
+	return ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "cannot sync the chip (%s)",
+				      rd ? "invalid data" : "no data");
+}
 
-	return 0;
+/* the environment is read once, getenv() races with setenv() in other threads */
+static pthread_once_t ftdi_mpsse_env_once = PTHREAD_ONCE_INIT;
+static unsigned int ftdi_mpsse_env_debug;
+static bool ftdi_mpsse_env_debug_set;
+
+static void ftdi_mpsse_read_env(void)
+{
+	const char *debug = getenv("FTDI_MPSSE_DEBUG");
+
+	if (debug) {
+		ftdi_mpsse_env_debug = strtol(debug, NULL, 0);
+		ftdi_mpsse_env_debug_set = true;
+	}
 }
 
 int ftdi_mpsse_init(struct ftdi_mpsse *ftdi_mpsse,
 		    const struct ftdi_mpsse_config *conf)
 {
-	uint8_t ibuf[64];
 	int ret;
 
 	memset(ftdi_mpsse, 0, sizeof(*ftdi_mpsse));
+	ftdi_mpsse->init_start_ns = ftdi_mpsse_now_ns();
 	ftdi_mpsse->speed = conf->speed;
+	ftdi_mpsse->read_timeout = conf->read_timeout ? : FTDI_MPSSE_READ_TIMEOUT;
 	ftdi_mpsse->debug = conf->debug;
-	const char *debug = getenv("FTDI_MPSSE_DEBUG");
-	if (debug)
-		ftdi_mpsse->debug = strtol(debug, NULL, 0);
+	pthread_once(&ftdi_mpsse_env_once, ftdi_mpsse_read_env);
+	if (ftdi_mpsse_env_debug_set)
+		ftdi_mpsse->debug = ftdi_mpsse_env_debug;
+	pthread_mutex_init(&ftdi_mpsse->lock, NULL);
 
+	/* GPIOL are outputs, GPIOH are left alone until ftdi_gpio_*() */
+	ftdi_mpsse->gpio_dir = 0xf0;
 	ftdi_mpsse_set_gpio(ftdi_mpsse, conf->gpio);
 
-	ret = ftdi_init(&ftdi_mpsse->ftdic);
+	ret = ftdi_mpsse_queue_init(ftdi_mpsse);
 	if (ret < 0)
-		return ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "ftdi_init");
+		goto free;
 
-	ftdi_set_interface(&ftdi_mpsse->ftdic, conf->iface);
-
-	struct ftdi_device_list *devlist;
-	ret = ftdi_usb_find_all(&ftdi_mpsse->ftdic, &devlist, conf->id_vendor, conf->id_product);
-	if (ret < 0) {
-		ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "failed to find a device");
-		goto deinit;
-	}
-	if (ret == 0) {
-		ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
-				       "cannot find vendor (%.4x) and/or product (%.4x)",
-				       conf->id_vendor, conf->id_product);
-		ftdi_list_free(&devlist);
-		goto deinit;
-	}
-	if (ret > 1 && (ftdi_mpsse->debug & MPSSE_VERBOSE))
-		fprintf(stderr, "More than one device found, taking the first one\n");
-
-	ret = ftdi_usb_open_dev(&ftdi_mpsse->ftdic, devlist->dev);
-	ftdi_list_free(&devlist);
-	if (ret < 0) {
-		ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "ftdi_usb_open");
-		goto deinit;
-	}
+	ret = ftdi_mpsse_trace_init(ftdi_mpsse, conf);
+	if (ret < 0)
+		goto free;
 
-	if (ftdi_mpsse->debug & MPSSE_VERBOSE)
-		fprintf(stderr, "Port opened, resetting device...\n");
+	ftdi_mpsse->transport = conf->transport ? : &ftdi_mpsse_transport_libftdi;
+	ret = ftdi_mpsse->transport->open(ftdi_mpsse, conf);
+	if (ret < 0)
+		goto free;
 
-	ret = ftdi_usb_reset(&ftdi_mpsse->ftdic);
-	if (ret < 0) {
-		ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "ftdi_usb_reset");
-		goto close;
+	/* a chip left in MPSSE mode by a previous user answers the echo right away */
+	if (conf->warm_attach) {
+		ftdi_mpsse->warm = ftdi_mpsse_synchronize(ftdi_mpsse, FTDI_MPSSE_WARM_TIMEOUT) >= 0;
+		if (!ftdi_mpsse->warm && (ftdi_mpsse->debug & MPSSE_VERBOSE))
+			fprintf(stderr, "%s: not in MPSSE mode, resetting\n", __func__);
 	}
 
-	ret = ftdi_tcioflush(&ftdi_mpsse->ftdic);
-	if (ret < 0) {
-		ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "ftdi_tcioflush");
-		goto close;
-	}
+	if (!ftdi_mpsse->warm) {
+		if (ftdi_mpsse->debug & MPSSE_VERBOSE)
+			fprintf(stderr, "Port opened, resetting device...\n");
 
-	/* Set MPSSE mode */
-	ftdi_set_bitmode(&ftdi_mpsse->ftdic, 0, BITMODE_RESET);
-	ftdi_set_bitmode(&ftdi_mpsse->ftdic, conf->gpio_dir, BITMODE_MPSSE);
+		ret = ftdi_mpsse->transport->reset(ftdi_mpsse, conf);
+		if (ret < 0)
+			goto close;
 
-	/* the flush is not enough, there might be USB data */
-	do {
-		ret = ftdi_read_data(&ftdi_mpsse->ftdic, ibuf, sizeof(ibuf));
-		if (ret < 0) {
-			ftdi_mpsse_store_error(ftdi_mpsse, ret, true, "ftdi_read_data(emptying)");
+		ret = ftdi_mpsse_synchronize(ftdi_mpsse, ftdi_mpsse->read_timeout);
+		if (ret < 0)
 			goto close;
-		}
+	}
 
-		if ((ftdi_mpsse->debug & MPSSE_VERBOSE) && ret) {
-			fprintf(stderr, "%s: dropping stalled data (%dB)\n", __func__, ret);
-			if (ftdi_mpsse->debug & MPSSE_DEBUG_READS) {
-				for (unsigned a = 0; a < (unsigned)ret; a++)
-					fprintf(stderr, " %02x", ibuf[a]);
-				fprintf(stderr, "\n");
-			}
+	if (conf->async) {
+		if (ftdi_mpsse->transport != &ftdi_mpsse_transport_libftdi) {
+			ret = ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+						     "async needs the libftdi transport");
+			goto close;
 		}
-	} while (ret > 0);
-
-	ret = ftdi_mpsse_synchronize(ftdi_mpsse);
-	if (ret < 0)
-		goto close;
+		ret = ftdi_mpsse_async_start(ftdi_mpsse);
+		if (ret < 0)
+			goto close;
+	}
 
 	return 0;
 close:
-	ftdi_usb_close(&ftdi_mpsse->ftdic);
-deinit:
-	ftdi_deinit(&ftdi_mpsse->ftdic);
+	ftdi_mpsse->transport->close(ftdi_mpsse);
+free:
+	/* a trace of a failed init is the most useful one */
+	ftdi_mpsse_trace_close(ftdi_mpsse);
+	ftdi_mpsse_queue_free(ftdi_mpsse);
+	pthread_mutex_destroy(&ftdi_mpsse->lock);
 	return ret;
 }
 
-int ftdi_mpsse_read_dev(struct ftdi_mpsse *ftdi_mpsse, uint8_t *ibuf, size_t size, size_t count,
+void ftdi_mpsse_init_done(struct ftdi_mpsse *ftdi_mpsse)
+{
+	ftdi_mpsse->init_ns = ftdi_mpsse_now_ns() - ftdi_mpsse->init_start_ns;
+	if (ftdi_mpsse->debug & MPSSE_VERBOSE)
+		fprintf(stderr, "%s init in %.3f ms (%s)\n", ftdi_mpsse->caps->name,
+			ftdi_mpsse->init_ns / 1e6, ftdi_mpsse->warm ? "warm" : "cold");
+}
+
+int ftdi_mpsse_read_usb(struct ftdi_mpsse *ftdi_mpsse, uint8_t *ibuf, size_t size, size_t count,
 			bool check_all)
 {
-	unsigned int to = 100;
+	uint64_t deadline = ftdi_mpsse_now_ns() + ftdi_mpsse->read_timeout * 1000000ULL;
 	unsigned int rd = 0;
+	int ret;
 
-	if (!count)
-		return 0;
-
+	/*
+	 * No sleeping here: an empty read blocks in the transport, e.g. in USB
+	 * until the chip sends its status packet (at most the latency timer).
+	 */
 	while (1) {
-		int now_rd = ftdi_read_data(&ftdi_mpsse->ftdic, ibuf + rd, size - rd);
-		if (now_rd < 0)
-			return ftdi_mpsse_store_error(ftdi_mpsse, now_rd, true, "ftdi_read_data");
+		int now_rd = ftdi_mpsse->transport->read(ftdi_mpsse, ibuf + rd, size - rd);
+		if (now_rd < 0) {
+			ret = now_rd;
+			goto fail;
+		}
 
-		if (now_rd == 0 && to < 90)
-			fprintf(stderr, "no input (rd=%d, count=%zu), trying (%u)\n",
-				rd, count, to);
+		ftdi_mpsse->stats.usb_reads++;
+		ftdi_mpsse->stats.bytes_in += now_rd;
 		rd += now_rd;
-		if (rd >= count)
+		if (rd >= count || !check_all)
 			break;
-		if (!to--)
-			return ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "TIMEOUT");
 
-		if (!check_all)
-			break;
+		if (!now_rd)
+			ftdi_mpsse->stats.empty_reads++;
 
-		usleep(10000);
+		if (ftdi_mpsse_now_ns() >= deadline) {
+			ftdi_mpsse->stats.timeouts++;
+			ret = ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+						     "TIMEOUT (rd=%u, count=%zu)", rd, count);
+			goto fail;
+		}
+	}
+
+	if (rd)
+		ftdi_mpsse_trace_io(ftdi_mpsse, FTDI_TRACE_RX, ibuf, rd);
+	ftdi_mpsse->rx_inflight -= min(ftdi_mpsse->rx_inflight, rd);
+	if (!ftdi_mpsse->rx_inflight && ftdi_mpsse->rtt_start_ns)
+		ftdi_mpsse_stats_rtt(ftdi_mpsse);
+
+	return rd;
+
+fail:
+	/* that round trip is lost, the next flush starts timing a new one */
+	ftdi_mpsse->rtt_start_ns = 0;
+	return ret;
+}
+
+int ftdi_mpsse_read_dev(struct ftdi_mpsse *ftdi_mpsse, uint8_t *ibuf, size_t size, size_t count,
+			bool check_all)
+{
+	unsigned int rd;
+	int ret;
+
+	ret = ftdi_mpsse_take_error(ftdi_mpsse);
+	if (ret < 0)
+		return ret;
+
+	if (!count)
+		return 0;
+
+	/* replies collected by an automatic flush come first */
+	rd = ftdi_mpsse_read_ahead(ftdi_mpsse, ibuf, min(size, count));
+	if (rd < count) {
+		ret = ftdi_mpsse_read_usb(ftdi_mpsse, ibuf + rd, size - rd, count - rd,
+					  check_all);
+		if (ret < 0)
+			return ret;
+		rd += ret;
 	}
 
 	if (ftdi_mpsse->debug & MPSSE_DEBUG_READS) {
@@ -196,33 +276,115 @@ int ftdi_mpsse_read_dev(struct ftdi_mpsse *ftdi_mpsse, uint8_t *ibuf, size_t siz
 	return rd;
 }
 
-void ftdi_mpsse_set_speed(struct ftdi_mpsse *ftdi_mpsse, unsigned int speed, bool three_phase)
+/* the best divisor for one base clock, 0 if there is none */
+static unsigned int ftdi_mpsse_plan_base(unsigned int base, unsigned int speed,
+					 unsigned int phases, enum ftdi_mpsse_clock_mode mode,
+					 unsigned int *divisor)
 {
-	unsigned int div = 60000000;
-	unsigned int div_divisor = speed * 2;
+	uint64_t den = (uint64_t)speed * phases;
+	uint64_t n;
+
+	if (mode == FTDI_MPSSE_CLOCK_NEAREST)
+		n = (base + den / 2) / den;
+	else
+		n = div_round_up(base, den);
+
+	n = min(max(n, 1U), 0x10000U);
+	if (mode == FTDI_MPSSE_CLOCK_NOT_ABOVE && base > den * n)
+		return 0;
+
+	*divisor = n - 1;
+
+	return base / (n * phases);
+}
 
-	if (three_phase) {
-		div *= 2;
-		div_divisor *= 3;
+/*
+ * Pick divide-by-5, 3-phase and the divisor giving the bus clock closest to
+ * speed. 3-phase is only honoured on the H series.
+ */
+int ftdi_mpsse_plan_clock(const struct ftdi_mpsse_caps *caps, unsigned int speed,
+			  bool three_phase, enum ftdi_mpsse_clock_mode mode,
+			  struct ftdi_mpsse_clock *clock)
+{
+	unsigned int phases, freq, freq5 = 0, div = 0, div5 = 0;
+	bool use5;
+
+	if (!speed)
+		return -1;
+
+	three_phase = three_phase && caps->h_series;
+	phases = three_phase ? 3 : 2;
+
+	freq = ftdi_mpsse_plan_base(caps->base_clock, speed, phases, mode, &div);
+	if (caps->h_series)
+		freq5 = ftdi_mpsse_plan_base(caps->base_clock / 5, speed, phases, mode, &div5);
+
+	/* the undivided clock has the finer steps, so it wins ties */
+	if (!freq || !freq5)
+		use5 = freq5;
+	else if (mode == FTDI_MPSSE_CLOCK_NEAREST)
+		use5 = abs_diff(freq5, speed) < abs_diff(freq, speed);
+	else
+		use5 = freq5 > freq;
+
+	if (use5) {
+		freq = freq5;
+		div = div5;
 	}
 
-	div = div_round_up(div, div_divisor) - 1;
+	if (!freq)
+		return -1;
 
-	if (div & ~0xffff)
-		fprintf(stderr, "%s: divisor overflow: speed=%u 3phase=%u div=0x%x\n", __func__,
-			speed, three_phase, div);
+	clock->freq = freq;
+	clock->divisor = div;
+	clock->div5 = use5;
+	clock->three_phase = three_phase;
 
-	if (ftdi_mpsse->debug & MPSSE_DEBUG_CLOCK)
-		fprintf(stderr, "%s: speed=%u 3phase=%u -> divisor=%.4x\n", __func__,
-			speed, three_phase, div);
+	return 0;
+}
+
+int ftdi_mpsse_set_speed(struct ftdi_mpsse *ftdi_mpsse, unsigned int speed,
+			 enum ftdi_mpsse_clock_mode mode, bool three_phase)
+{
+	struct ftdi_mpsse_clock *clock = &ftdi_mpsse->clock;
 
+	if (ftdi_mpsse_plan_clock(ftdi_mpsse->caps, speed, three_phase, mode, clock) < 0)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "%s cannot clock at or below %u Hz",
+					      ftdi_mpsse->caps->name, speed);
+
+	if (ftdi_mpsse->debug & MPSSE_DEBUG_CLOCK)
+		fprintf(stderr, "%s: speed=%u -> %u Hz (div5=%u 3phase=%u divisor=%.4x)\n",
+			__func__, speed, clock->freq, clock->div5, clock->three_phase,
+			clock->divisor);
+
+	if (three_phase && !clock->three_phase && (ftdi_mpsse->debug & MPSSE_VERBOSE))
+		fprintf(stderr, "%s: %s has no 3-phase clocking\n", __func__,
+			ftdi_mpsse->caps->name);
+
+	/* older chips reject these as bad commands */
+	if (ftdi_mpsse->caps->h_series) {
+		ftdi_mpsse_enqueue(ftdi_mpsse, clock->div5 ? CMD_CLK_DIV5_EN : CMD_CLK_DIV5_DIS);
+		ftdi_mpsse_enqueue(ftdi_mpsse, clock->three_phase ? CMD_CLK_3PHASE_EN :
+				   CMD_CLK_3PHASE_DIS);
+	}
 	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_SET_CLK_DIVISOR);
-	ftdi_mpsse_enqueue(ftdi_mpsse, div & 0xff);
-	ftdi_mpsse_enqueue(ftdi_mpsse, div >> 8);
+	ftdi_mpsse_enqueue(ftdi_mpsse, clock->divisor & 0xff);
+	ftdi_mpsse_enqueue(ftdi_mpsse, clock->divisor >> 8);
+
+	ftdi_mpsse->speed = clock->freq;
+
+	return 0;
 }
 
 int ftdi_mpsse_flush(struct ftdi_mpsse *ftdi_mpsse)
 {
+	int ret;
+
+	ret = ftdi_mpsse_take_error(ftdi_mpsse);
+	if (ret < 0)
+		return ret;
+
 	if (ftdi_mpsse->debug & MPSSE_DEBUG_WRITES) {
 		fprintf(stderr, "%s: sending %u:", __func__, ftdi_mpsse->obuf_cnt);
 		for (unsigned a = 0; a < ftdi_mpsse->obuf_cnt; a++)
@@ -230,31 +392,84 @@ int ftdi_mpsse_flush(struct ftdi_mpsse *ftdi_mpsse)
 		fprintf(stderr, "\n");
 	}
 
-	int ret = ftdi_write_data(&ftdi_mpsse->ftdic, ftdi_mpsse->obuf, ftdi_mpsse->obuf_cnt);
-	if (ret != (int)ftdi_mpsse->obuf_cnt) {
-		return ftdi_mpsse_store_error(ftdi_mpsse, ret < 0 ? ret : -1, ret < 0,
+	ftdi_mpsse_trace_io(ftdi_mpsse, FTDI_TRACE_TX, ftdi_mpsse->obuf, ftdi_mpsse->obuf_cnt);
+
+	ret = ftdi_mpsse->transport->write(ftdi_mpsse, ftdi_mpsse->obuf, ftdi_mpsse->obuf_cnt);
+	if (ret < 0)
+		return ret;
+	if (ret != (int)ftdi_mpsse->obuf_cnt)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
 					      "%s: cannot write: ret (%d) != %u", __func__,
 					      ret, ftdi_mpsse->obuf_cnt);
-	}
+
+	ftdi_mpsse->stats.usb_writes++;
+	ftdi_mpsse->stats.bytes_out += ret;
+	if (ftdi_mpsse->rx_queued && !ftdi_mpsse->rtt_start_ns)
+		ftdi_mpsse->rtt_start_ns = ftdi_mpsse_now_ns();
 
 	ftdi_mpsse->obuf_cnt = 0;
+	ftdi_mpsse->rx_inflight += ftdi_mpsse->rx_queued;
+	ftdi_mpsse->rx_queued = 0;
 
 	return ret;
 }
 
+/* the bus pins (0..3) of the I2C/SPI engine, GPIOL follow ftdi_gpio_*() */
 void ftdi_mpsse_set_pins(struct ftdi_mpsse *ftdi_mpsse, uint8_t bits,
 			 uint8_t output)
 {
-	unsigned char val = (ftdi_mpsse->gpio << 4) | bits;
-	unsigned char dir = 0xf0 | output;
+	unsigned char val = (ftdi_mpsse->gpio & 0xf0) | bits;
+	unsigned char dir = (ftdi_mpsse->gpio_dir & 0xf0 & ~ftdi_mpsse->gpio_in) | output;
+
+	ftdi_mpsse->bus_bits = bits;
+	ftdi_mpsse->bus_output = output;
 
 	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_SET_BITS_LOW);
 	ftdi_mpsse_enqueue(ftdi_mpsse, val);
 	ftdi_mpsse_enqueue(ftdi_mpsse, dir);
 }
 
+/*
+ * After a failed transfer the queued commands and the replies the chip still
+ * owes belong to nobody. Drop them, write the bus pins as last set (released
+ * by the caller) right away and read up to an echo, so the next transfer gets
+ * its own data. Best effort: the error of the transfer stays the reported one.
+ */
+void ftdi_mpsse_recover(struct ftdi_mpsse *ftdi_mpsse)
+{
+	char error[sizeof(ftdi_mpsse->error_buf)];
+
+	memcpy(error, ftdi_mpsse->error_buf, sizeof(error));
+
+	ftdi_mpsse->obuf_cnt = 0;
+	ftdi_mpsse->obuf_error = 0;
+	ftdi_mpsse_drop_replies(ftdi_mpsse);
+	ftdi_mpsse_reset_acks(ftdi_mpsse);
+	ftdi_mpsse->ibuf_cnt = ftdi_mpsse->ibuf_pos = 0;
+	ftdi_mpsse->rx_queued = 0;
+	ftdi_mpsse->rx_inflight = 0;
+	ftdi_mpsse->rtt_start_ns = 0;
+
+	ftdi_mpsse_set_pins(ftdi_mpsse, ftdi_mpsse->bus_bits, ftdi_mpsse->bus_output);
+	ftdi_mpsse_synchronize(ftdi_mpsse, ftdi_mpsse->read_timeout);
+
+	memcpy(ftdi_mpsse->error_buf, error, sizeof(error));
+}
+
 void ftdi_mpsse_close(struct ftdi_mpsse *ftdi_mpsse)
 {
-	ftdi_usb_close(&ftdi_mpsse->ftdic);
-	ftdi_deinit(&ftdi_mpsse->ftdic);
+	ftdi_mpsse->transport->close(ftdi_mpsse);
+	ftdi_mpsse_trace_close(ftdi_mpsse);
+	ftdi_mpsse_queue_free(ftdi_mpsse);
+	pthread_mutex_destroy(&ftdi_mpsse->lock);
+}
+
+void ftdi_mpsse_lock(struct ftdi_mpsse *ftdi_mpsse)
+{
+	pthread_mutex_lock(&ftdi_mpsse->lock);
+}
+
+void ftdi_mpsse_unlock(struct ftdi_mpsse *ftdi_mpsse)
+{
+	pthread_mutex_unlock(&ftdi_mpsse->lock);
 }
@@ -0,0 +1,271 @@
+/*
+ * Licensed under the GPLv2
+ *
+ * Multi-adapter manager: one worker thread per adapter, each with its own job
+ * queue. The workers open their adapters in parallel, so the (slow) USB
+ * resets and synchronizations overlap too.
+ */
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ftdi_mpsse.h"
+#include "internal.h"
+
+struct ftdi_pool_job {
+	struct ftdi_pool_job *next;
+	ftdi_pool_job_fn fn;
+	void *data;
+};
+
+struct ftdi_pool_adapter {
+	struct ftdi_pool_adapter_config conf;
+	struct ftdi_mpsse ftdi_mpsse;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t idle;
+
+	/* under lock */
+	struct ftdi_pool_job *head, **tail;
+	unsigned int pending;
+	bool started, opened, stop;
+	int error;
+	char error_buf[sizeof(((struct ftdi_mpsse *)0)->error_buf)];
+};
+
+struct ftdi_pool {
+	unsigned int count;
+	char error_buf[160];
+	struct ftdi_pool_adapter adapters[];
+};
+
+static int ftdi_pool_store_error(struct ftdi_pool *pool, const char *fmt, ...)
+{
+	va_list va;
+
+	va_start(va, fmt);
+	vsnprintf(pool->error_buf, sizeof(pool->error_buf), fmt, va);
+	va_end(va);
+
+	return -1;
+}
+
+/* the first error of an adapter is kept until ftdi_pool_wait() */
+static void ftdi_pool_adapter_error(struct ftdi_pool_adapter *adapter, int ret)
+{
+	if (adapter->error)
+		return;
+
+	adapter->error = ret;
+	memcpy(adapter->error_buf, ftdi_mpsse_get_error(&adapter->ftdi_mpsse),
+	       sizeof(adapter->error_buf));
+}
+
+static void *ftdi_pool_worker(void *arg)
+{
+	struct ftdi_pool_adapter *adapter = arg;
+	struct ftdi_mpsse *ftdi_mpsse = &adapter->ftdi_mpsse;
+	int ret;
+
+	if (adapter->conf.bus == FTDI_POOL_I2C)
+		ret = ftdi_i2c_init(ftdi_mpsse, &adapter->conf.conf);
+	else
+		ret = ftdi_spi_init(ftdi_mpsse, &adapter->conf.conf);
+
+	pthread_mutex_lock(&adapter->lock);
+	adapter->opened = ret >= 0;
+	if (ret < 0)
+		ftdi_pool_adapter_error(adapter, ret);
+	adapter->pending--;
+	pthread_cond_broadcast(&adapter->idle);
+
+	while (adapter->opened) {
+		struct ftdi_pool_job *job;
+
+		while (!adapter->head && !adapter->stop)
+			pthread_cond_wait(&adapter->work, &adapter->lock);
+		if (!adapter->head)
+			break;
+
+		job = adapter->head;
+		adapter->head = job->next;
+		if (!adapter->head)
+			adapter->tail = &adapter->head;
+		pthread_mutex_unlock(&adapter->lock);
+
+		ret = job->fn(ftdi_mpsse, job->data);
+		free(job);
+
+		pthread_mutex_lock(&adapter->lock);
+		if (ret < 0)
+			ftdi_pool_adapter_error(adapter, ret);
+		if (!--adapter->pending)
+			pthread_cond_broadcast(&adapter->idle);
+	}
+	pthread_mutex_unlock(&adapter->lock);
+
+	if (adapter->opened)
+		ftdi_mpsse_close(ftdi_mpsse);
+
+	return NULL;
+}
+
+struct ftdi_pool *ftdi_pool_create(const struct ftdi_pool_adapter_config *adapters,
+				   unsigned int count)
+{
+	struct ftdi_pool *pool;
+
+	pool = calloc(1, sizeof(*pool) + count * sizeof(*pool->adapters));
+	if (!pool)
+		return NULL;
+
+	pool->count = count;
+	for (unsigned int a = 0; a < count; a++) {
+		struct ftdi_pool_adapter *adapter = &pool->adapters[a];
+
+		adapter->conf = adapters[a];
+		adapter->tail = &adapter->head;
+		pthread_mutex_init(&adapter->lock, NULL);
+		pthread_cond_init(&adapter->work, NULL);
+		pthread_cond_init(&adapter->idle, NULL);
+	}
+
+	return pool;
+}
+
+/* Wait until all the queued jobs of an adapter are done, return its first error */
+static int ftdi_pool_wait_adapter(struct ftdi_pool *pool, unsigned int idx)
+{
+	struct ftdi_pool_adapter *adapter = &pool->adapters[idx];
+	int ret;
+
+	pthread_mutex_lock(&adapter->lock);
+	while (adapter->pending)
+		pthread_cond_wait(&adapter->idle, &adapter->lock);
+	ret = adapter->error;
+	if (ret < 0)
+		ftdi_pool_store_error(pool, "adapter %u: %s", idx, adapter->error_buf);
+	adapter->error = 0;
+	pthread_mutex_unlock(&adapter->lock);
+
+	return ret;
+}
+
+/* Open all the adapters in parallel. Fails if any of them cannot be opened. */
+int ftdi_pool_open(struct ftdi_pool *pool)
+{
+	int ret = 0;
+
+	for (unsigned int a = 0; a < pool->count; a++) {
+		struct ftdi_pool_adapter *adapter = &pool->adapters[a];
+		int err;
+
+		/* the open counts as a job */
+		adapter->pending = 1;
+		err = pthread_create(&adapter->thread, NULL, ftdi_pool_worker, adapter);
+		if (err) {
+			adapter->pending = 0;
+			ret = ftdi_pool_store_error(pool, "adapter %u: cannot create thread: %s",
+						    a, strerror(err));
+			break;
+		}
+		adapter->started = true;
+	}
+
+	for (unsigned int a = 0; a < pool->count; a++) {
+		if (!pool->adapters[a].started)
+			continue;
+		if (ftdi_pool_wait_adapter(pool, a) < 0 && !ret)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+int ftdi_pool_submit(struct ftdi_pool *pool, unsigned int idx, ftdi_pool_job_fn fn, void *data)
+{
+	struct ftdi_pool_adapter *adapter;
+	struct ftdi_pool_job *job;
+
+	if (idx >= pool->count)
+		return ftdi_pool_store_error(pool, "no adapter %u", idx);
+
+	adapter = &pool->adapters[idx];
+	job = malloc(sizeof(*job));
+	if (!job)
+		return ftdi_pool_store_error(pool, "cannot allocate a job");
+
+	job->next = NULL;
+	job->fn = fn;
+	job->data = data;
+
+	pthread_mutex_lock(&adapter->lock);
+	if (!adapter->opened) {
+		pthread_mutex_unlock(&adapter->lock);
+		free(job);
+		return ftdi_pool_store_error(pool, "adapter %u not open", idx);
+	}
+	*adapter->tail = job;
+	adapter->tail = &job->next;
+	adapter->pending++;
+	pthread_cond_signal(&adapter->work);
+	pthread_mutex_unlock(&adapter->lock);
+
+	return 0;
+}
+
+/* Wait for all the submitted jobs. Returns -1 if any of them failed. */
+int ftdi_pool_wait(struct ftdi_pool *pool)
+{
+	int ret = 0;
+
+	for (unsigned int a = 0; a < pool->count; a++)
+		if (ftdi_pool_wait_adapter(pool, a) < 0 && !ret)
+			ret = -1;
+
+	return ret;
+}
+
+void ftdi_pool_destroy(struct ftdi_pool *pool)
+{
+	for (unsigned int a = 0; a < pool->count; a++) {
+		struct ftdi_pool_adapter *adapter = &pool->adapters[a];
+
+		if (!adapter->started)
+			continue;
+
+		pthread_mutex_lock(&adapter->lock);
+		adapter->stop = true;
+		pthread_cond_signal(&adapter->work);
+		pthread_mutex_unlock(&adapter->lock);
+	}
+
+	for (unsigned int a = 0; a < pool->count; a++) {
+		struct ftdi_pool_adapter *adapter = &pool->adapters[a];
+
+		if (adapter->started)
+			pthread_join(adapter->thread, NULL);
+
+		/* jobs submitted but never run */
+		while (adapter->head) {
+			struct ftdi_pool_job *job = adapter->head;
+
+			adapter->head = job->next;
+			free(job);
+		}
+
+		pthread_mutex_destroy(&adapter->lock);
+		pthread_cond_destroy(&adapter->work);
+		pthread_cond_destroy(&adapter->idle);
+	}
+
+	free(pool);
+}
+
+const char *ftdi_pool_get_error(const struct ftdi_pool *pool)
+{
+	return pool->error_buf;
+}
@@ -0,0 +1,267 @@
+/*
+ * Licensed under the GPLv2
+ *
+ * Output queue: commands are collected in a growable buffer which is sent
+ * whenever it reaches the size of the chip's TX buffer (flush_window).
+ * Replies of the sent commands are collected into a read-ahead buffer before
+ * the next batch is written, so the chip never stalls on a full RX buffer.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "ftdi_mpsse.h"
+#include "internal.h"
+#include "mpsse_reg.h"
+
+int ftdi_mpsse_queue_init(struct ftdi_mpsse *ftdi_mpsse)
+{
+	/* until the chip is known */
+	ftdi_mpsse->caps = &ftdi_mpsse_caps_default;
+	ftdi_mpsse->flush_window = ftdi_mpsse->caps->tx_bufsize;
+
+	ftdi_mpsse_reset_acks(ftdi_mpsse);
+
+	ftdi_mpsse->obuf_size = 2 * ftdi_mpsse->flush_window;
+	ftdi_mpsse->obuf = malloc(ftdi_mpsse->obuf_size);
+	if (!ftdi_mpsse->obuf)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "cannot allocate obuf");
+
+	return 0;
+}
+
+void ftdi_mpsse_queue_free(struct ftdi_mpsse *ftdi_mpsse)
+{
+	free(ftdi_mpsse->obuf);
+	ftdi_mpsse->obuf = NULL;
+	free(ftdi_mpsse->ibuf);
+	ftdi_mpsse->ibuf = NULL;
+	free(ftdi_mpsse->replies);
+	ftdi_mpsse->replies = NULL;
+	free(ftdi_mpsse->rbuf);
+	ftdi_mpsse->rbuf = NULL;
+}
+
+static int ftdi_mpsse_grow(struct ftdi_mpsse *ftdi_mpsse, uint8_t **buf, unsigned int *size,
+			   size_t needed)
+{
+	size_t new_size = max(*size, 64U);
+	uint8_t *new_buf;
+
+	while (new_size < needed)
+		new_size *= 2;
+
+	new_buf = realloc(*buf, new_size);
+	if (!new_buf)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "cannot grow buffer to %zu", new_size);
+
+	*buf = new_buf;
+	*size = new_size;
+
+	return 0;
+}
+
+int ftdi_mpsse_obuf_grow(struct ftdi_mpsse *ftdi_mpsse, size_t len)
+{
+	int ret;
+
+	ret = ftdi_mpsse_grow(ftdi_mpsse, &ftdi_mpsse->obuf, &ftdi_mpsse->obuf_size,
+			      ftdi_mpsse->obuf_cnt + len);
+	if (ret < 0 && !ftdi_mpsse->obuf_error)
+		ftdi_mpsse->obuf_error = ret;
+
+	return ret;
+}
+
+/* Collect replies of all the sent commands into the read-ahead buffer */
+static int ftdi_mpsse_drain(struct ftdi_mpsse *ftdi_mpsse)
+{
+	unsigned int need = ftdi_mpsse->rx_inflight;
+	int ret;
+
+	if (!need)
+		return 0;
+
+	if (ftdi_mpsse->ibuf_pos == ftdi_mpsse->ibuf_cnt)
+		ftdi_mpsse->ibuf_pos = ftdi_mpsse->ibuf_cnt = 0;
+
+	if (ftdi_mpsse->ibuf_cnt + need > ftdi_mpsse->ibuf_size) {
+		ret = ftdi_mpsse_grow(ftdi_mpsse, &ftdi_mpsse->ibuf, &ftdi_mpsse->ibuf_size,
+				      ftdi_mpsse->ibuf_cnt + need);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = ftdi_mpsse_read_usb(ftdi_mpsse, ftdi_mpsse->ibuf + ftdi_mpsse->ibuf_cnt,
+				  need, need, true);
+	if (ret < 0)
+		return ret;
+
+	ftdi_mpsse->ibuf_cnt += ret;
+
+	return 0;
+}
+
+/*
+ * Called when the queue reaches the chip's TX buffer size. Errors cannot be
+ * returned from the enqueue path, so they are kept and reported by the next
+ * ftdi_mpsse_flush() or ftdi_mpsse_read_dev().
+ */
+void ftdi_mpsse_autoflush(struct ftdi_mpsse *ftdi_mpsse)
+{
+	int ret;
+
+	if (ftdi_mpsse->obuf_error) {
+		ftdi_mpsse->obuf_cnt = 0;
+		return;
+	}
+
+	ftdi_mpsse->stats.auto_flushes++;
+
+	if (ftdi_mpsse->debug & MPSSE_DEBUG_FLUSHING)
+		fprintf(stderr, "%s: obuf_cnt=%u rx_inflight=%u rx_queued=%u\n", __func__,
+			ftdi_mpsse->obuf_cnt, ftdi_mpsse->rx_inflight, ftdi_mpsse->rx_queued);
+
+	ret = ftdi_mpsse_drain(ftdi_mpsse);
+	if (ret >= 0)
+		ret = ftdi_mpsse_flush(ftdi_mpsse);
+	if (ret < 0) {
+		ftdi_mpsse->obuf_error = ret;
+		ftdi_mpsse->obuf_cnt = 0;
+	}
+}
+
+size_t ftdi_mpsse_read_ahead(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf, size_t size)
+{
+	size_t now = min(size, (size_t)(ftdi_mpsse->ibuf_cnt - ftdi_mpsse->ibuf_pos));
+
+	memcpy(buf, ftdi_mpsse->ibuf + ftdi_mpsse->ibuf_pos, now);
+	ftdi_mpsse->ibuf_pos += now;
+
+	return now;
+}
+
+int ftdi_mpsse_take_error(struct ftdi_mpsse *ftdi_mpsse)
+{
+	int ret = ftdi_mpsse->obuf_error;
+
+	ftdi_mpsse->obuf_error = 0;
+
+	return ret;
+}
+
+/*
+ * Reply descriptors: every command producing a reply records where its bytes
+ * go, in the order the chip will send them. ftdi_mpsse_collect() then reads
+ * all of them at once and scatters the bytes, so writes (ACKs), reads and GPIO
+ * samples can be freely mixed in one command stream.
+ */
+static void ftdi_mpsse_reply_add(struct ftdi_mpsse *ftdi_mpsse,
+				 enum ftdi_mpsse_reply_type type, uint8_t *buf, size_t len)
+{
+	struct ftdi_mpsse_reply *reply;
+
+	/* consecutive reads into one buffer are merged */
+	if (type == MPSSE_REPLY_DATA && ftdi_mpsse->replies_cnt) {
+		reply = &ftdi_mpsse->replies[ftdi_mpsse->replies_cnt - 1];
+		if (reply->type == MPSSE_REPLY_DATA && reply->buf + reply->len == buf) {
+			reply->len += len;
+			goto expect;
+		}
+	}
+
+	if (ftdi_mpsse->replies_cnt >= ftdi_mpsse->replies_size) {
+		unsigned int size = max(ftdi_mpsse->replies_size * 2, 64U);
+
+		reply = realloc(ftdi_mpsse->replies, size * sizeof(*reply));
+		if (!reply) {
+			if (!ftdi_mpsse->obuf_error)
+				ftdi_mpsse->obuf_error =
+					ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+							       "cannot grow replies to %u", size);
+			return;
+		}
+		ftdi_mpsse->replies = reply;
+		ftdi_mpsse->replies_size = size;
+	}
+
+	reply = &ftdi_mpsse->replies[ftdi_mpsse->replies_cnt++];
+	reply->type = type;
+	reply->buf = buf;
+	reply->len = len;
+expect:
+	ftdi_mpsse->reply_bytes += len;
+	ftdi_mpsse_expect(ftdi_mpsse, len);
+}
+
+void ftdi_mpsse_reply_ack(struct ftdi_mpsse *ftdi_mpsse)
+{
+	ftdi_mpsse_reply_add(ftdi_mpsse, MPSSE_REPLY_ACK, NULL, 1);
+}
+
+void ftdi_mpsse_reply_data(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf, size_t len)
+{
+	ftdi_mpsse_reply_add(ftdi_mpsse, MPSSE_REPLY_DATA, buf, len);
+}
+
+void ftdi_mpsse_reply_gpio(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf)
+{
+	ftdi_mpsse_reply_add(ftdi_mpsse, MPSSE_REPLY_GPIO, buf, 1);
+}
+
+/*
+ * Read the replies of all the sent commands in one go. ACK bits are only
+ * counted, the first NACK is remembered in first_nack until reset by
+ * ftdi_mpsse_reset_acks().
+ */
+int ftdi_mpsse_collect(struct ftdi_mpsse *ftdi_mpsse)
+{
+	unsigned int bytes = ftdi_mpsse->reply_bytes;
+	unsigned int cnt = ftdi_mpsse->replies_cnt;
+	const uint8_t *src;
+	int ret;
+
+	if (!cnt)
+		return 0;
+
+	ftdi_mpsse->replies_cnt = 0;
+	ftdi_mpsse->reply_bytes = 0;
+
+	if (bytes > ftdi_mpsse->rbuf_size) {
+		ret = ftdi_mpsse_grow(ftdi_mpsse, &ftdi_mpsse->rbuf, &ftdi_mpsse->rbuf_size,
+				      bytes);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = ftdi_mpsse_read_dev(ftdi_mpsse, ftdi_mpsse->rbuf, bytes, bytes, true);
+	if (ret < 0)
+		return ret;
+
+	src = ftdi_mpsse->rbuf;
+	for (unsigned int a = 0; a < cnt; a++) {
+		const struct ftdi_mpsse_reply *reply = &ftdi_mpsse->replies[a];
+
+		switch (reply->type) {
+		case MPSSE_REPLY_ACK:
+			if (*src & BIT(0)) {
+				ftdi_mpsse->stats.nacks++;
+				if (ftdi_mpsse->first_nack < 0)
+					ftdi_mpsse->first_nack = ftdi_mpsse->acks_seen;
+			}
+			ftdi_mpsse->acks_seen++;
+			break;
+		case MPSSE_REPLY_DATA:
+		case MPSSE_REPLY_GPIO:
+			memcpy(reply->buf, src, reply->len);
+			break;
+		}
+		src += reply->len;
+	}
+
+	if (ftdi_mpsse->debug & MPSSE_DEBUG_ACKS)
+		fprintf(stderr, "%s: %u replies, %u bytes, acks=%u first_nack=%d\n", __func__,
+			cnt, bytes, ftdi_mpsse->acks_seen, ftdi_mpsse->first_nack);
+
+	return 0;
+}
@@ -0,0 +1,383 @@
+/*
+ * Licensed under the GPLv2
+ *
+ * Register map: a host-side cache of device registers on top of the I2C and
+ * SPI primitives. Non-volatile registers are read from the bus only once,
+ * writes of unchanged values are dropped and, in cache-only mode, dirty
+ * registers are written by ftdi_regmap_sync() in as few bursts as possible.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "ftdi_mpsse.h"
+#include "internal.h"
+
+/* internal state kept along the FTDI_REGMAP_* flags of every register */
+#define REG_CACHED	BIT(6)
+#define REG_DIRTY	BIT(7)
+
+int ftdi_regmap_init(struct ftdi_regmap *map, struct ftdi_mpsse *ftdi_mpsse,
+		     const struct ftdi_regmap_config *conf)
+{
+	unsigned int regs = conf->max_register + 1;
+
+	if (conf->val_bits != 8 && conf->val_bits != 16)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "regmap: unsupported val_bits %u", conf->val_bits);
+	if (conf->max_register > 0xff)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "regmap: max_register 0x%x above 8 bits",
+					      conf->max_register);
+
+	memset(map, 0, sizeof(*map));
+	map->ftdi_mpsse = ftdi_mpsse;
+	map->conf = *conf;
+	map->val_bytes = conf->val_bits / 8;
+
+	map->state = calloc(regs, sizeof(*map->state));
+	map->cache = calloc(regs, sizeof(*map->cache));
+	if (!map->state || !map->cache) {
+		ftdi_regmap_exit(map);
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "regmap: cannot allocate");
+	}
+
+	/* the ranges override the default */
+	memset(map->state, FTDI_REGMAP_READABLE | FTDI_REGMAP_WRITABLE, regs);
+
+	for (unsigned int a = 0; a < conf->num_ranges; a++) {
+		const struct ftdi_regmap_range *range = &conf->ranges[a];
+
+		if (range->first > range->last || range->last > conf->max_register) {
+			ftdi_regmap_exit(map);
+			return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+						      "regmap: invalid range 0x%x-0x%x",
+						      range->first, range->last);
+		}
+
+		for (unsigned int reg = range->first; reg <= range->last; reg++)
+			map->state[reg] = range->flags;
+	}
+
+	return 0;
+}
+
+void ftdi_regmap_exit(struct ftdi_regmap *map)
+{
+	free(map->state);
+	map->state = NULL;
+	free(map->cache);
+	map->cache = NULL;
+	free(map->buf);
+	map->buf = NULL;
+	map->buf_size = 0;
+}
+
+static int ftdi_regmap_grow(struct ftdi_regmap *map, size_t size)
+{
+	uint8_t *buf;
+
+	if (size <= map->buf_size)
+		return 0;
+
+	buf = realloc(map->buf, size);
+	if (!buf)
+		return ftdi_mpsse_store_error(map->ftdi_mpsse, -1, false,
+					      "regmap: cannot grow buffer to %zu", size);
+
+	map->buf = buf;
+	map->buf_size = size;
+
+	return 0;
+}
+
+static void ftdi_regmap_put(const struct ftdi_regmap *map, uint8_t *buf, unsigned int val)
+{
+	if (map->val_bytes == 2)
+		*buf++ = val >> 8;
+	*buf = val;
+}
+
+static unsigned int ftdi_regmap_get(const struct ftdi_regmap *map, const uint8_t *buf)
+{
+	if (map->val_bytes == 2)
+		return buf[0] << 8 | buf[1];
+
+	return buf[0];
+}
+
+static int ftdi_regmap_check(struct ftdi_regmap *map, unsigned int reg, unsigned int count,
+			     unsigned int flag)
+{
+	if (!count || reg + count - 1 > map->conf.max_register)
+		return ftdi_mpsse_store_error(map->ftdi_mpsse, -1, false,
+					      "regmap: registers 0x%x+%u out of range", reg,
+					      count);
+
+	for (unsigned int a = reg; a < reg + count; a++)
+		if (!(map->state[a] & flag))
+			return ftdi_mpsse_store_error(map->ftdi_mpsse, -1, false,
+						      "regmap: register 0x%x not %s", a,
+						      flag == FTDI_REGMAP_READABLE ? "readable" :
+						      "writable");
+
+	return 0;
+}
+
+/* Read count values starting at reg into map->buf in one transaction */
+static int ftdi_regmap_bus_read(struct ftdi_regmap *map, unsigned int reg, unsigned int count)
+{
+	struct ftdi_mpsse *ftdi_mpsse = map->ftdi_mpsse;
+	size_t len = count * map->val_bytes;
+	uint8_t addr = reg;
+	int ret;
+
+	ret = ftdi_regmap_grow(map, len);
+	if (ret < 0)
+		return ret;
+
+	if (map->conf.bus == FTDI_REGMAP_I2C) {
+		const struct ftdi_i2c_msg msgs[] = {
+			{ .addr = map->conf.address, .len = 1, .buf = &addr },
+			{ .addr = map->conf.address, .flags = FTDI_I2C_M_RD, .len = len,
+				.buf = map->buf },
+		};
+
+		ret = ftdi_i2c_transfer(ftdi_mpsse, msgs, ARRAY_SIZE(msgs));
+		return ret < 0 ? ret : 0;
+	}
+
+	addr |= map->conf.read_flag_mask;
+
+	ret = ftdi_spi_begin(ftdi_mpsse);
+	if (ret < 0)
+		return ret;
+	ret = ftdi_spi_write(ftdi_mpsse, &addr, 1);
+	if (ret >= 0)
+		ret = ftdi_spi_read(ftdi_mpsse, map->buf, len);
+	if (ret < 0) {
+		ftdi_spi_end(ftdi_mpsse);
+		return ret;
+	}
+
+	return ftdi_spi_end(ftdi_mpsse);
+}
+
+/* Write len bytes of map->buf + off, register address(es) included */
+static int ftdi_regmap_bus_write(struct ftdi_regmap *map, size_t off, size_t len)
+{
+	struct ftdi_mpsse *ftdi_mpsse = map->ftdi_mpsse;
+	int ret;
+
+	if (map->conf.bus == FTDI_REGMAP_I2C) {
+		const struct ftdi_i2c_msg msg = {
+			.addr = map->conf.address, .len = len, .buf = map->buf + off,
+		};
+
+		ret = ftdi_i2c_transfer(ftdi_mpsse, &msg, 1);
+		return ret < 0 ? ret : 0;
+	}
+
+	ret = ftdi_spi_begin(ftdi_mpsse);
+	if (ret < 0)
+		return ret;
+	ret = ftdi_spi_write(ftdi_mpsse, map->buf + off, len);
+	if (ret < 0) {
+		ftdi_spi_end(ftdi_mpsse);
+		return ret;
+	}
+
+	return ftdi_spi_end(ftdi_mpsse);
+}
+
+int ftdi_regmap_bulk_read(struct ftdi_regmap *map, unsigned int reg, unsigned int *vals,
+			  unsigned int count)
+{
+	bool cached = true;
+	int ret;
+
+	ret = ftdi_regmap_check(map, reg, count, FTDI_REGMAP_READABLE);
+	if (ret < 0)
+		return ret;
+
+	for (unsigned int a = reg; a < reg + count; a++)
+		if ((map->state[a] & FTDI_REGMAP_VOLATILE) || !(map->state[a] & REG_CACHED))
+			cached = false;
+
+	if (cached) {
+		memcpy(vals, &map->cache[reg], count * sizeof(*vals));
+		return 0;
+	}
+
+	if (map->cache_only)
+		return ftdi_mpsse_store_error(map->ftdi_mpsse, -1, false,
+					      "regmap: 0x%x+%u not cached in cache-only mode",
+					      reg, count);
+
+	ret = ftdi_regmap_bus_read(map, reg, count);
+	if (ret < 0)
+		return ret;
+
+	for (unsigned int a = 0; a < count; a++) {
+		uint8_t *state = &map->state[reg + a];
+
+		vals[a] = ftdi_regmap_get(map, map->buf + a * map->val_bytes);
+
+		/* a dirty value is newer than what the device has */
+		if (*state & REG_DIRTY) {
+			vals[a] = map->cache[reg + a];
+		} else if (!(*state & FTDI_REGMAP_VOLATILE)) {
+			map->cache[reg + a] = vals[a];
+			*state |= REG_CACHED;
+		}
+	}
+
+	return 0;
+}
+
+int ftdi_regmap_read(struct ftdi_regmap *map, unsigned int reg, unsigned int *val)
+{
+	return ftdi_regmap_bulk_read(map, reg, val, 1);
+}
+
+int ftdi_regmap_write(struct ftdi_regmap *map, unsigned int reg, unsigned int val)
+{
+	uint8_t *state;
+	int ret;
+
+	ret = ftdi_regmap_check(map, reg, 1, FTDI_REGMAP_WRITABLE);
+	if (ret < 0)
+		return ret;
+
+	state = &map->state[reg];
+	val &= (1U << map->conf.val_bits) - 1;
+
+	if (!(*state & FTDI_REGMAP_VOLATILE)) {
+		if ((*state & REG_CACHED) && map->cache[reg] == val)
+			return 0;
+
+		if (map->cache_only) {
+			map->cache[reg] = val;
+			*state |= REG_CACHED | REG_DIRTY;
+			return 0;
+		}
+	}
+
+	ret = ftdi_regmap_grow(map, 1 + map->val_bytes);
+	if (ret < 0)
+		return ret;
+
+	map->buf[0] = reg | map->conf.write_flag_mask;
+	ftdi_regmap_put(map, map->buf + 1, val);
+
+	ret = ftdi_regmap_bus_write(map, 0, 1 + map->val_bytes);
+	if (ret < 0)
+		return ret;
+
+	if (!(*state & FTDI_REGMAP_VOLATILE)) {
+		map->cache[reg] = val;
+		*state = (*state | REG_CACHED) & ~REG_DIRTY;
+	}
+
+	return 0;
+}
+
+int ftdi_regmap_update_bits(struct ftdi_regmap *map, unsigned int reg, unsigned int mask,
+			    unsigned int val)
+{
+	unsigned int old;
+	int ret;
+
+	ret = ftdi_regmap_read(map, reg, &old);
+	if (ret < 0)
+		return ret;
+
+	return ftdi_regmap_write(map, reg, (old & ~mask) | (val & mask));
+}
+
+void ftdi_regmap_cache_only(struct ftdi_regmap *map, bool enable)
+{
+	map->cache_only = enable;
+}
+
+void ftdi_regmap_cache_drop(struct ftdi_regmap *map)
+{
+	for (unsigned int reg = 0; reg <= map->conf.max_register; reg++)
+		map->state[reg] &= ~(REG_CACHED | REG_DIRTY);
+}
+
+/*
+ * Dirty registers are written as runs of consecutive registers (one register
+ * address and the values), or as (register, value) pairs with write_pairs.
+ * On I2C, all the runs go in one transfer joined by repeated STARTs.
+ */
+int ftdi_regmap_sync(struct ftdi_regmap *map)
+{
+	unsigned int max = map->conf.max_register;
+	unsigned int vb = map->val_bytes;
+	struct ftdi_i2c_msg *msgs = NULL;
+	unsigned int runs = 0, run_start = 0, dirty = 0;
+	size_t len = 0;
+	int ret = 0;
+
+	for (unsigned int reg = 0; reg <= max; reg++)
+		dirty += !!(map->state[reg] & REG_DIRTY);
+	if (!dirty)
+		return 0;
+
+	/* the worst case, a pair for every dirty register, so buf does not move below */
+	ret = ftdi_regmap_grow(map, dirty * (1 + vb));
+	if (ret < 0)
+		return ret;
+
+	msgs = calloc(dirty, sizeof(*msgs));
+	if (!msgs)
+		return ftdi_mpsse_store_error(map->ftdi_mpsse, -1, false,
+					      "regmap: cannot allocate messages");
+
+	for (unsigned int reg = 0; reg <= max; reg++) {
+		if (!(map->state[reg] & REG_DIRTY))
+			continue;
+
+		if (map->conf.write_pairs) {
+			map->buf[len++] = reg | map->conf.write_flag_mask;
+		} else if (!reg || !(map->state[reg - 1] & REG_DIRTY)) {
+			/* a new run: close the previous one */
+			if (len) {
+				msgs[runs].buf = map->buf + run_start;
+				msgs[runs++].len = len - run_start;
+			}
+			run_start = len;
+			map->buf[len++] = reg | map->conf.write_flag_mask;
+		}
+
+		ftdi_regmap_put(map, map->buf + len, map->cache[reg]);
+		len += vb;
+	}
+
+	if (len) {
+		msgs[runs].buf = map->buf + run_start;
+		msgs[runs++].len = len - run_start;
+	}
+
+	for (unsigned int a = 0; a < runs; a++)
+		msgs[a].addr = map->conf.address;
+
+	if (map->conf.bus == FTDI_REGMAP_I2C) {
+		ret = ftdi_i2c_transfer(map->ftdi_mpsse, msgs, runs);
+		if (ret < 0)
+			goto out;
+	} else {
+		for (unsigned int a = 0; a < runs; a++) {
+			ret = ftdi_regmap_bus_write(map, msgs[a].buf - map->buf, msgs[a].len);
+			if (ret < 0)
+				goto out;
+		}
+	}
+
+	ret = 0;
+	for (unsigned int reg = 0; reg <= max; reg++)
+		map->state[reg] &= ~REG_DIRTY;
+out:
+	free(msgs);
+	return ret;
+}
@@ -37,12 +37,12 @@ int ftdi_spi_init(struct ftdi_mpsse *ftdi_mpsse,
 	if (ret < 0)
 		return ret;
 
-	usleep(50000);
+	if (!ftdi_mpsse->warm)
+		usleep(50000);
 
-	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_CLK_DIV5_DIS);
-	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_CLK_ADAPTIVE_DIS);
-	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_CLK_3PHASE_DIS);
-	if (ftdi_mpsse->ftdic.type == TYPE_232H) {
+	if (ftdi_mpsse->caps->h_series)
+		ftdi_mpsse_enqueue(ftdi_mpsse, CMD_CLK_ADAPTIVE_DIS);
+	if (ftdi_mpsse->caps->drive_zero) {
 		ftdi_mpsse_enqueue(ftdi_mpsse, CMD_DRIVE_ONLY_ZERO);
 		ftdi_mpsse_enqueue(ftdi_mpsse, 0x00);
 		ftdi_mpsse_enqueue(ftdi_mpsse, 0x00);
@@ -50,13 +50,15 @@ int ftdi_spi_init(struct ftdi_mpsse *ftdi_mpsse,
 
 	ret = ftdi_mpsse_flush(ftdi_mpsse);
 	if (ret <= 0) {
-		ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "cannot flush (3PHASE)");
+		ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "cannot flush (SETUP)");
 		goto close;
 	}
 
 	ftdi_spi_set_pins(ftdi_mpsse, true);
 
-	ftdi_mpsse_set_speed(ftdi_mpsse, conf->speed, false);
+	ret = ftdi_mpsse_set_speed(ftdi_mpsse, conf->speed, conf->clock_mode, false);
+	if (ret < 0)
+		goto close;
 
 	ftdi_mpsse_enqueue(ftdi_mpsse, CMD_LOOPBACK_DIS);
 
@@ -66,6 +68,8 @@ int ftdi_spi_init(struct ftdi_mpsse *ftdi_mpsse,
 		goto close;
 	}
 
+	ftdi_mpsse_init_done(ftdi_mpsse);
+
 	return 0;
 
 close:
@@ -73,53 +77,318 @@ close:
 	return ret;
 }
 
-static int __ftdi_spi_sendrecv(struct ftdi_mpsse *ftdi_mpsse, uint8_t *c, uint8_t rw)
+#define SPI_CMD_MAX_LEN		0x10000U
+
+/*
+ * One byte-mode command carries up to 64 KiB, but keep what is in flight within
+ * the chip's buffers. The TX window leaves some room for CS toggling.
+ */
+static unsigned int ftdi_spi_tx_window(const struct ftdi_mpsse *ftdi_mpsse)
+{
+	return ftdi_mpsse->caps->tx_bufsize - 16;
+}
+
+static unsigned int ftdi_spi_rx_window(const struct ftdi_mpsse *ftdi_mpsse)
+{
+	return ftdi_mpsse->caps->rx_bufsize;
+}
+
+static void ftdi_spi_enqueue_xfer(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *tx, bool rx,
+				  size_t len)
 {
 	unsigned int rise_fall = 0;
+	uint8_t rw = 0;
 
-	if (rw & CMD_IN)
+	if (rx) {
 		rise_fall |= CMD_IN_RISING;
-	if (rw & CMD_OUT)
+		rw |= CMD_IN;
+	}
+	if (tx) {
 		rise_fall |= CMD_OUT_FALLING;
+		rw |= CMD_OUT;
+	}
+
+	/* len = 0 means 1 byte */
+	ftdi_mpsse_enqueue(ftdi_mpsse, CMD(rise_fall, CMD_BYTE, CMD_MSB, rw));
+	ftdi_mpsse_enqueue(ftdi_mpsse, (len - 1) & 0xff);
+	ftdi_mpsse_enqueue(ftdi_mpsse, (len - 1) >> 8);
+	if (tx)
+		ftdi_mpsse_enqueue_buf(ftdi_mpsse, tx, len);
+}
+
+/* How many bytes can be queued before the command stream has to be sent */
+static size_t ftdi_spi_room(const struct ftdi_mpsse *ftdi_mpsse, bool tx, bool rx)
+{
+	unsigned int tx_window = ftdi_spi_tx_window(ftdi_mpsse);
+	size_t room = SPI_CMD_MAX_LEN;
+
+	/* 3 bytes of the command itself */
+	if (ftdi_mpsse->obuf_cnt + 3 >= tx_window)
+		return 0;
+	if (tx)
+		room = min(room, tx_window - ftdi_mpsse->obuf_cnt - 3);
+
+	if (rx) {
+		if (ftdi_mpsse->reply_bytes >= ftdi_spi_rx_window(ftdi_mpsse))
+			return 0;
+		room = min(room, ftdi_spi_rx_window(ftdi_mpsse) - ftdi_mpsse->reply_bytes);
+	}
+
+	return room;
+}
+
+/*
+ * Send the queued commands and collect all the replies. One SEND_IMMEDIATE and
+ * one read per call, the data are scattered to the buffers queued by the reads.
+ */
+static int ftdi_spi_sync(struct ftdi_mpsse *ftdi_mpsse)
+{
+	int ret;
+
+	if (ftdi_mpsse->replies_cnt)
+		ftdi_mpsse_enqueue(ftdi_mpsse, CMD_SEND_IMMEDIATE);
 
+	if (ftdi_mpsse->obuf_cnt) {
+		ret = ftdi_mpsse_flush(ftdi_mpsse);
+		if (ret < 0) {
+			ftdi_mpsse_drop_replies(ftdi_mpsse);
+			return ret;
+		}
+	}
+
+	return ftdi_mpsse_collect(ftdi_mpsse);
+}
+
+/*
+ * Assert CS and start queueing. Transfers up to ftdi_spi_end() are merged into
+ * one command stream, received data are valid only after ftdi_spi_end(). Reads
+ * longer than the chip's RX buffer are streamed and valid on return. A failed
+ * transfer deasserts CS and ends the transaction.
+ */
+int ftdi_spi_begin(struct ftdi_mpsse *ftdi_mpsse)
+{
+	if (ftdi_mpsse->spi.in_xfer)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "%s: transaction already started", __func__);
+
+	ftdi_mpsse->spi.in_xfer = true;
 	ftdi_spi_set_pins(ftdi_mpsse, false);
 
-	ftdi_mpsse_enqueue(ftdi_mpsse, CMD(rise_fall, CMD_BIT, CMD_MSB, rw));
-	ftdi_mpsse_enqueue(ftdi_mpsse, 0x07);
-	if (rw & CMD_OUT)
-		ftdi_mpsse_enqueue(ftdi_mpsse, *c);
+	return 0;
+}
+
+int ftdi_spi_end(struct ftdi_mpsse *ftdi_mpsse)
+{
+	if (!ftdi_mpsse->spi.in_xfer)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "%s: no transaction started", __func__);
 
+	ftdi_mpsse->spi.in_xfer = false;
 	ftdi_spi_set_pins(ftdi_mpsse, true);
 
-	if (rw & CMD_IN)
-		ftdi_mpsse_enqueue(ftdi_mpsse, CMD_SEND_IMMEDIATE);
+	if (ftdi_mpsse->spi.posted)
+		return 0;
+
+	return ftdi_spi_sync(ftdi_mpsse);
+}
+
+void ftdi_spi_set_posted(struct ftdi_mpsse *ftdi_mpsse, bool posted)
+{
+	ftdi_mpsse->spi.posted = posted;
+}
+
+int ftdi_spi_commit(struct ftdi_mpsse *ftdi_mpsse)
+{
+	if (ftdi_mpsse->spi.in_xfer)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "%s: transaction not ended", __func__);
+
+	return ftdi_spi_sync(ftdi_mpsse);
+}
+
+int ftdi_spi_delay(struct ftdi_mpsse *ftdi_mpsse, unsigned int ns)
+{
+	static const uint8_t zeros[64];
+	uint64_t bytes = div_round_up((uint64_t)ns * ftdi_mpsse->speed, 8 * 1000000000ULL);
+
+	if (ftdi_mpsse->spi.in_xfer)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "%s: inside a transaction", __func__);
+
+	while (bytes) {
+		/* clocks without data where the chip has them, dummy bytes otherwise */
+		if (ftdi_mpsse->caps->h_series) {
+			unsigned int now = min(bytes, (uint64_t)SPI_CMD_MAX_LEN);
+
+			ftdi_mpsse_enqueue(ftdi_mpsse, CMD_CLK_BYTES);
+			ftdi_mpsse_enqueue(ftdi_mpsse, (now - 1) & 0xff);
+			ftdi_mpsse_enqueue(ftdi_mpsse, (now - 1) >> 8);
+			bytes -= now;
+		} else {
+			unsigned int now = min(bytes, (uint64_t)sizeof(zeros));
+
+			ftdi_spi_enqueue_xfer(ftdi_mpsse, zeros, false, now);
+			bytes -= now;
+		}
+	}
+
+	return 0;
+}
+
+static int ftdi_spi_queue(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *tx, uint8_t *rx,
+			  size_t len)
+{
+	int ret;
+
+	while (len) {
+		size_t now = ftdi_spi_room(ftdi_mpsse, tx, rx);
+
+		if (!now) {
+			ftdi_mpsse->stats.forced_flushes++;
+			/* mostly writes: send them, the few replies stay in the chip */
+			if (ftdi_mpsse->obuf_cnt + 3 >= ftdi_spi_tx_window(ftdi_mpsse) &&
+			    ftdi_mpsse->reply_bytes < ftdi_spi_rx_window(ftdi_mpsse) / 2)
+				ret = ftdi_mpsse_flush(ftdi_mpsse);
+			else
+				ret = ftdi_spi_sync(ftdi_mpsse);
+			if (ret < 0)
+				return ret;
+			continue;
+		}
+
+		now = min(now, len);
+		ftdi_spi_enqueue_xfer(ftdi_mpsse, tx, rx, now);
+
+		if (rx) {
+			ftdi_mpsse_reply_data(ftdi_mpsse, rx, now);
+			rx += now;
+		}
+		if (tx)
+			tx += now;
+		len -= now;
+	}
+
+	return 0;
+}
 
-	int ret = ftdi_mpsse_flush(ftdi_mpsse);
+/* RX windows requested from the chip ahead of the one being read */
+#define SPI_STREAM_DEPTH	4U
+
+/*
+ * Long reads: instead of a round trip per RX window, keep several windows
+ * requested so the chip clocks on while the previous ones are read, the data
+ * go straight to the buffer and are valid on return.
+ */
+static int ftdi_spi_stream(struct ftdi_mpsse *ftdi_mpsse, uint8_t *rx, size_t len)
+{
+	unsigned int window = ftdi_spi_rx_window(ftdi_mpsse);
+	size_t requested = 0, done = 0;
+	int ret;
+
+	/* replies queued before come first */
+	ret = ftdi_spi_sync(ftdi_mpsse);
 	if (ret < 0)
 		return ret;
 
-	if (rw & CMD_IN) {
-		ret = ftdi_mpsse_read_dev(ftdi_mpsse, c, 1, 1, true);
+	while (done < len) {
+		size_t now;
+
+		/* top up the requests, one USB write for all of them */
+		if (requested < len && requested - done < SPI_STREAM_DEPTH * window) {
+			do {
+				now = min(len - requested, (size_t)window);
+				ftdi_spi_enqueue_xfer(ftdi_mpsse, NULL, true, now);
+				ftdi_mpsse_expect(ftdi_mpsse, now);
+				requested += now;
+			} while (requested < len && requested - done < SPI_STREAM_DEPTH * window);
+			ftdi_mpsse_enqueue(ftdi_mpsse, CMD_SEND_IMMEDIATE);
+
+			ret = ftdi_mpsse_flush(ftdi_mpsse);
+			if (ret < 0)
+				return ret;
+		}
+
+		now = min(len - done, (size_t)window);
+		ret = ftdi_mpsse_read_dev(ftdi_mpsse, rx + done, now, now, true);
 		if (ret < 0)
 			return ret;
+		done += now;
 	}
 
 	return 0;
 }
 
+/* A failed transfer ends the transaction: CS is deasserted and the chip resynced */
+static int ftdi_spi_queue_or_stream(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *tx,
+				    uint8_t *rx, size_t len)
+{
+	int ret;
+
+	if (!tx && len > ftdi_spi_rx_window(ftdi_mpsse))
+		ret = ftdi_spi_stream(ftdi_mpsse, rx, len);
+	else
+		ret = ftdi_spi_queue(ftdi_mpsse, tx, rx, len);
+
+	if (ret < 0) {
+		ftdi_spi_set_pins(ftdi_mpsse, true);
+		ftdi_mpsse->spi.in_xfer = false;
+		ftdi_mpsse_recover(ftdi_mpsse);
+	}
+
+	return ret;
+}
+
+static int __ftdi_spi_transfer(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *tx, uint8_t *rx,
+			       size_t len)
+{
+	int ret;
+
+	if (!len)
+		return 0;
+
+	if (ftdi_mpsse->spi.in_xfer)
+		return ftdi_spi_queue_or_stream(ftdi_mpsse, tx, rx, len);
+
+	ret = ftdi_spi_begin(ftdi_mpsse);
+	if (ret < 0)
+		return ret;
+
+	ret = ftdi_spi_queue_or_stream(ftdi_mpsse, tx, rx, len);
+	if (ret < 0)
+		return ret;
+
+	return ftdi_spi_end(ftdi_mpsse);
+}
+
+int ftdi_spi_transfer(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *tx, uint8_t *rx,
+		      size_t len)
+{
+	return __ftdi_spi_transfer(ftdi_mpsse, tx, rx, len);
+}
+
+int ftdi_spi_write(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *buf, size_t len)
+{
+	return __ftdi_spi_transfer(ftdi_mpsse, buf, NULL, len);
+}
+
+int ftdi_spi_read(struct ftdi_mpsse *ftdi_mpsse, uint8_t *buf, size_t len)
+{
+	return __ftdi_spi_transfer(ftdi_mpsse, NULL, buf, len);
+}
+
 int ftdi_spi_sendrecv(struct ftdi_mpsse *ftdi_mpsse, uint8_t *c)
 {
-	return __ftdi_spi_sendrecv(ftdi_mpsse, c, CMD_IN | CMD_OUT);
+	return __ftdi_spi_transfer(ftdi_mpsse, c, c, 1);
 }
 
 int ftdi_spi_recv(struct ftdi_mpsse *ftdi_mpsse, uint8_t *c)
 {
-	return __ftdi_spi_sendrecv(ftdi_mpsse, c, CMD_IN);
+	return __ftdi_spi_transfer(ftdi_mpsse, NULL, c, 1);
 }
 
 int ftdi_spi_send(struct ftdi_mpsse *ftdi_mpsse, uint8_t c)
 {
-	return __ftdi_spi_sendrecv(ftdi_mpsse, &c, CMD_OUT);
+	return __ftdi_spi_transfer(ftdi_mpsse, &c, NULL, 1);
 }
 
 void ftdi_spi_close(struct ftdi_mpsse *ftdi_mpsse)
@@ -0,0 +1,383 @@
+/*
+ * Licensed under the GPLv2
+ *
+ * SPI NOR flash on top of the SPI primitives, 25-series command set.
+ */
+#include <errno.h>
+#include <stdlib.h>
+
+#include "ftdi_mpsse.h"
+#include "internal.h"
+
+#define SPINOR_OP_WREN		0x06
+#define SPINOR_OP_RDSR		0x05
+#define SPINOR_OP_PP		0x02
+#define SPINOR_OP_BE_4K		0x20
+#define SPINOR_OP_BE_32K	0x52
+#define SPINOR_OP_SE		0xd8
+#define SPINOR_OP_RDID		0x9f
+#define SPINOR_OP_READ_FAST	0x0b
+
+#define SR_WIP			BIT(0)
+
+#define SPIFLASH_PAGE_SIZE	256U
+/* pages queued per round trip */
+#define SPIFLASH_BATCH		8U
+/* status polls are spaced by idle clocks, so a page needs only a few */
+#define SPIFLASH_PP_GAP_NS	20000U
+#define SPIFLASH_PP_POLLS	16U
+#define SPIFLASH_PP_MAX_POLLS	256U
+/* typical sector and block erases take 45..150 ms */
+#define SPIFLASH_ERASE_GAP_NS	1000000U
+#define SPIFLASH_ERASE_POLLS	32U
+/* 10 s, chip erases are not used */
+#define SPIFLASH_ERASE_BATCHES	(10000 / 32)
+
+int ftdi_spiflash_read_id(struct ftdi_mpsse *ftdi_mpsse, uint32_t *jedec_id)
+{
+	uint8_t buf[4] = { SPINOR_OP_RDID };
+	int ret;
+
+	ret = ftdi_spi_transfer(ftdi_mpsse, buf, buf, sizeof(buf));
+	if (ret < 0)
+		return ret;
+
+	*jedec_id = buf[1] << 16 | buf[2] << 8 | buf[3];
+
+	return 0;
+}
+
+unsigned int ftdi_spiflash_size(uint32_t jedec_id)
+{
+	unsigned int capacity = jedec_id & 0xff;
+
+	/* no flash (MISO floating high or stuck low) */
+	if (jedec_id == 0xffffff || !jedec_id)
+		return 0;
+	if (capacity < 10 || capacity > 24)
+		return 0;
+
+	return 1U << capacity;
+}
+
+int ftdi_spiflash_read(struct ftdi_mpsse *ftdi_mpsse, uint32_t addr, uint8_t *buf,
+		       size_t len)
+{
+	/* the address and a dummy byte */
+	uint8_t cmd[5] = { SPINOR_OP_READ_FAST, addr >> 16, addr >> 8, addr };
+	int ret;
+
+	if (addr > FTDI_SPIFLASH_MAX_SIZE || len > FTDI_SPIFLASH_MAX_SIZE - addr)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+					      "%s: 0x%x+0x%zx beyond 3-byte addressing",
+					      __func__, addr, len);
+
+	ret = ftdi_spi_begin(ftdi_mpsse);
+	if (ret < 0)
+		return ret;
+
+	ret = ftdi_spi_write(ftdi_mpsse, cmd, sizeof(cmd));
+	if (ret >= 0)
+		ret = ftdi_spi_read(ftdi_mpsse, buf, len);
+	/* a failed transfer has already ended the transaction */
+	if (ret < 0)
+		return ret;
+
+	return ftdi_spi_end(ftdi_mpsse);
+}
+
+/* Queue a transaction, its data are valid after ftdi_spi_commit() */
+static int ftdi_spiflash_enqueue(struct ftdi_mpsse *ftdi_mpsse, const uint8_t *cmd, size_t len,
+				 const uint8_t *data, size_t data_len, uint8_t *rx, size_t rx_len)
+{
+	int ret;
+
+	ret = ftdi_spi_begin(ftdi_mpsse);
+	if (ret < 0)
+		return ret;
+
+	ret = ftdi_spi_write(ftdi_mpsse, cmd, len);
+	if (ret >= 0 && data_len)
+		ret = ftdi_spi_write(ftdi_mpsse, data, data_len);
+	if (ret >= 0 && rx_len)
+		ret = ftdi_spi_read(ftdi_mpsse, rx, rx_len);
+	/* a failed transfer has already ended the transaction */
+	if (ret < 0)
+		return ret;
+
+	return ftdi_spi_end(ftdi_mpsse);
+}
+
+static int ftdi_spiflash_enqueue_rdsr(struct ftdi_mpsse *ftdi_mpsse, uint8_t *status)
+{
+	static const uint8_t rdsr = SPINOR_OP_RDSR;
+
+	return ftdi_spiflash_enqueue(ftdi_mpsse, &rdsr, 1, NULL, 0, status, 1);
+}
+
+static int ftdi_spiflash_enqueue_wren(struct ftdi_mpsse *ftdi_mpsse)
+{
+	static const uint8_t wren = SPINOR_OP_WREN;
+
+	return ftdi_spiflash_enqueue(ftdi_mpsse, &wren, 1, NULL, 0, NULL, 0);
+}
+
+/* index of the first status without WIP, polls if still busy */
+static unsigned int ftdi_spiflash_first_ready(const uint8_t *status, unsigned int polls)
+{
+	unsigned int a;
+
+	for (a = 0; a < polls; a++)
+		if (!(status[a] & SR_WIP))
+			break;
+
+	return a;
+}
+
+/*
+ * Queue batches of status polls spaced by gap_ns until the flash is ready,
+ * one round trip per batch.
+ */
+static int ftdi_spiflash_wait(struct ftdi_mpsse *ftdi_mpsse, unsigned int gap_ns,
+			      unsigned int polls, unsigned int max_batches)
+{
+	uint8_t status[SPIFLASH_PP_MAX_POLLS];
+	int ret;
+
+	polls = min(polls, (unsigned int)sizeof(status));
+
+	for (unsigned int batch = 0; batch < max_batches; batch++) {
+		ret = 0;
+		for (unsigned int a = 0; a < polls && ret >= 0; a++) {
+			if (a)
+				ret = ftdi_spi_delay(ftdi_mpsse, gap_ns);
+			if (ret >= 0)
+				ret = ftdi_spiflash_enqueue_rdsr(ftdi_mpsse, &status[a]);
+		}
+
+		if (ret >= 0)
+			ret = ftdi_spi_commit(ftdi_mpsse);
+		if (ret < 0)
+			return ret;
+
+		if (ftdi_spiflash_first_ready(status, polls) < polls)
+			return 0;
+	}
+
+	return ftdi_mpsse_store_error(ftdi_mpsse, -ETIMEDOUT, false,
+				      "spiflash: still busy after %u polls", polls * max_batches);
+}
+
+static int ftdi_spiflash_erase_one(struct ftdi_mpsse *ftdi_mpsse, uint8_t op, uint32_t addr)
+{
+	const uint8_t cmd[4] = { op, addr >> 16, addr >> 8, addr };
+	int ret;
+
+	ret = ftdi_spiflash_enqueue_wren(ftdi_mpsse);
+	if (ret >= 0)
+		ret = ftdi_spiflash_enqueue(ftdi_mpsse, cmd, sizeof(cmd), NULL, 0, NULL, 0);
+	if (ret < 0)
+		return ret;
+
+	/* the first polls go out along with the erase */
+	return ftdi_spiflash_wait(ftdi_mpsse, SPIFLASH_ERASE_GAP_NS, SPIFLASH_ERASE_POLLS,
+				  SPIFLASH_ERASE_BATCHES);
+}
+
+int ftdi_spiflash_erase(struct ftdi_mpsse *ftdi_mpsse, uint32_t addr, size_t len)
+{
+	bool posted = ftdi_mpsse->spi.posted;
+	int ret = 0;
+
+	if (addr % 0x1000 || len % 0x1000 || addr > FTDI_SPIFLASH_MAX_SIZE ||
+	    len > FTDI_SPIFLASH_MAX_SIZE - addr)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -EINVAL, false,
+					      "%s: 0x%x+0x%zx not in 4 KiB sectors", __func__,
+					      addr, len);
+
+	ftdi_spi_set_posted(ftdi_mpsse, true);
+
+	/* the largest erase fitting the alignment and what is left */
+	while (len && ret >= 0) {
+		uint32_t size = 0x1000;
+		uint8_t op = SPINOR_OP_BE_4K;
+
+		if (!(addr % 0x10000) && len >= 0x10000) {
+			size = 0x10000;
+			op = SPINOR_OP_SE;
+		} else if (!(addr % 0x8000) && len >= 0x8000) {
+			size = 0x8000;
+			op = SPINOR_OP_BE_32K;
+		}
+
+		ret = ftdi_spiflash_erase_one(ftdi_mpsse, op, addr);
+		addr += size;
+		len -= size;
+	}
+
+	ftdi_spi_set_posted(ftdi_mpsse, posted);
+
+	return ret < 0 ? ret : 0;
+}
+
+struct ftdi_spiflash_page {
+	uint32_t addr;
+	const uint8_t *data;
+	unsigned int len;
+	bool done;
+};
+
+/*
+ * Page programs are queued speculatively, SPIFLASH_BATCH pages with their
+ * status polls per round trip. A flash still busy ignores WREN and PAGE
+ * PROGRAM, so a page took effect only if the last poll before it saw the
+ * flash ready. The others are queued again with more polls.
+ */
+int ftdi_spiflash_write(struct ftdi_mpsse *ftdi_mpsse, uint32_t addr, const uint8_t *buf,
+			size_t len)
+{
+	/* the polls of the pages in flight, by their slot in the batch */
+	uint8_t status[SPIFLASH_BATCH][SPIFLASH_PP_MAX_POLLS];
+	struct ftdi_spiflash_page *pages;
+	unsigned int num = 0, first = 0, polls = SPIFLASH_PP_POLLS;
+	bool posted = ftdi_mpsse->spi.posted;
+	uint8_t ready;
+	int ret;
+
+	if (addr > FTDI_SPIFLASH_MAX_SIZE || len > FTDI_SPIFLASH_MAX_SIZE - addr)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -EINVAL, false,
+					      "%s: 0x%x+0x%zx beyond 3-byte addressing",
+					      __func__, addr, len);
+	if (!len)
+		return 0;
+
+	pages = calloc(div_round_up(len, SPIFLASH_PAGE_SIZE), sizeof(*pages));
+	if (!pages)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -ENOMEM, false,
+					      "%s: cannot allocate", __func__);
+
+	/* programs wrap within a page, split at the page boundaries */
+	while (len) {
+		unsigned int now = min(len, (size_t)(SPIFLASH_PAGE_SIZE - addr % SPIFLASH_PAGE_SIZE));
+
+		pages[num].addr = addr;
+		pages[num].data = buf;
+		pages[num].len = now;
+		num++;
+		addr += now;
+		buf += now;
+		len -= now;
+	}
+
+	ftdi_spi_set_posted(ftdi_mpsse, true);
+
+	/* e.g. an erase or a program before us */
+	ret = ftdi_spiflash_enqueue_rdsr(ftdi_mpsse, &ready);
+	if (ret >= 0)
+		ret = ftdi_spi_commit(ftdi_mpsse);
+	if (ret < 0)
+		goto out;
+	if (ready & SR_WIP) {
+		ret = ftdi_spiflash_wait(ftdi_mpsse, SPIFLASH_PP_GAP_NS, SPIFLASH_PP_MAX_POLLS, 100);
+		if (ret < 0)
+			goto out;
+	}
+
+	while (first < num) {
+		unsigned int queued = 0, slowest = 0;
+		bool idle = true;
+
+		ret = 0;
+		for (unsigned int a = first; a < num && queued < SPIFLASH_BATCH && ret >= 0; a++) {
+			struct ftdi_spiflash_page *page = &pages[a];
+			const uint8_t cmd[4] = { SPINOR_OP_PP, page->addr >> 16, page->addr >> 8,
+						 page->addr };
+
+			if (page->done)
+				continue;
+
+			ret = ftdi_spiflash_enqueue_wren(ftdi_mpsse);
+			if (ret >= 0)
+				ret = ftdi_spiflash_enqueue(ftdi_mpsse, cmd, sizeof(cmd), page->data,
+							    page->len, NULL, 0);
+			for (unsigned int p = 0; p < polls && ret >= 0; p++) {
+				ret = ftdi_spi_delay(ftdi_mpsse, SPIFLASH_PP_GAP_NS);
+				if (ret >= 0)
+					ret = ftdi_spiflash_enqueue_rdsr(ftdi_mpsse, &status[queued][p]);
+			}
+			queued++;
+		}
+
+		if (ret >= 0)
+			ret = ftdi_spi_commit(ftdi_mpsse);
+		if (ret < 0)
+			goto out;
+
+		/* walk the batch in the order the flash saw it */
+		for (unsigned int a = first, seen = 0; a < num && seen < queued; a++) {
+			struct ftdi_spiflash_page *page = &pages[a];
+			unsigned int ready_at;
+
+			if (page->done)
+				continue;
+
+			ready_at = ftdi_spiflash_first_ready(status[seen++], polls);
+			if (idle) {
+				page->done = true;
+				slowest = max(slowest, ready_at + 1);
+			}
+			idle = ready_at < polls;
+		}
+
+		while (first < num && pages[first].done)
+			first++;
+
+		/* a page outlasted its polls, the next ones were lost: poll longer */
+		if (slowest > polls)
+			polls = min(2 * polls, SPIFLASH_PP_MAX_POLLS);
+		else if (slowest && slowest + 2 < polls)
+			polls = slowest + 2;
+
+		if (!idle) {
+			ret = ftdi_spiflash_wait(ftdi_mpsse, SPIFLASH_PP_GAP_NS,
+						 SPIFLASH_PP_MAX_POLLS, 100);
+			if (ret < 0)
+				goto out;
+		}
+	}
+
+	ret = 0;
+out:
+	ftdi_spi_set_posted(ftdi_mpsse, posted);
+	free(pages);
+
+	return ret;
+}
+
+int ftdi_spiflash_verify(struct ftdi_mpsse *ftdi_mpsse, uint32_t addr, const uint8_t *buf,
+			 size_t len)
+{
+	uint8_t *readback;
+	int ret;
+
+	readback = malloc(len ? len : 1);
+	if (!readback)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -ENOMEM, false,
+					      "%s: cannot allocate", __func__);
+
+	ret = ftdi_spiflash_read(ftdi_mpsse, addr, readback, len);
+	if (ret >= 0) {
+		for (size_t a = 0; a < len; a++) {
+			if (readback[a] == buf[a])
+				continue;
+			ret = ftdi_mpsse_store_error(ftdi_mpsse, -EIO, false,
+						     "spiflash: mismatch at 0x%zx: 0x%02x != 0x%02x",
+						     addr + a, readback[a], buf[a]);
+			break;
+		}
+	}
+
+	free(readback);
+
+	return ret < 0 ? ret : 0;
+}
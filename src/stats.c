@@ -0,0 +1,61 @@
+/*
+ * Licensed under the GPLv2
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "internal.h"
+
+void ftdi_mpsse_stats_rtt(struct ftdi_mpsse *ftdi_mpsse)
+{
+	struct ftdi_mpsse_stats *stats = &ftdi_mpsse->stats;
+	uint64_t ns = ftdi_mpsse_now_ns() - ftdi_mpsse->rtt_start_ns;
+	uint64_t us = ns / 1000;
+	unsigned int bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+	ftdi_mpsse->rtt_start_ns = 0;
+	stats->round_trips++;
+	stats->rtt_total_ns += ns;
+	stats->rtt_max_ns = max(stats->rtt_max_ns, ns);
+	stats->rtt_hist[min(bucket, FTDI_MPSSE_RTT_BUCKETS - 1)]++;
+}
+
+void ftdi_mpsse_get_stats(const struct ftdi_mpsse *ftdi_mpsse, struct ftdi_mpsse_stats *stats)
+{
+	*stats = ftdi_mpsse->stats;
+}
+
+void ftdi_mpsse_reset_stats(struct ftdi_mpsse *ftdi_mpsse)
+{
+	memset(&ftdi_mpsse->stats, 0, sizeof(ftdi_mpsse->stats));
+}
+
+void ftdi_mpsse_print_stats(const struct ftdi_mpsse *ftdi_mpsse, FILE *f)
+{
+	const struct ftdi_mpsse_stats *stats = &ftdi_mpsse->stats;
+
+	fprintf(f, "usb: %" PRIu64 " writes (%" PRIu64 " B), %" PRIu64 " reads (%" PRIu64
+		" B), %" PRIu64 " empty, %" PRIu64 " timeouts\n",
+		stats->usb_writes, stats->bytes_out, stats->usb_reads, stats->bytes_in,
+		stats->empty_reads, stats->timeouts);
+	fprintf(f, "flushes: %" PRIu64 " auto, %" PRIu64 " forced; nacks: %" PRIu64 "\n",
+		stats->auto_flushes, stats->forced_flushes, stats->nacks);
+	fprintf(f, "round trips: %" PRIu64, stats->round_trips);
+	if (stats->round_trips)
+		fprintf(f, ", avg %.1f us, max %.1f us",
+			stats->rtt_total_ns / 1e3 / stats->round_trips, stats->rtt_max_ns / 1e3);
+	fprintf(f, "\n");
+
+	for (unsigned int a = 0; a < FTDI_MPSSE_RTT_BUCKETS; a++) {
+		if (!stats->rtt_hist[a])
+			continue;
+		if (!a)
+			fprintf(f, "\t     < 1 us");
+		else if (a == FTDI_MPSSE_RTT_BUCKETS - 1)
+			fprintf(f, "\t>= %6u us", 1U << (a - 1));
+		else
+			fprintf(f, "\t< %7u us", 1U << a);
+		fprintf(f, ": %" PRIu64 "\n", stats->rtt_hist[a]);
+	}
+}
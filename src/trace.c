@@ -0,0 +1,192 @@
+/*
+ * Licensed under the GPLv2
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+struct ftdi_mpsse_trace {
+	uint8_t *ring;
+	size_t size;
+	size_t head;		/* next write */
+	size_t tail;		/* oldest record */
+	size_t used;
+	uint64_t dropped;
+	char *file;
+};
+
+static void ftdi_trace_put(struct ftdi_mpsse_trace *trace, const void *src, size_t len)
+{
+	size_t now = min(len, trace->size - trace->head);
+
+	memcpy(trace->ring + trace->head, src, now);
+	memcpy(trace->ring, (const uint8_t *)src + now, len - now);
+	trace->head = (trace->head + len) % trace->size;
+	trace->used += len;
+}
+
+static void ftdi_trace_get(const struct ftdi_mpsse_trace *trace, size_t off, void *dst,
+			   size_t len)
+{
+	size_t now = min(len, trace->size - off);
+
+	memcpy(dst, trace->ring + off, now);
+	memcpy((uint8_t *)dst + now, trace->ring, len - now);
+}
+
+void ftdi_mpsse_trace_record(struct ftdi_mpsse *ftdi_mpsse, enum ftdi_trace_dir dir,
+			     const uint8_t *buf, size_t len)
+{
+	struct ftdi_mpsse_trace *trace = ftdi_mpsse->trace;
+	struct ftdi_trace_record rec = {
+		.ts_ns = ftdi_mpsse_now_ns(),
+		.dir = dir,
+	};
+
+	if (sizeof(rec) + len > trace->size) {
+		len = trace->size - sizeof(rec);
+		rec.truncated = 1;
+	}
+	rec.len = len;
+
+	/* make room by dropping the oldest records */
+	while (trace->size - trace->used < sizeof(rec) + len) {
+		struct ftdi_trace_record old;
+		size_t old_size;
+
+		ftdi_trace_get(trace, trace->tail, &old, sizeof(old));
+		old_size = sizeof(old) + old.len;
+		trace->tail = (trace->tail + old_size) % trace->size;
+		trace->used -= old_size;
+		trace->dropped++;
+	}
+
+	ftdi_trace_put(trace, &rec, sizeof(rec));
+	ftdi_trace_put(trace, buf, len);
+}
+
+int ftdi_mpsse_trace_start(struct ftdi_mpsse *ftdi_mpsse, size_t size)
+{
+	struct ftdi_mpsse_trace *trace = ftdi_mpsse->trace;
+
+	if (size < 4 * sizeof(struct ftdi_trace_record))
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "trace ring too small: %zu",
+					      size);
+
+	if (!trace) {
+		trace = calloc(1, sizeof(*trace));
+		if (!trace)
+			return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+						      "cannot allocate the trace");
+	}
+
+	if (trace->size != size) {
+		uint8_t *ring = realloc(trace->ring, size);
+
+		if (!ring) {
+			if (!ftdi_mpsse->trace)
+				free(trace);
+			return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+						      "cannot allocate the trace ring (%zu B)",
+						      size);
+		}
+		trace->ring = ring;
+		trace->size = size;
+	}
+
+	trace->head = trace->tail = trace->used = 0;
+	trace->dropped = 0;
+	ftdi_mpsse->trace = trace;
+
+	return 0;
+}
+
+void ftdi_mpsse_trace_stop(struct ftdi_mpsse *ftdi_mpsse)
+{
+	struct ftdi_mpsse_trace *trace = ftdi_mpsse->trace;
+
+	if (!trace)
+		return;
+
+	ftdi_mpsse->trace = NULL;
+	free(trace->ring);
+	free(trace->file);
+	free(trace);
+}
+
+int ftdi_mpsse_trace_dump(struct ftdi_mpsse *ftdi_mpsse, const char *path)
+{
+	const struct ftdi_mpsse_trace *trace = ftdi_mpsse->trace;
+	struct ftdi_trace_header hdr = {
+		.magic = FTDI_TRACE_MAGIC,
+		.version = FTDI_TRACE_VERSION,
+		.speed = ftdi_mpsse->speed,
+	};
+	size_t now;
+	FILE *f;
+	int ret = 0;
+
+	if (!trace)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "tracing not started");
+
+	f = fopen(path, "wb");
+	if (!f)
+		return ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "cannot open %s: %s", path,
+					      strerror(errno));
+
+	hdr.dropped = trace->dropped;
+	now = min(trace->used, trace->size - trace->tail);
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(trace->ring + trace->tail, 1, now, f) != now ||
+	    fwrite(trace->ring, 1, trace->used - now, f) != trace->used - now)
+		ret = ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "cannot write %s: %s", path,
+					     strerror(errno));
+
+	if (fclose(f) && !ret)
+		ret = ftdi_mpsse_store_error(ftdi_mpsse, -1, false, "cannot write %s: %s", path,
+					     strerror(errno));
+
+	return ret;
+}
+
+/* the configured trace_file is dumped by ftdi_mpsse_trace_close() */
+int ftdi_mpsse_trace_init(struct ftdi_mpsse *ftdi_mpsse, const struct ftdi_mpsse_config *conf)
+{
+	int ret;
+
+	if (!conf->trace_size)
+		return 0;
+
+	ret = ftdi_mpsse_trace_start(ftdi_mpsse, conf->trace_size);
+	if (ret < 0)
+		return ret;
+
+	if (conf->trace_file) {
+		ftdi_mpsse->trace->file = strdup(conf->trace_file);
+		if (!ftdi_mpsse->trace->file) {
+			ftdi_mpsse_trace_stop(ftdi_mpsse);
+			return ftdi_mpsse_store_error(ftdi_mpsse, -1, false,
+						      "cannot allocate the trace file name");
+		}
+	}
+
+	return 0;
+}
+
+void ftdi_mpsse_trace_close(struct ftdi_mpsse *ftdi_mpsse)
+{
+	char error_buf[sizeof(ftdi_mpsse->error_buf)];
+
+	if (ftdi_mpsse->trace && ftdi_mpsse->trace->file) {
+		/* keep the error which led to the close */
+		memcpy(error_buf, ftdi_mpsse->error_buf, sizeof(error_buf));
+		if (ftdi_mpsse_trace_dump(ftdi_mpsse, ftdi_mpsse->trace->file) < 0)
+			fprintf(stderr, "%s: %s\n", __func__, ftdi_mpsse->error_buf);
+		memcpy(ftdi_mpsse->error_buf, error_buf, sizeof(error_buf));
+	}
+
+	ftdi_mpsse_trace_stop(ftdi_mpsse);
+}
@@ -15,6 +15,14 @@ static void usage(const char *prgname)
 	fprintf(stderr, "Usage: %s [-c <channel>] [-g <gpio_settings>] <commands>\n",
 		prgname);
 	fprintf(stderr, "\n");
+	fprintf(stderr, "-A -- follow clock stretching, SCL wired to GPIOL1 and GPIOL3 (FT232H only)\n");
+	fprintf(stderr, "-E -- run against the MPSSE emulator, no adapter needed\n");
+	fprintf(stderr, "-P <bus-path> -- select the adapter by its USB path (e.g. 1-2.4)\n");
+	fprintf(stderr, "-S <serial> -- select the adapter by its serial number\n");
+	fprintf(stderr, "-n -- use the clock nearest to the speed, even if faster\n");
+	fprintf(stderr, "-T <file> -- trace the MPSSE streams to <file>, see ftdi_trace\n");
+	fprintf(stderr, "-w -- reuse a chip still in MPSSE mode, skipping the reset\n");
+	fprintf(stderr, "\n");
 	fprintf(stderr, "Commands:\n");
 	fprintf(stderr, "\ta<address> -- set address to <address>\n");
 	fprintf(stderr, "\tc -- commit stored W values below (multiwrite)\n");
@@ -74,42 +82,66 @@ static bool i2c_read(struct ftdi_mpsse *ftdi_mpsse, uint8_t address,
 static bool i2c_write(struct ftdi_mpsse *ftdi_mpsse, uint8_t address,
 		     uint8_t *buf, unsigned int count)
 {
-	int ret = ftdi_i2c_begin(ftdi_mpsse, address, true);
-	if (ret < 0) {
-		warnx("%s (%d): %s\n", __func__, __LINE__, ftdi_mpsse_get_error(ftdi_mpsse));
-		return false;
-	}
+	int nack, ret;
+
+	/* queue everything and check the ACKs once at the end */
+	ftdi_i2c_set_posted(ftdi_mpsse, true);
+
+	ret = ftdi_i2c_begin(ftdi_mpsse, address, true);
+	if (ret < 0)
+		goto err;
 
 	hex_dump("Write:", buf, count);
 	for (unsigned i = 0; i < count; i++) {
 		ret = ftdi_i2c_send_check_ack(ftdi_mpsse, buf[i]);
-		if (ret < 0) {
-			warnx("%s (%d): %s\n", __func__, __LINE__,
-			      ftdi_mpsse_get_error(ftdi_mpsse));
-			return false;
-		}
+		if (ret < 0)
+			goto err;
 	}
 
-	ret = ftdi_i2c_end(ftdi_mpsse);
+	ret = ftdi_i2c_commit(ftdi_mpsse, &nack);
 	if (ret < 0) {
-		warnx("%s (%d): %s\n", __func__, __LINE__, ftdi_mpsse_get_error(ftdi_mpsse));
-		return false;
+		if (nack > 0)
+			warnx("%s: value %u (0x%.2x) not acknowledged", __func__, nack - 1,
+			      buf[nack - 1]);
+		goto err;
 	}
 
+	ret = ftdi_i2c_end(ftdi_mpsse);
+	if (ret < 0)
+		goto err;
+
+	ftdi_i2c_set_posted(ftdi_mpsse, false);
+
 	return true;
+err:
+	warnx("%s (%d): %s\n", __func__, __LINE__, ftdi_mpsse_get_error(ftdi_mpsse));
+	ftdi_i2c_set_posted(ftdi_mpsse, false);
+	return false;
 }
 
 int main(int argc, char **argv)
 {
 	const struct option longopts[] = {
+		{ "clock-stretch", 0, NULL, 'A' },
+		{ "emulate", 0, NULL, 'E' },
 		{ "gpio", 1, NULL, 'g' },
 		{ "gpio-dir", 1, NULL, 'G' },
 		{ "interface", 1, NULL, 'i' },
+		{ "latency", 1, NULL, 'L' },
+		{ "nearest", 0, NULL, 'n' },
+		{ "bus-path", 1, NULL, 'P' },
+		{ "serial", 1, NULL, 'S' },
 		{ "loops-after-read-ack", 1, NULL, 'l' },
+		{ "open-drain", 0, NULL, 'o' },
 		{ "speed", 1, NULL, 's' },
+		{ "trace", 1, NULL, 'T' },
 		{ "verbose", 1, NULL, 'v' },
+		{ "warm", 0, NULL, 'w' },
 		{}
 	};
+	struct ftdi_emu_config emu_conf = {
+		.tied = { BIT(1) | BIT(2) },	/* SDA on DO and DI */
+	};
 	struct ftdi_mpsse ftdi_mpsse;
 	struct ftdi_mpsse_config conf = {
 		  .iface = INTERFACE_ANY,
@@ -120,8 +152,16 @@ int main(int argc, char **argv)
 	const char *prgname = argv[0];
 	int ret;
 
-	while ((ret = getopt_long(argc, argv, "g:G:i:l:s:v", longopts, NULL)) >= 0) {
+	while ((ret = getopt_long(argc, argv, "AEg:G:i:l:L:noP:s:S:T:vw", longopts, NULL)) >= 0) {
 		switch (ret) {
+		case 'A':
+			conf.i2c_clock_stretch = true;
+			emu_conf.tied[1] = BIT(0) | BIT(5) | BIT(7);	/* SCL on SK, GPIOL1/3 */
+			break;
+		case 'E':
+			conf.transport = &ftdi_mpsse_transport_emu;
+			conf.transport_conf = &emu_conf;
+			break;
 		case 'g':
 			unsigned int gpio;
 
@@ -150,6 +190,25 @@ int main(int argc, char **argv)
 				return EXIT_FAILURE;
 			conf.loops_after_read_ack = loops;
 			break;
+		case 'L':
+			unsigned int latency;
+
+			if (!strtol_and_check(latency, optarg))
+				return EXIT_FAILURE;
+			conf.latency_timer = latency;
+			break;
+		case 'o':
+			conf.i2c_open_drain = true;
+			break;
+		case 'n':
+			conf.clock_mode = FTDI_MPSSE_CLOCK_NEAREST;
+			break;
+		case 'P':
+			conf.bus_path = optarg;
+			break;
+		case 'S':
+			conf.serial = optarg;
+			break;
 		case 's':
 			unsigned int speed;
 
@@ -158,9 +217,16 @@ int main(int argc, char **argv)
 
 			conf.speed = speed;
 			break;
+		case 'T':
+			conf.trace_size = 1 << 20;
+			conf.trace_file = optarg;
+			break;
 		case 'v':
 			verbose = true;
 			break;
+		case 'w':
+			conf.warm_attach = true;
+			break;
 		case -1:
 			break;
 		default:
@@ -186,6 +252,23 @@ int main(int argc, char **argv)
 		errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
 		     ftdi_mpsse_get_error(&ftdi_mpsse));
 
+	if (verbose) {
+		struct ftdi_i2c_timing t;
+
+		printf("init: %.3f ms (%s), clock %u Hz\n",
+		       ftdi_mpsse_get_init_ns(&ftdi_mpsse) / 1e6,
+		       ftdi_mpsse_is_warm(&ftdi_mpsse) ? "warm" : "cold",
+		       ftdi_mpsse_get_speed(&ftdi_mpsse));
+
+		ftdi_i2c_get_timing(&ftdi_mpsse, &t);
+		printf("timing: START %u+%u, STOP %u+%u+%u cycles of %u ns\n",
+		       t.su_sta_cycles, t.hd_sta_cycles, t.low_cycles, t.su_sto_cycles,
+		       t.buf_cycles, t.set_pins_ns);
+	}
+
+	/* count the commands only, not the init */
+	ftdi_mpsse_reset_stats(&ftdi_mpsse);
+
 	uint8_t *wbuf = NULL;
 	unsigned int wbuf_size = 0;
 	unsigned int wbuf_count = 0;
@@ -255,6 +338,16 @@ int main(int argc, char **argv)
 
 	free(wbuf);
 
+	if (verbose) {
+		struct ftdi_i2c_wire_stats stats;
+
+		ftdi_i2c_get_wire_stats(&ftdi_mpsse, &stats);
+		printf("wire: %llu MPSSE bytes for %llu I2C bytes\n",
+		       (unsigned long long)stats.mpsse_bytes,
+		       (unsigned long long)stats.i2c_bytes);
+		ftdi_mpsse_print_stats(&ftdi_mpsse, stdout);
+	}
+
 	ftdi_i2c_close(&ftdi_mpsse);
 
 	return EXIT_SUCCESS;
@@ -5,6 +5,7 @@
 #include <getopt.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <time.h>
 
 #include <ftdi_mpsse.h>
 
@@ -13,16 +14,86 @@
 static void usage(const char *prgname)
 {
 	fprintf(stderr, "Usage: %s [-c <channel>] [-g <gpio_settings>] <value>\n", prgname);
+	fprintf(stderr, "       %s [-c <channel>] [-g <gpio_settings>] -b <bytes>\n", prgname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "-a -- use the asynchronous transport\n");
+	fprintf(stderr, "-b -- compare throughput of the synchronous and asynchronous transport\n");
+	fprintf(stderr, "-E -- run against the MPSSE emulator, no adapter needed\n");
+	fprintf(stderr, "-P <bus-path> -- select the adapter by its USB path (e.g. 1-2.4)\n");
+	fprintf(stderr, "-S <serial> -- select the adapter by its serial number\n");
+	fprintf(stderr, "-n -- use the clock nearest to the speed, even if faster\n");
+	fprintf(stderr, "-T <file> -- trace the MPSSE streams to <file>, see ftdi_trace\n");
+	fprintf(stderr, "-w -- reuse a chip still in MPSSE mode, skipping the reset\n");
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(struct ftdi_mpsse_config *conf, unsigned int bytes)
+{
+	uint8_t *buf = calloc(bytes, 1);
+	int ret;
+
+	if (!buf)
+		err(EXIT_FAILURE, "cannot allocate memory");
+
+	for (unsigned int async = 0; async < 2; async++) {
+		struct ftdi_mpsse ftdi_mpsse;
+		double start, wr, rd;
+
+		conf->async = async;
+		ret = ftdi_spi_init(&ftdi_mpsse, conf);
+		if (ret < 0)
+			errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
+			     ftdi_mpsse_get_error(&ftdi_mpsse));
+
+		start = now_s();
+		ret = ftdi_spi_write(&ftdi_mpsse, buf, bytes);
+		if (ret < 0)
+			errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
+			     ftdi_mpsse_get_error(&ftdi_mpsse));
+		wr = now_s() - start;
+
+		start = now_s();
+		ret = ftdi_spi_read(&ftdi_mpsse, buf, bytes);
+		if (ret < 0)
+			errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
+			     ftdi_mpsse_get_error(&ftdi_mpsse));
+		rd = now_s() - start;
+
+		ftdi_spi_close(&ftdi_mpsse);
+
+		printf("%-5s: write %u B in %.3f s (%.1f kB/s), read %u B in %.3f s (%.1f kB/s)\n",
+		       async ? "async" : "sync", bytes, wr, bytes / wr / 1000,
+		       bytes, rd, bytes / rd / 1000);
+	}
+
+	free(buf);
 }
 
 int main(int argc, char **argv)
 {
 	const struct option longopts[] = {
+		{ "async", 0, NULL, 'a' },
+		{ "bench", 1, NULL, 'b' },
+		{ "emulate", 0, NULL, 'E' },
 		{ "gpio", 1, NULL, 'g' },
 		{ "gpio-dir", 1, NULL, 'G' },
 		{ "interface", 1, NULL, 'i' },
+		{ "latency", 1, NULL, 'L' },
+		{ "nearest", 0, NULL, 'n' },
+		{ "bus-path", 1, NULL, 'P' },
+		{ "serial", 1, NULL, 'S' },
 		{ "speed", 1, NULL, 's' },
+		{ "trace", 1, NULL, 'T' },
 		{ "verbose", 1, NULL, 'v' },
+		{ "warm", 0, NULL, 'w' },
 		{}
 	};
 	struct ftdi_mpsse ftdi_mpsse;
@@ -30,12 +101,23 @@ int main(int argc, char **argv)
 		  .iface = INTERFACE_ANY,
 		  .speed = FTDI_I2C_SPD_STD,
 	};
+	unsigned int bench_bytes = 0;
 	bool verbose = false;
 	const char *prgname = argv[0];
 	int ret;
 
-	while ((ret = getopt_long(argc, argv, "g:G:i:l:s:v", longopts, NULL)) >= 0) {
+	while ((ret = getopt_long(argc, argv, "ab:Eg:G:i:l:L:nP:s:S:T:vw", longopts, NULL)) >= 0) {
 		switch (ret) {
+		case 'a':
+			conf.async = true;
+			break;
+		case 'b':
+			if (!strtol_and_check(bench_bytes, optarg))
+				return EXIT_FAILURE;
+			break;
+		case 'E':
+			conf.transport = &ftdi_mpsse_transport_emu;
+			break;
 		case 'g':
 			unsigned int gpio;
 
@@ -57,6 +139,22 @@ int main(int argc, char **argv)
 				return EXIT_FAILURE;
 			conf.iface = interface;
 			break;
+		case 'L':
+			unsigned int latency;
+
+			if (!strtol_and_check(latency, optarg))
+				return EXIT_FAILURE;
+			conf.latency_timer = latency;
+			break;
+		case 'n':
+			conf.clock_mode = FTDI_MPSSE_CLOCK_NEAREST;
+			break;
+		case 'P':
+			conf.bus_path = optarg;
+			break;
+		case 'S':
+			conf.serial = optarg;
+			break;
 		case 's':
 			unsigned int speed;
 
@@ -65,9 +163,16 @@ int main(int argc, char **argv)
 
 			conf.speed = speed;
 			break;
+		case 'T':
+			conf.trace_size = 1 << 20;
+			conf.trace_file = optarg;
+			break;
 		case 'v':
 			verbose = true;
 			break;
+		case 'w':
+			conf.warm_attach = true;
+			break;
 		case -1:
 			break;
 		default:
@@ -79,6 +184,11 @@ int main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
+	if (bench_bytes) {
+		bench(&conf, bench_bytes);
+		return EXIT_SUCCESS;
+	}
+
 	if (argc < 1) {
 		usage(prgname);
 		return EXIT_FAILURE;
@@ -98,12 +208,24 @@ int main(int argc, char **argv)
 		errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
 		     ftdi_mpsse_get_error(&ftdi_mpsse));
 
+	if (verbose)
+		printf("init: %.3f ms (%s), clock %u Hz\n",
+		       ftdi_mpsse_get_init_ns(&ftdi_mpsse) / 1e6,
+		       ftdi_mpsse_is_warm(&ftdi_mpsse) ? "warm" : "cold",
+		       ftdi_mpsse_get_speed(&ftdi_mpsse));
+
+	/* count the transfer only, not the init */
+	ftdi_mpsse_reset_stats(&ftdi_mpsse);
+
 	uint8_t c = val;
 	ret = ftdi_spi_sendrecv(&ftdi_mpsse, &c);
 	if (ret < 0)
 		errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
 		     ftdi_mpsse_get_error(&ftdi_mpsse));
 
+	if (verbose)
+		ftdi_mpsse_print_stats(&ftdi_mpsse, stdout);
+
 	ftdi_spi_close(&ftdi_mpsse);
 
 	printf("Wrote: 0x%.2x\n", val);
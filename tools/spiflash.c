@@ -0,0 +1,348 @@
+/*
+ * Licensed under the GPLv2
+ */
+#include <err.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ftdi_mpsse.h>
+
+#include "utils.h"
+
+static void usage(const char *prgname)
+{
+	fprintf(stderr, "Usage: %s [options] read <file>\n", prgname);
+	fprintf(stderr, "       %s [options] write <file>\n", prgname);
+	fprintf(stderr, "       %s [options] erase\n", prgname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "write erases the 4 KiB sectors covering the file, then programs and verifies\n");
+	fprintf(stderr, "them with the file and the data they held before and after it\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "-E -- run against the MPSSE emulator (with a W25Q128), no adapter needed\n");
+	fprintf(stderr, "-l <length> -- bytes to read or erase (default: the size from the JEDEC ID)\n");
+	fprintf(stderr, "-o <offset> -- start address (default 0)\n");
+	fprintf(stderr, "-P <bus-path> -- select the adapter by its USB path (e.g. 1-2.4)\n");
+	fprintf(stderr, "-S <serial> -- select the adapter by its serial number\n");
+	fprintf(stderr, "-s <speed> -- SPI clock in Hz (default %u)\n", FTDI_SPI_SPD_MAX);
+	fprintf(stderr, "-n -- use the clock nearest to the speed, even if faster\n");
+	fprintf(stderr, "-T <file> -- trace the MPSSE streams to <file>, see ftdi_trace\n");
+	fprintf(stderr, "-v -- print the throughput and the transport statistics\n");
+	fprintf(stderr, "-w -- reuse a chip still in MPSSE mode, skipping the reset\n");
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the file is mapped, the flash is read straight into the page cache */
+static bool flash_read(struct ftdi_mpsse *ftdi_mpsse, const char *path, unsigned int offset,
+		       unsigned int length, bool verbose)
+{
+	double start;
+	uint8_t *map;
+	int fd, ret;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		warn("cannot open %s", path);
+		return false;
+	}
+
+	if (ftruncate(fd, length) < 0) {
+		warn("cannot resize %s", path);
+		close(fd);
+		return false;
+	}
+
+	map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		warn("cannot map %s", path);
+		return false;
+	}
+
+	start = now_s();
+	ret = ftdi_spiflash_read(ftdi_mpsse, offset, map, length);
+	if (ret < 0) {
+		warnx("%s (%d): %s\n", __func__, __LINE__, ftdi_mpsse_get_error(ftdi_mpsse));
+		munmap(map, length);
+		return false;
+	}
+
+	if (verbose) {
+		double t = now_s() - start;
+
+		printf("read %u B in %.3f s (%.1f kB/s)\n", length, t, length / t / 1000);
+	}
+
+	munmap(map, length);
+
+	return true;
+}
+
+static bool flash_erase(struct ftdi_mpsse *ftdi_mpsse, unsigned int offset, unsigned int length,
+			bool verbose)
+{
+	double start = now_s();
+	int ret;
+
+	ret = ftdi_spiflash_erase(ftdi_mpsse, offset, length);
+	if (ret < 0) {
+		warnx("%s (%d): %s\n", __func__, __LINE__, ftdi_mpsse_get_error(ftdi_mpsse));
+		return false;
+	}
+
+	if (verbose)
+		printf("erased %u B in %.3f s\n", length, now_s() - start);
+
+	return true;
+}
+
+/*
+ * The sectors are erased whole: what they hold around the file is read first
+ * and programmed back with it.
+ */
+static bool flash_write(struct ftdi_mpsse *ftdi_mpsse, const char *path, unsigned int offset,
+			bool verbose)
+{
+	unsigned int erase_start, erase_end, head, tail, size;
+	struct stat st;
+	double start;
+	uint8_t *map, *buf = NULL;
+	bool ok = false;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		warn("cannot open %s", path);
+		return false;
+	}
+
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		warnx("%s: empty or not a file", path);
+		close(fd);
+		return false;
+	}
+
+	if (offset > FTDI_SPIFLASH_MAX_SIZE || st.st_size > FTDI_SPIFLASH_MAX_SIZE - offset) {
+		warnx("%s: does not fit at 0x%x", path, offset);
+		close(fd);
+		return false;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		warn("cannot map %s", path);
+		return false;
+	}
+
+	erase_start = offset & ~0xfffU;
+	erase_end = (offset + st.st_size + 0xfff) & ~0xfffU;
+	size = erase_end - erase_start;
+	head = offset - erase_start;
+	tail = erase_end - offset - st.st_size;
+
+	buf = malloc(size);
+	if (!buf) {
+		warnx("cannot allocate %u B", size);
+		goto unmap;
+	}
+
+	ret = 0;
+	if (head)
+		ret = ftdi_spiflash_read(ftdi_mpsse, erase_start, buf, head);
+	if (ret >= 0 && tail)
+		ret = ftdi_spiflash_read(ftdi_mpsse, erase_end - tail, buf + size - tail, tail);
+	if (ret < 0) {
+		warnx("%s (%d): %s\n", __func__, __LINE__, ftdi_mpsse_get_error(ftdi_mpsse));
+		goto unmap;
+	}
+	memcpy(buf + head, map, st.st_size);
+
+	if (!flash_erase(ftdi_mpsse, erase_start, size, verbose))
+		goto unmap;
+
+	start = now_s();
+	ret = ftdi_spiflash_write(ftdi_mpsse, erase_start, buf, size);
+	if (ret < 0) {
+		warnx("%s (%d): %s\n", __func__, __LINE__, ftdi_mpsse_get_error(ftdi_mpsse));
+		goto unmap;
+	}
+
+	if (verbose) {
+		double t = now_s() - start;
+
+		printf("programmed %u B in %.3f s (%.1f kB/s)\n", size, t, size / t / 1000);
+	}
+
+	ret = ftdi_spiflash_verify(ftdi_mpsse, erase_start, buf, size);
+	if (ret < 0) {
+		warnx("%s (%d): %s\n", __func__, __LINE__, ftdi_mpsse_get_error(ftdi_mpsse));
+		goto unmap;
+	}
+
+	ok = true;
+unmap:
+	free(buf);
+	munmap(map, st.st_size);
+
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	const struct option longopts[] = {
+		{ "emulate", 0, NULL, 'E' },
+		{ "interface", 1, NULL, 'i' },
+		{ "length", 1, NULL, 'l' },
+		{ "latency", 1, NULL, 'L' },
+		{ "nearest", 0, NULL, 'n' },
+		{ "offset", 1, NULL, 'o' },
+		{ "bus-path", 1, NULL, 'P' },
+		{ "serial", 1, NULL, 'S' },
+		{ "speed", 1, NULL, 's' },
+		{ "trace", 1, NULL, 'T' },
+		{ "verbose", 0, NULL, 'v' },
+		{ "warm", 0, NULL, 'w' },
+		{}
+	};
+	struct ftdi_mpsse ftdi_mpsse;
+	struct ftdi_mpsse_config conf = {
+		  .iface = INTERFACE_ANY,
+		  .speed = FTDI_SPI_SPD_MAX,
+	};
+	struct ftdi_emu_device *emu_dev = NULL;
+	struct ftdi_emu_config emu_conf = {};
+	unsigned int offset = 0, length = 0, size;
+	bool verbose = false, ok;
+	const char *prgname = argv[0];
+	uint32_t jedec_id;
+	int ret;
+
+	while ((ret = getopt_long(argc, argv, "Ei:l:L:no:P:s:S:T:vw", longopts, NULL)) >= 0) {
+		switch (ret) {
+		case 'E':
+			emu_dev = ftdi_emu_spinor_new(0xef4018, 16 << 20);
+			if (!emu_dev)
+				errx(EXIT_FAILURE, "cannot allocate the flash model");
+			emu_conf.devices = &emu_dev;
+			emu_conf.num_devices = 1;
+			conf.transport = &ftdi_mpsse_transport_emu;
+			conf.transport_conf = &emu_conf;
+			break;
+		case 'i':
+			unsigned int interface;
+
+			if (!strtol_and_check(interface, optarg))
+				return EXIT_FAILURE;
+			conf.iface = interface;
+			break;
+		case 'l':
+			if (!strtol_and_check(length, optarg))
+				return EXIT_FAILURE;
+			break;
+		case 'L':
+			unsigned int latency;
+
+			if (!strtol_and_check(latency, optarg))
+				return EXIT_FAILURE;
+			conf.latency_timer = latency;
+			break;
+		case 'n':
+			conf.clock_mode = FTDI_MPSSE_CLOCK_NEAREST;
+			break;
+		case 'o':
+			if (!strtol_and_check(offset, optarg))
+				return EXIT_FAILURE;
+			break;
+		case 'P':
+			conf.bus_path = optarg;
+			break;
+		case 'S':
+			conf.serial = optarg;
+			break;
+		case 's':
+			unsigned int speed;
+
+			if (!strtol_and_check(speed, optarg))
+				return EXIT_FAILURE;
+
+			conf.speed = speed;
+			break;
+		case 'T':
+			conf.trace_size = 1 << 20;
+			conf.trace_file = optarg;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'w':
+			conf.warm_attach = true;
+			break;
+		default:
+			usage(prgname);
+			return EXIT_FAILURE;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (!(argc == 2 && (!strcmp(argv[0], "read") || !strcmp(argv[0], "write"))) &&
+	    !(argc == 1 && !strcmp(argv[0], "erase"))) {
+		usage(prgname);
+		return EXIT_FAILURE;
+	}
+
+	ret = ftdi_spi_init(&ftdi_mpsse, &conf);
+	if (ret < 0)
+		errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
+		     ftdi_mpsse_get_error(&ftdi_mpsse));
+
+	ret = ftdi_spiflash_read_id(&ftdi_mpsse, &jedec_id);
+	if (ret < 0)
+		errx(EXIT_FAILURE, "%s (%d): %s\n", __func__, __LINE__,
+		     ftdi_mpsse_get_error(&ftdi_mpsse));
+
+	size = ftdi_spiflash_size(jedec_id);
+	printf("JEDEC ID 0x%06x, %u KiB, clock %u Hz\n", jedec_id, size >> 10,
+	       ftdi_mpsse_get_speed(&ftdi_mpsse));
+
+	if (!length && strcmp(argv[0], "write")) {
+		if (!size || offset >= size)
+			errx(EXIT_FAILURE, "unknown flash size, pass -l");
+		length = size - offset;
+	}
+
+	ftdi_mpsse_reset_stats(&ftdi_mpsse);
+
+	if (!strcmp(argv[0], "read"))
+		ok = flash_read(&ftdi_mpsse, argv[1], offset, length, verbose);
+	else if (!strcmp(argv[0], "write"))
+		ok = flash_write(&ftdi_mpsse, argv[1], offset, verbose);
+	else
+		ok = flash_erase(&ftdi_mpsse, offset, length, verbose);
+
+	if (verbose)
+		ftdi_mpsse_print_stats(&ftdi_mpsse, stdout);
+
+	ftdi_spi_close(&ftdi_mpsse);
+	ftdi_emu_device_free(emu_dev);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
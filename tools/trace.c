@@ -0,0 +1,578 @@
+/*
+ * Licensed under the GPLv2
+ *
+ * Decoder of the binary traces written by ftdi_mpsse_trace_dump(): turns the
+ * MPSSE command stream back into opcodes, I2C or SPI transactions.
+ */
+#include <err.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <ftdi_mpsse.h>
+
+#include "mpsse_reg.h"
+#include "utils.h"
+
+#define I2C_SCL		BIT(0)
+#define I2C_SDA		BIT(1)
+#define SPI_CS		BIT(3)
+
+enum mode {
+	MODE_RAW,
+	MODE_I2C,
+	MODE_SPI,
+};
+
+/* one direction of the trace, each byte with the time of its USB transfer */
+struct stream {
+	uint8_t *data;
+	uint64_t *ts;
+	size_t cnt;
+	size_t size;
+	size_t pos;
+};
+
+struct cmd {
+	uint64_t ts;
+	uint64_t rx_ts;
+	uint8_t op;
+	unsigned int arg;
+	unsigned int bits;		/* clock commands, bit mode */
+	const uint8_t *out;
+	size_t out_len;
+	const uint8_t *in;		/* NULL if the reply is not in the trace */
+	size_t in_len;
+};
+
+struct decoder {
+	enum mode mode;
+	uint64_t t0;
+	struct stream tx, rx;
+
+	/* I2C and SPI */
+	bool in_xfer;
+	uint64_t xfer_ts, xfer_rx_ts;
+	/* I2C */
+	bool scl, sda;
+	bool expect_address;
+	/* SPI */
+	struct stream mosi, miso;
+};
+
+static void stream_add(struct stream *s, const uint8_t *buf, size_t len, uint64_t ts)
+{
+	if (s->cnt + len > s->size) {
+		s->size = max(s->size * 2, s->cnt + len);
+		s->data = realloc(s->data, s->size);
+		s->ts = realloc(s->ts, s->size * sizeof(*s->ts));
+		if (!s->data || !s->ts)
+			err(EXIT_FAILURE, "cannot allocate %zu B", s->size);
+	}
+
+	memcpy(s->data + s->cnt, buf, len);
+	for (size_t a = 0; a < len; a++)
+		s->ts[s->cnt + a] = ts;
+	s->cnt += len;
+}
+
+static const uint8_t *stream_take(struct stream *s, size_t len, uint64_t *ts)
+{
+	const uint8_t *p;
+
+	if (s->pos + len > s->cnt)
+		return NULL;
+
+	p = s->data + s->pos;
+	if (ts)
+		*ts = s->ts[s->pos + len - 1];
+	s->pos += len;
+
+	return p;
+}
+
+static void load(struct decoder *dec, const char *path)
+{
+	struct ftdi_trace_header hdr;
+	struct ftdi_trace_record rec;
+	uint8_t *buf = NULL;
+	size_t buf_size = 0;
+	bool first = true;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		err(EXIT_FAILURE, "cannot open %s", path);
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    memcmp(hdr.magic, FTDI_TRACE_MAGIC, sizeof(hdr.magic)))
+		errx(EXIT_FAILURE, "%s: not an MPSSE trace", path);
+	if (hdr.version != FTDI_TRACE_VERSION)
+		errx(EXIT_FAILURE, "%s: unsupported version %u", path, hdr.version);
+
+	printf("bus clock %u Hz\n", hdr.speed);
+	if (hdr.dropped)
+		printf("ring overflowed, %" PRIu64 " records lost: the first replies may be misplaced\n",
+		       hdr.dropped);
+
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		if (rec.len > buf_size) {
+			buf_size = rec.len;
+			buf = realloc(buf, buf_size);
+			if (!buf)
+				err(EXIT_FAILURE, "cannot allocate %zu B", buf_size);
+		}
+		if (fread(buf, 1, rec.len, f) != rec.len)
+			errx(EXIT_FAILURE, "%s: truncated record", path);
+		if (rec.truncated)
+			printf("a %u B record was cut, decoding may go astray\n", rec.len);
+
+		/* replies whose commands were dropped from the ring */
+		if (first && rec.dir == FTDI_TRACE_RX)
+			continue;
+		if (first) {
+			dec->t0 = rec.ts_ns;
+			first = false;
+		}
+		stream_add(rec.dir == FTDI_TRACE_TX ? &dec->tx : &dec->rx, buf, rec.len,
+			   rec.ts_ns);
+	}
+
+	free(buf);
+	fclose(f);
+}
+
+/* Parse one command and take its reply from the RX stream */
+static bool next_cmd(struct decoder *dec, struct cmd *cmd)
+{
+	struct stream *tx = &dec->tx;
+	size_t start = tx->pos;
+	const uint8_t *p;
+	size_t in_len = 0;
+
+	memset(cmd, 0, sizeof(*cmd));
+	if (tx->pos >= tx->cnt)
+		return false;
+
+	cmd->ts = tx->ts[tx->pos];
+	cmd->op = tx->data[tx->pos++];
+
+#define ARGS(n)	do { p = stream_take(tx, n, NULL); if (!p) goto partial; } while (0)
+	if (!(cmd->op & 0x80)) {
+		if (cmd->op & 0x40) {			/* TMS */
+			ARGS(2);
+			cmd->bits = p[0] + 1;
+			cmd->out = p + 1;
+			cmd->out_len = 1;
+			in_len = cmd->op & CMD_IN ? 1 : 0;
+		} else if (cmd->op & CMD_BIT) {
+			ARGS(1);
+			cmd->bits = p[0] + 1;
+			if (cmd->op & CMD_OUT) {
+				ARGS(1);
+				cmd->out = p;
+				cmd->out_len = 1;
+			}
+			in_len = cmd->op & CMD_IN ? 1 : 0;
+		} else {
+			ARGS(2);
+			cmd->arg = (p[0] | p[1] << 8) + 1;
+			if (cmd->op & CMD_OUT) {
+				ARGS(cmd->arg);
+				cmd->out = p;
+				cmd->out_len = cmd->arg;
+			}
+			in_len = cmd->op & CMD_IN ? cmd->arg : 0;
+		}
+	} else {
+		switch (cmd->op) {
+		case CMD_SET_BITS_LOW:
+		case CMD_SET_BITS_HIGH:
+		case CMD_DRIVE_ONLY_ZERO:
+			ARGS(2);
+			cmd->out = p;
+			cmd->out_len = 2;
+			break;
+		case CMD_SET_CLK_DIVISOR:
+			ARGS(2);
+			cmd->arg = p[0] | p[1] << 8;
+			break;
+		case CMD_CLK_BITS:
+			ARGS(1);
+			cmd->bits = p[0] + 1;
+			break;
+		case CMD_CLK_BYTES:
+			ARGS(2);
+			cmd->arg = (p[0] | p[1] << 8) + 1;
+			break;
+		case CMD_GET_BITS_LOW:
+		case CMD_GET_BITS_HIGH:
+			in_len = 1;
+			break;
+		case CMD_LOOPBACK_EN:
+		case CMD_LOOPBACK_DIS:
+		case CMD_SEND_IMMEDIATE:
+		case CMD_CLK_DIV5_DIS:
+		case CMD_CLK_DIV5_EN:
+		case CMD_CLK_3PHASE_EN:
+		case CMD_CLK_3PHASE_DIS:
+		case CMD_CLK_ADAPTIVE_EN:
+		case CMD_CLK_ADAPTIVE_DIS:
+		case CMD_WAIT_ON_IO_HIGH:
+		case CMD_WAIT_ON_IO_LOW:
+			break;
+		case CMD_ECHO1:
+			/* the synchronization: whatever precedes 0xfa 0xaa is stale */
+			for (size_t a = dec->rx.pos; a + 1 < dec->rx.cnt; a++) {
+				if (dec->rx.data[a] == CMD_INVALID &&
+				    dec->rx.data[a + 1] == CMD_ECHO1) {
+					dec->rx.pos = a;
+					break;
+				}
+			}
+			in_len = 2;
+			break;
+		default:
+			/* the chip answers 0xfa <opcode> */
+			in_len = 2;
+			break;
+		}
+	}
+#undef ARGS
+
+	if (in_len) {
+		cmd->in = stream_take(&dec->rx, in_len, &cmd->rx_ts);
+		cmd->in_len = in_len;
+	}
+
+	return true;
+
+partial:
+	tx->pos = start;
+	return false;
+}
+
+static void print_ts(const struct decoder *dec, uint64_t ts)
+{
+	printf("%12.3f ms  ", (ts - dec->t0) / 1e6);
+}
+
+static void print_rx_delay(const struct cmd *cmd)
+{
+	if (cmd->in)
+		printf(" (reply +%.1f us)", (cmd->rx_ts - cmd->ts) / 1e3);
+	else if (cmd->in_len)
+		printf(" (no reply)");
+}
+
+static void print_hex(const uint8_t *buf, size_t len)
+{
+	for (size_t a = 0; a < len; a++)
+		printf(" %02x", buf[a]);
+}
+
+static const char *cmd_name(uint8_t op)
+{
+	switch (op) {
+	case CMD_LOOPBACK_EN:		return "LOOPBACK_EN";
+	case CMD_LOOPBACK_DIS:		return "LOOPBACK_DIS";
+	case CMD_SEND_IMMEDIATE:	return "SEND_IMMEDIATE";
+	case CMD_WAIT_ON_IO_HIGH:	return "WAIT_ON_IO_HIGH";
+	case CMD_WAIT_ON_IO_LOW:	return "WAIT_ON_IO_LOW";
+	case CMD_CLK_DIV5_DIS:		return "CLK_DIV5_DIS";
+	case CMD_CLK_DIV5_EN:		return "CLK_DIV5_EN";
+	case CMD_CLK_3PHASE_EN:		return "CLK_3PHASE_EN";
+	case CMD_CLK_3PHASE_DIS:	return "CLK_3PHASE_DIS";
+	case CMD_CLK_ADAPTIVE_EN:	return "CLK_ADAPTIVE_EN";
+	case CMD_CLK_ADAPTIVE_DIS:	return "CLK_ADAPTIVE_DIS";
+	}
+
+	return "?";
+}
+
+static void print_raw(const struct decoder *dec, const struct cmd *cmd)
+{
+	print_ts(dec, cmd->ts);
+
+	if (!(cmd->op & 0x80)) {
+		printf("%02x %s%s%s%s", cmd->op, cmd->op & 0x40 ? "TMS" : "CLK",
+		       cmd->op & CMD_OUT ? " out" : "", cmd->op & CMD_IN ? " in" : "",
+		       cmd->op & CMD_LSB ? " lsb" : "");
+		if (cmd->bits)
+			printf(" %u bits", cmd->bits);
+		else
+			printf(" %u bytes", cmd->arg);
+		if (cmd->out) {
+			printf(", out");
+			print_hex(cmd->out, cmd->out_len);
+		}
+		if (cmd->in) {
+			printf(", in");
+			print_hex(cmd->in, cmd->in_len);
+		}
+		print_rx_delay(cmd);
+		printf("\n");
+		return;
+	}
+
+	switch (cmd->op) {
+	case CMD_SET_BITS_LOW:
+	case CMD_SET_BITS_HIGH:
+		printf("%02x SET_BITS_%s value=%02x dir=%02x\n", cmd->op,
+		       cmd->op == CMD_SET_BITS_LOW ? "LOW" : "HIGH", cmd->out[0], cmd->out[1]);
+		return;
+	case CMD_GET_BITS_LOW:
+	case CMD_GET_BITS_HIGH:
+		printf("%02x GET_BITS_%s", cmd->op, cmd->op == CMD_GET_BITS_LOW ? "LOW" : "HIGH");
+		if (cmd->in)
+			printf(" -> %02x", cmd->in[0]);
+		break;
+	case CMD_DRIVE_ONLY_ZERO:
+		printf("%02x DRIVE_ONLY_ZERO low=%02x high=%02x\n", cmd->op, cmd->out[0],
+		       cmd->out[1]);
+		return;
+	case CMD_SET_CLK_DIVISOR:
+		printf("%02x SET_CLK_DIVISOR %04x\n", cmd->op, cmd->arg);
+		return;
+	case CMD_CLK_BITS:
+		printf("%02x CLK_BITS %u bits, no data\n", cmd->op, cmd->bits);
+		return;
+	case CMD_CLK_BYTES:
+		printf("%02x CLK_BYTES %u bytes, no data\n", cmd->op, cmd->arg);
+		return;
+	case CMD_LOOPBACK_EN:
+	case CMD_LOOPBACK_DIS:
+	case CMD_SEND_IMMEDIATE:
+	case CMD_CLK_DIV5_DIS:
+	case CMD_CLK_DIV5_EN:
+	case CMD_CLK_3PHASE_EN:
+	case CMD_CLK_3PHASE_DIS:
+	case CMD_CLK_ADAPTIVE_EN:
+	case CMD_CLK_ADAPTIVE_DIS:
+	case CMD_WAIT_ON_IO_HIGH:
+	case CMD_WAIT_ON_IO_LOW:
+		printf("%02x %s\n", cmd->op, cmd_name(cmd->op));
+		return;
+	default:
+		printf("%02x %s", cmd->op, cmd->op == CMD_ECHO1 ? "ECHO (bad command)" :
+		       "unknown");
+		if (cmd->in)
+			printf(" ->%s", cmd->in[0] == CMD_INVALID ? " bad command" : "");
+		break;
+	}
+
+	print_rx_delay(cmd);
+	printf("\n");
+}
+
+static void xfer_begin(struct decoder *dec, const struct cmd *cmd)
+{
+	dec->in_xfer = true;
+	dec->xfer_ts = cmd->ts;
+	dec->xfer_rx_ts = 0;
+	print_ts(dec, cmd->ts);
+}
+
+static void xfer_end(struct decoder *dec)
+{
+	if (dec->xfer_rx_ts)
+		printf("  (replies +%.1f us)", (dec->xfer_rx_ts - dec->xfer_ts) / 1e3);
+	printf("\n");
+	dec->in_xfer = false;
+}
+
+static void xfer_reply(struct decoder *dec, const struct cmd *cmd)
+{
+	if (cmd->in)
+		dec->xfer_rx_ts = max(dec->xfer_rx_ts, cmd->rx_ts);
+}
+
+static void decode_i2c(struct decoder *dec, const struct cmd *cmd)
+{
+	if (cmd->op == CMD_SET_BITS_LOW) {
+		uint8_t val = cmd->out[0], dir = cmd->out[1];
+		/* released lines are pulled up */
+		bool scl = !(dir & I2C_SCL) || (val & I2C_SCL);
+		bool sda = !(dir & I2C_SDA) || (val & I2C_SDA);
+
+		if (dec->scl && scl && dec->sda && !sda) {
+			if (dec->in_xfer) {
+				printf(" Sr");
+			} else {
+				xfer_begin(dec, cmd);
+				printf("S");
+			}
+			dec->expect_address = true;
+		} else if (dec->scl && scl && !dec->sda && sda && dec->in_xfer) {
+			printf(" P");
+			xfer_end(dec);
+		}
+		dec->scl = scl;
+		dec->sda = sda;
+		return;
+	}
+
+	if ((cmd->op & 0xc0) || !cmd->bits || !dec->in_xfer) {
+		/* the clock setup and the like */
+		if (!dec->in_xfer && (cmd->op & 0x80) && cmd->op != CMD_SEND_IMMEDIATE)
+			print_raw(dec, cmd);
+		return;
+	}
+
+	xfer_reply(dec, cmd);
+
+	if (cmd->bits == 8) {
+		uint8_t c = cmd->in ? cmd->in[0] : cmd->out ? cmd->out[0] : 0;
+		bool missing = (cmd->op & CMD_IN) && !cmd->in;
+
+		if (dec->expect_address)
+			printf(" %02x%s", c >> 1, c & 1 ? "R" : "W");
+		else if (missing)
+			printf(" ??");
+		else
+			printf(" %02x", c);
+		dec->expect_address = false;
+	} else if (cmd->bits == 1) {
+		bool nack;
+
+		/* from the slave if read, else from us */
+		if (cmd->op & CMD_IN)
+			nack = cmd->in ? cmd->in[0] & BIT(0) : true;
+		else
+			nack = cmd->out[0] & 0x80;
+		printf(" %s", (cmd->op & CMD_IN) && !cmd->in ? "?" : nack ? "N" : "A");
+	}
+}
+
+/* at most 32 bytes per direction, unless verbose */
+static void spi_print(const char *name, const struct stream *s, bool verbose)
+{
+	size_t len = verbose ? s->cnt : min(s->cnt, (size_t)32);
+
+	if (!s->cnt)
+		return;
+
+	printf(" %s", name);
+	print_hex(s->data, len);
+	if (len < s->cnt)
+		printf(" ... (%zu B)", s->cnt);
+}
+
+static void decode_spi(struct decoder *dec, const struct cmd *cmd, bool verbose)
+{
+	if (cmd->op == CMD_SET_BITS_LOW) {
+		uint8_t val = cmd->out[0], dir = cmd->out[1];
+		bool cs = (dir & SPI_CS) && !(val & SPI_CS);
+
+		if (cs && !dec->in_xfer) {
+			xfer_begin(dec, cmd);
+			printf("CS");
+			dec->mosi.cnt = dec->miso.cnt = 0;
+		} else if (!cs && dec->in_xfer) {
+			spi_print("MOSI", &dec->mosi, verbose);
+			spi_print("MISO", &dec->miso, verbose);
+			xfer_end(dec);
+		}
+		return;
+	}
+
+	if ((cmd->op & 0x80) || !dec->in_xfer) {
+		if (!dec->in_xfer && (cmd->op & 0x80) && cmd->op != CMD_SEND_IMMEDIATE)
+			print_raw(dec, cmd);
+		return;
+	}
+
+	xfer_reply(dec, cmd);
+	if (cmd->out)
+		stream_add(&dec->mosi, cmd->out, cmd->out_len, cmd->ts);
+	if (cmd->in)
+		stream_add(&dec->miso, cmd->in, cmd->in_len, cmd->rx_ts);
+}
+
+static void usage(const char *prgname)
+{
+	fprintf(stderr, "Usage: %s [-m raw|i2c|spi] [-v] <trace file>\n", prgname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "-m <mode> -- decode opcodes (raw, default), I2C or SPI transactions\n");
+	fprintf(stderr, "-v -- print whole SPI transfers, not only their start\n");
+}
+
+int main(int argc, char **argv)
+{
+	const struct option longopts[] = {
+		{ "mode", 1, NULL, 'm' },
+		{ "verbose", 0, NULL, 'v' },
+		{}
+	};
+	struct decoder dec = {
+		.scl = true,
+		.sda = true,
+	};
+	const char *prgname = argv[0];
+	bool verbose = false;
+	struct cmd cmd;
+	int ret;
+
+	while ((ret = getopt_long(argc, argv, "m:v", longopts, NULL)) >= 0) {
+		switch (ret) {
+		case 'm':
+			if (!strcmp(optarg, "raw"))
+				dec.mode = MODE_RAW;
+			else if (!strcmp(optarg, "i2c"))
+				dec.mode = MODE_I2C;
+			else if (!strcmp(optarg, "spi"))
+				dec.mode = MODE_SPI;
+			else
+				errx(EXIT_FAILURE, "invalid mode \"%s\"", optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(prgname);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind + 1 != argc) {
+		usage(prgname);
+		return EXIT_FAILURE;
+	}
+
+	load(&dec, argv[optind]);
+
+	while (next_cmd(&dec, &cmd)) {
+		switch (dec.mode) {
+		case MODE_RAW:
+			print_raw(&dec, &cmd);
+			break;
+		case MODE_I2C:
+			decode_i2c(&dec, &cmd);
+			break;
+		case MODE_SPI:
+			decode_spi(&dec, &cmd, verbose);
+			break;
+		}
+	}
+
+	if (dec.in_xfer) {
+		printf(" (trace ends)");
+		xfer_end(&dec);
+	}
+	if (dec.tx.pos < dec.tx.cnt)
+		printf("%zu B of a partial command at the end\n", dec.tx.cnt - dec.tx.pos);
+	if (dec.rx.pos < dec.rx.cnt)
+		printf("%zu B received but not matched to a command\n", dec.rx.cnt - dec.rx.pos);
+
+	free(dec.tx.data);
+	free(dec.tx.ts);
+	free(dec.rx.data);
+	free(dec.rx.ts);
+	free(dec.mosi.data);
+	free(dec.mosi.ts);
+	free(dec.miso.data);
+	free(dec.miso.ts);
+
+	return EXIT_SUCCESS;
+}
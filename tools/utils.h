@@ -10,6 +10,7 @@
 #include <string.h>
 
 #define max(x, y)	((x) < (y) ? (y) : (x))
+#define min(x, y)	((x) < (y) ? (x) : (y))
 
 static inline bool _strtol_and_check(unsigned int *val, const char *what, const char *from)
 {